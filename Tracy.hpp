@@ -16,6 +16,11 @@
 #define ZoneScopedC(x)
 #define ZoneScopedNC(x,y)
 
+#define ZoneNamedAggregate(x,y)
+#define ZoneNamedAggregateN(x,y,z)
+#define ZoneScopedAggregate
+#define ZoneScopedAggregateN(x)
+
 #define ZoneText(x,y)
 #define ZoneName(x,y)
 
@@ -91,6 +96,11 @@
 #define ZoneScopedC( color ) ZoneNamedC( ___tracy_scoped_zone, color, true )
 #define ZoneScopedNC( name, color ) ZoneNamedNC( ___tracy_scoped_zone, name, color, true )
 
+#define ZoneNamedAggregate( varname, active ) static const tracy::SourceLocationData TracyConcat(__tracy_source_location,__LINE__) { nullptr, __FUNCTION__,  __FILE__, (uint32_t)__LINE__, 0 }; tracy::AggregatedZone varname( &TracyConcat(__tracy_source_location,__LINE__), active );
+#define ZoneNamedAggregateN( varname, name, active ) static const tracy::SourceLocationData TracyConcat(__tracy_source_location,__LINE__) { name, __FUNCTION__,  __FILE__, (uint32_t)__LINE__, 0 }; tracy::AggregatedZone varname( &TracyConcat(__tracy_source_location,__LINE__), active );
+#define ZoneScopedAggregate ZoneNamedAggregate( ___tracy_aggregated_zone, true )
+#define ZoneScopedAggregateN( name ) ZoneNamedAggregateN( ___tracy_aggregated_zone, name, true )
+
 #define ZoneText( txt, size ) ___tracy_scoped_zone.Text( txt, size );
 #define ZoneName( txt, size ) ___tracy_scoped_zone.Name( txt, size );
 
@@ -120,17 +130,11 @@
 #  define TracyMessageL( txt ) tracy::Profiler::Message( txt, TRACY_CALLSTACK );
 #  define TracyMessageC( txt, size, color ) tracy::Profiler::MessageColor( txt, size, color, TRACY_CALLSTACK );
 #  define TracyMessageLC( txt, color ) tracy::Profiler::MessageColor( txt, color, TRACY_CALLSTACK );
-
-#  define TracyAlloc( ptr, size ) tracy::Profiler::MemAllocCallstack( ptr, size, TRACY_CALLSTACK );
-#  define TracyFree( ptr ) tracy::Profiler::MemFreeCallstack( ptr, TRACY_CALLSTACK );
 #else
 #  define TracyMessage( txt, size ) tracy::Profiler::Message( txt, size, 0 );
 #  define TracyMessageL( txt ) tracy::Profiler::Message( txt, 0 );
 #  define TracyMessageC( txt, size, color ) tracy::Profiler::MessageColor( txt, size, color, 0 );
 #  define TracyMessageLC( txt, color ) tracy::Profiler::MessageColor( txt, color, 0 );
-
-#  define TracyAlloc( ptr, size ) tracy::Profiler::MemAlloc( ptr, size );
-#  define TracyFree( ptr ) tracy::Profiler::MemFree( ptr );
 #endif
 
 #ifdef TRACY_HAS_CALLSTACK
@@ -144,9 +148,6 @@
 #  define ZoneScopedCS( color, depth ) ZoneNamedCS( ___tracy_scoped_zone, color, depth, true )
 #  define ZoneScopedNCS( name, color, depth ) ZoneNamedNCS( ___tracy_scoped_zone, name, color depth, true )
 
-#  define TracyAllocS( ptr, size, depth ) tracy::Profiler::MemAllocCallstack( ptr, size, depth );
-#  define TracyFreeS( ptr, depth ) tracy::Profiler::MemFreeCallstack( ptr, depth );
-
 #  define TracyMessageS( txt, size, depth ) tracy::Profiler::Message( txt, size, depth );
 #  define TracyMessageLS( txt, depth ) tracy::Profiler::Message( txt, depth );
 #  define TracyMessageCS( txt, size, color, depth ) tracy::Profiler::MessageColor( txt, size, color, depth );
@@ -162,15 +163,34 @@
 #  define ZoneScopedCS( color, depth ) ZoneScopedC( color )
 #  define ZoneScopedNCS( name, color, depth ) ZoneScopedNC( name, color )
 
-#  define TracyAllocS( ptr, size, depth ) TracyAlloc( ptr, size )
-#  define TracyFreeS( ptr, depth ) TracyFree( ptr )
-
 #  define TracyMessageS( txt, size, depth ) TracyMessage( txt, size )
 #  define TracyMessageLS( txt, depth ) TracyMessageL( txt )
 #  define TracyMessageCS( txt, size, color, depth ) TracyMessageC( txt, size, color )
 #  define TracyMessageLCS( txt, color, depth ) TracyMessageLC( txt, color )
 #endif
 
+#if defined TRACY_MEMORY_SAMPLING
+#  define TracyAlloc( ptr, size ) tracy::Profiler::MemAllocSampled( ptr, size, TRACY_MEMORY_SAMPLING_DEPTH );
+#  define TracyFree( ptr ) tracy::Profiler::MemFreeSampled( ptr, TRACY_MEMORY_SAMPLING_DEPTH );
+#  define TracyAllocS( ptr, size, depth ) tracy::Profiler::MemAllocSampled( ptr, size, depth );
+#  define TracyFreeS( ptr, depth ) tracy::Profiler::MemFreeSampled( ptr, depth );
+#elif defined TRACY_HAS_CALLSTACK && defined TRACY_CALLSTACK
+#  define TracyAlloc( ptr, size ) tracy::Profiler::MemAllocCallstack( ptr, size, TRACY_CALLSTACK );
+#  define TracyFree( ptr ) tracy::Profiler::MemFreeCallstack( ptr, TRACY_CALLSTACK );
+#  define TracyAllocS( ptr, size, depth ) tracy::Profiler::MemAllocCallstack( ptr, size, depth );
+#  define TracyFreeS( ptr, depth ) tracy::Profiler::MemFreeCallstack( ptr, depth );
+#elif defined TRACY_HAS_CALLSTACK
+#  define TracyAlloc( ptr, size ) tracy::Profiler::MemAlloc( ptr, size );
+#  define TracyFree( ptr ) tracy::Profiler::MemFree( ptr );
+#  define TracyAllocS( ptr, size, depth ) tracy::Profiler::MemAllocCallstack( ptr, size, depth );
+#  define TracyFreeS( ptr, depth ) tracy::Profiler::MemFreeCallstack( ptr, depth );
+#else
+#  define TracyAlloc( ptr, size ) tracy::Profiler::MemAlloc( ptr, size );
+#  define TracyFree( ptr ) tracy::Profiler::MemFree( ptr );
+#  define TracyAllocS( ptr, size, depth ) TracyAlloc( ptr, size )
+#  define TracyFreeS( ptr, depth ) TracyFree( ptr )
+#endif
+
 #define TracyParameterRegister( cb ) tracy::Profiler::ParameterRegister( cb );
 #define TracyParameterSetup( idx, name, isBool, val ) tracy::Profiler::ParameterSetup( idx, name, isBool, val );
 
@@ -81,6 +81,7 @@ typedef /*const*/ struct ___tracy_c_zone_context TracyCZoneCtx;
 
 TRACY_API uint64_t ___tracy_alloc_srcloc( uint32_t line, const char* source, const char* function );
 TRACY_API uint64_t ___tracy_alloc_srcloc_name( uint32_t line, const char* source, const char* function, const char* name, size_t nameSz );
+TRACY_API const struct ___tracy_source_location_data* ___tracy_intern_srcloc( uint32_t line, const char* source, size_t sourceSz, const char* function, size_t functionSz, const char* name, size_t nameSz, uint32_t color );
 
 TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin( const struct ___tracy_source_location_data* srcloc, int active );
 TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin_callstack( const struct ___tracy_source_location_data* srcloc, int depth, int active );
@@ -142,6 +142,17 @@ TRACY_API LuaZoneState& GetLuaZoneState();
 namespace detail
 {
 
+// Source locations are interned, so that zones may use the plain zone begin
+// events, without allocating and transferring a source location each time.
+static tracy_force_inline uint64_t LuaSourceLocation( lua_State* L, const char* name, size_t nameSz )
+{
+    lua_Debug dbg;
+    lua_getstack( L, 1, &dbg );
+    lua_getinfo( L, "Snl", &dbg );
+    const auto func = dbg.name ? dbg.name : dbg.short_src;
+    return uint64_t( Profiler::InternSourceLocation( dbg.currentline, dbg.source, strlen( dbg.source ), func, strlen( func ), name, nameSz ) );
+}
+
 #ifdef TRACY_HAS_CALLSTACK
 static tracy_force_inline void SendLuaCallstack( lua_State* L, uint32_t depth )
 {
@@ -194,12 +205,9 @@ static inline int LuaZoneBeginS( lua_State* L )
     if( !GetLuaZoneState().active ) return 0;
 #endif
 
-    lua_Debug dbg;
-    lua_getstack( L, 1, &dbg );
-    lua_getinfo( L, "Snl", &dbg );
-    const auto srcloc = Profiler::AllocSourceLocation( dbg.currentline, dbg.source, dbg.name ? dbg.name : dbg.short_src );
+    const auto srcloc = LuaSourceLocation( L, nullptr, 0 );
 
-    TracyLfqPrepare( QueueType::ZoneBeginAllocSrcLocCallstack );
+    TracyLfqPrepare( QueueType::ZoneBeginCallstack );
     MemWrite( &item->zoneBegin.time, Profiler::GetTime() );
     MemWrite( &item->zoneBegin.srcloc, srcloc );
     TracyLfqCommit;
@@ -223,14 +231,11 @@ static inline int LuaZoneBeginNS( lua_State* L )
     if( !GetLuaZoneState().active ) return 0;
 #endif
 
-    lua_Debug dbg;
-    lua_getstack( L, 1, &dbg );
-    lua_getinfo( L, "Snl", &dbg );
     size_t nsz;
     const auto name = lua_tolstring( L, 1, &nsz );
-    const auto srcloc = Profiler::AllocSourceLocation( dbg.currentline, dbg.source, dbg.name ? dbg.name : dbg.short_src, name, nsz );
+    const auto srcloc = LuaSourceLocation( L, name, nsz );
 
-    TracyLfqPrepare( QueueType::ZoneBeginAllocSrcLocCallstack );
+    TracyLfqPrepare( QueueType::ZoneBeginCallstack );
     MemWrite( &item->zoneBegin.time, Profiler::GetTime() );
     MemWrite( &item->zoneBegin.srcloc, srcloc );
     TracyLfqCommit;
@@ -258,12 +263,9 @@ static inline int LuaZoneBegin( lua_State* L )
     if( !GetLuaZoneState().active ) return 0;
 #endif
 
-    lua_Debug dbg;
-    lua_getstack( L, 1, &dbg );
-    lua_getinfo( L, "Snl", &dbg );
-    const auto srcloc = Profiler::AllocSourceLocation( dbg.currentline, dbg.source, dbg.name ? dbg.name : dbg.short_src );
+    const auto srcloc = LuaSourceLocation( L, nullptr, 0 );
 
-    TracyLfqPrepare( QueueType::ZoneBeginAllocSrcLoc );
+    TracyLfqPrepare( QueueType::ZoneBegin );
     MemWrite( &item->zoneBegin.time, Profiler::GetTime() );
     MemWrite( &item->zoneBegin.srcloc, srcloc );
     TracyLfqCommit;
@@ -283,14 +285,11 @@ static inline int LuaZoneBeginN( lua_State* L )
     if( !GetLuaZoneState().active ) return 0;
 #endif
 
-    lua_Debug dbg;
-    lua_getstack( L, 1, &dbg );
-    lua_getinfo( L, "Snl", &dbg );
     size_t nsz;
     const auto name = lua_tolstring( L, 1, &nsz );
-    const auto srcloc = Profiler::AllocSourceLocation( dbg.currentline, dbg.source, dbg.name ? dbg.name : dbg.short_src, name, nsz );
+    const auto srcloc = LuaSourceLocation( L, name, nsz );
 
-    TracyLfqPrepare( QueueType::ZoneBeginAllocSrcLoc );
+    TracyLfqPrepare( QueueType::ZoneBegin );
     MemWrite( &item->zoneBegin.time, Profiler::GetTime() );
     MemWrite( &item->zoneBegin.srcloc, srcloc );
     TracyLfqCommit;
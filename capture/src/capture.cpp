@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string>
 
 #include "../../common/TracyProtocol.hpp"
 #include "../../server/TracyFileWrite.hpp"
@@ -27,7 +28,7 @@ void SigInt( int )
 
 void Usage()
 {
-    printf( "Usage: capture -o output.tracy [-a address] [-p port]\n" );
+    printf( "Usage: capture -o output.tracy [-a address] [-p port] [-b buffers] [-m limit]\n" );
     exit( 1 );
 }
 
@@ -44,9 +45,11 @@ int main( int argc, char** argv )
     const char* address = "localhost";
     const char* output = nullptr;
     int port = 8086;
+    int buffers = tracy::Worker::DefaultRecvFrames;
+    size_t memLimit = 0;
 
     int c;
-    while( ( c = getopt( argc, argv, "a:o:p:" ) ) != -1 )
+    while( ( c = getopt( argc, argv, "a:o:p:b:m:" ) ) != -1 )
     {
         switch( c )
         {
@@ -59,6 +62,12 @@ int main( int argc, char** argv )
         case 'p':
             port = atoi( optarg );
             break;
+        case 'b':
+            buffers = atoi( optarg );
+            break;
+        case 'm':
+            memLimit = size_t( atoll( optarg ) ) * 1024 * 1024;
+            break;
         default:
             Usage();
             break;
@@ -67,9 +76,18 @@ int main( int argc, char** argv )
 
     if( !address || !output ) Usage();
 
+    if( memLimit != 0 )
+    {
+        std::string path = output;
+        const auto sep = path.find_last_of( "/\\" );
+        path = sep == std::string::npos ? "." : path.substr( 0, sep );
+        tracy::SetSpillPath( path.c_str() );
+        tracy::memLimit = memLimit;
+    }
+
     printf( "Connecting to %s:%i...", address, port );
     fflush( stdout );
-    tracy::Worker worker( address, port );
+    tracy::Worker worker( address, port, buffers );
     while( !worker.IsConnected() )
     {
         const auto handshake = worker.GetHandshakeStatus();
@@ -156,6 +174,14 @@ int main( int argc, char** argv )
         f->Finish();
         const auto stats = f->GetCompressionStatistics();
         printf( "Trace size %s (%.2f%% ratio)\n", tracy::MemSizeToString( stats.second ), 100.f * stats.second / stats.first );
+        const auto large = tracy::memStats.large.load( std::memory_order_relaxed );
+        if( large != 0 )
+        {
+            printf( "Large allocations: %s (%s), huge page backed: %s (%s), spilled: %s (%s)\n",
+                tracy::RealToString( large ), tracy::MemSizeToString( tracy::memStats.largeBytes.load( std::memory_order_relaxed ) ),
+                tracy::RealToString( tracy::memStats.huge.load( std::memory_order_relaxed ) ), tracy::MemSizeToString( tracy::memStats.hugeBytes.load( std::memory_order_relaxed ) ),
+                tracy::RealToString( tracy::memStats.spill.load( std::memory_order_relaxed ) ), tracy::MemSizeToString( tracy::memStats.spillBytes.load( std::memory_order_relaxed ) ) );
+        }
     }
     else
     {
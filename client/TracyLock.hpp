@@ -64,24 +64,20 @@ public:
         if( !queue ) return false;
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockWait );
-        MemWrite( &item->lockWait.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockWait );
         MemWrite( &item->lockWait.id, m_id );
         MemWrite( &item->lockWait.time, Profiler::GetTime() );
         MemWrite( &item->lockWait.type, LockType::Lockable );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
         return true;
     }
 
     tracy_force_inline void AfterLock()
     {
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockObtain );
-        MemWrite( &item->lockObtain.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockObtain );
         MemWrite( &item->lockObtain.id, m_id );
         MemWrite( &item->lockObtain.time, Profiler::GetTime() );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void AfterUnlock()
@@ -96,12 +92,10 @@ public:
         }
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockRelease );
-        MemWrite( &item->lockRelease.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockRelease );
         MemWrite( &item->lockRelease.id, m_id );
         MemWrite( &item->lockRelease.time, Profiler::GetTime() );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void AfterTryLock( bool acquired )
@@ -123,12 +117,10 @@ public:
 
         if( acquired )
         {
-            auto item = Profiler::QueueSerial();
-            MemWrite( &item->hdr.type, QueueType::LockObtain );
-            MemWrite( &item->lockObtain.thread, GetThreadHandle() );
+            TracyLfqPrepare( QueueType::LockObtain );
             MemWrite( &item->lockObtain.id, m_id );
             MemWrite( &item->lockObtain.time, Profiler::GetTime() );
-            Profiler::QueueSerialFinish();
+            TracyLfqCommit;
         }
     }
 
@@ -145,12 +137,10 @@ public:
         }
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockMark );
-        MemWrite( &item->lockMark.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockMark );
         MemWrite( &item->lockMark.id, m_id );
         MemWrite( &item->lockMark.srcloc, (uint64_t)srcloc );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void CustomName( const char* name, size_t size )
@@ -281,24 +271,20 @@ public:
         if( !queue ) return false;
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockWait );
-        MemWrite( &item->lockWait.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockWait );
         MemWrite( &item->lockWait.id, m_id );
         MemWrite( &item->lockWait.time, Profiler::GetTime() );
         MemWrite( &item->lockWait.type, LockType::SharedLockable );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
         return true;
     }
 
     tracy_force_inline void AfterLock()
     {
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockObtain );
-        MemWrite( &item->lockObtain.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockObtain );
         MemWrite( &item->lockObtain.id, m_id );
         MemWrite( &item->lockObtain.time, Profiler::GetTime() );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void AfterUnlock()
@@ -313,12 +299,10 @@ public:
         }
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockRelease );
-        MemWrite( &item->lockRelease.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockRelease );
         MemWrite( &item->lockRelease.id, m_id );
         MemWrite( &item->lockRelease.time, Profiler::GetTime() );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void AfterTryLock( bool acquired )
@@ -340,12 +324,10 @@ public:
 
         if( acquired )
         {
-            auto item = Profiler::QueueSerial();
-            MemWrite( &item->hdr.type, QueueType::LockObtain );
-            MemWrite( &item->lockObtain.thread, GetThreadHandle() );
+            TracyLfqPrepare( QueueType::LockObtain );
             MemWrite( &item->lockObtain.id, m_id );
             MemWrite( &item->lockObtain.time, Profiler::GetTime() );
-            Profiler::QueueSerialFinish();
+            TracyLfqCommit;
         }
     }
 
@@ -364,24 +346,20 @@ public:
         if( !queue ) return false;
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockSharedWait );
-        MemWrite( &item->lockWait.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockSharedWait );
         MemWrite( &item->lockWait.id, m_id );
         MemWrite( &item->lockWait.time, Profiler::GetTime() );
         MemWrite( &item->lockWait.type, LockType::SharedLockable );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
         return true;
     }
 
     tracy_force_inline void AfterLockShared()
     {
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockSharedObtain );
-        MemWrite( &item->lockObtain.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockSharedObtain );
         MemWrite( &item->lockObtain.id, m_id );
         MemWrite( &item->lockObtain.time, Profiler::GetTime() );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void AfterUnlockShared()
@@ -396,12 +374,10 @@ public:
         }
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockSharedRelease );
-        MemWrite( &item->lockRelease.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockSharedRelease );
         MemWrite( &item->lockRelease.id, m_id );
         MemWrite( &item->lockRelease.time, Profiler::GetTime() );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void AfterTryLockShared( bool acquired )
@@ -423,12 +399,10 @@ public:
 
         if( acquired )
         {
-            auto item = Profiler::QueueSerial();
-            MemWrite( &item->hdr.type, QueueType::LockSharedObtain );
-            MemWrite( &item->lockObtain.thread, GetThreadHandle() );
+            TracyLfqPrepare( QueueType::LockSharedObtain );
             MemWrite( &item->lockObtain.id, m_id );
             MemWrite( &item->lockObtain.time, Profiler::GetTime() );
-            Profiler::QueueSerialFinish();
+            TracyLfqCommit;
         }
     }
 
@@ -445,12 +419,10 @@ public:
         }
 #endif
 
-        auto item = Profiler::QueueSerial();
-        MemWrite( &item->hdr.type, QueueType::LockMark );
-        MemWrite( &item->lockMark.thread, GetThreadHandle() );
+        TracyLfqPrepare( QueueType::LockMark );
         MemWrite( &item->lockMark.id, m_id );
         MemWrite( &item->lockMark.srcloc, (uint64_t)srcloc );
-        Profiler::QueueSerialFinish();
+        TracyLfqCommit;
     }
 
     tracy_force_inline void CustomName( const char* name, size_t size )
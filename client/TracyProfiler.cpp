@@ -42,6 +42,8 @@
 #include <atomic>
 #include <chrono>
 #include <limits>
+#include <math.h>
+#include <mutex>
 #include <new>
 #include <stdlib.h>
 #include <string.h>
@@ -237,6 +239,32 @@ static int64_t SetupHwTimer()
 
     return Profiler::GetTime();
 }
+
+// The timer is recalibrated more often if TSC may be unreliable. This is the
+// case when it is not invariant, when running under a hypervisor, where TSC
+// may be emulated or the VM may be migrated, or when the kernel itself has
+// stopped using TSC as a clock source.
+static bool IsTscReliable()
+{
+#ifndef TRACY_TIMER_QPC
+    uint32_t regs[4];
+    CpuId( regs, 0x80000007 );
+    if( !( regs[3] & ( 1 << 8 ) ) ) return false;
+    CpuId( regs, 1 );
+    if( regs[2] & ( 1u << 31 ) ) return false;
+#  if defined __linux__ && !defined __ANDROID__
+    FILE* f = fopen( "/sys/devices/system/clocksource/clocksource0/current_clocksource", "rb" );
+    if( f )
+    {
+        char buf[16] = {};
+        const auto sz = fread( buf, 1, 15, f );
+        fclose( f );
+        if( sz < 3 || memcmp( buf, "tsc", 3 ) != 0 ) return false;
+    }
+#  endif
+#endif
+    return true;
+}
 #else
 static int64_t SetupHwTimer()
 {
@@ -870,6 +898,9 @@ enum { QueuePrealloc = 256 * 1024 };
 static Profiler* s_instance;
 static Thread* s_thread;
 static Thread* s_compressThread;
+#ifdef TRACY_QUEUE_BUDGET
+static Thread* s_budgetThread;
+#endif
 
 #ifdef TRACY_HAS_SYSTEM_TRACING
 static Thread* s_sysTraceThread = nullptr;
@@ -1020,6 +1051,270 @@ TRACY_API LuaZoneState& GetLuaZoneState() { return s_luaZoneState; }
 #  endif
 #endif
 
+// Zone aggregates of the current thread. Plain data, so that no constructor
+// or destructor has to run on the hot path. States are kept on a list, so
+// that the profiler thread can send intervals of threads which stopped
+// hitting aggregated zones. The lock guards the state against that.
+enum { ZoneAggregateSlots = 8 };
+
+struct ZoneAggregateState
+{
+    int64_t deadline;
+    uint64_t connection;
+    uint64_t thread;
+    ZoneAggregateState* prev;
+    ZoneAggregateState* next;
+    std::atomic<uint32_t> lock;
+    uint32_t used;
+    bool registered;
+    QueueZoneAggregateEntry entry[ZoneAggregateSlots];
+};
+
+static thread_local ZoneAggregateState s_zoneAggregateState;
+
+static std::atomic<int> s_zoneAggregateListLock { 0 };
+static ZoneAggregateState* s_zoneAggregateList = nullptr;
+
+static tracy_force_inline void LockZoneAggregates( std::atomic<int>& lock )
+{
+    int expected = 0;
+    while( !lock.compare_exchange_weak( expected, 1, std::memory_order_acquire, std::memory_order_relaxed ) ) { expected = 0; }
+}
+
+static tracy_force_inline void LockZoneAggregates( std::atomic<uint32_t>& lock )
+{
+    while( lock.exchange( 1, std::memory_order_acquire ) != 0 ) {}
+}
+
+static tracy_force_inline int ZoneAggregateBucket( int64_t dt )
+{
+    if( dt <= 1 ) return 0;
+#if defined __GNUC__ || defined __clang__
+    const int bucket = 63 - __builtin_clzll( uint64_t( dt ) );
+#elif defined _MSC_VER && ( defined _M_X64 || defined _M_ARM64 )
+    unsigned long idx;
+    _BitScanReverse64( &idx, uint64_t( dt ) );
+    const int bucket = int( idx );
+#else
+    int bucket = 0;
+    while( dt >>= 1 ) bucket++;
+#endif
+    return bucket < ZoneAggregateBuckets ? bucket : ZoneAggregateBuckets - 1;
+}
+
+// Moves the interval to a buffer holding the entry count followed by the entries.
+static char* TakeZoneAggregates( ZoneAggregateState& state )
+{
+    const auto sz = state.used * sizeof( QueueZoneAggregateEntry );
+    auto ptr = (char*)tracy_malloc( sizeof( state.used ) + sz );
+    memcpy( ptr, &state.used, sizeof( state.used ) );
+    memcpy( ptr + sizeof( state.used ), state.entry, sz );
+    state.used = 0;
+    return ptr;
+}
+
+static void FlushZoneAggregates( ZoneAggregateState& state )
+{
+    InitRPMallocThread();
+    auto ptr = TakeZoneAggregates( state );
+
+    TracyLfqPrepare( QueueType::ZoneAggregate );
+    MemWrite( &item->zoneAggregate.ptr, (uint64_t)ptr );
+    TracyLfqCommit;
+}
+
+// Sends the last interval and removes the state from the list on thread exit.
+struct ZoneAggregateExit
+{
+    ~ZoneAggregateExit()
+    {
+        auto& state = s_zoneAggregateState;
+        LockZoneAggregates( s_zoneAggregateListLock );
+        if( state.prev ) state.prev->next = state.next; else s_zoneAggregateList = state.next;
+        if( state.next ) state.next->prev = state.prev;
+        s_zoneAggregateListLock.store( 0, std::memory_order_release );
+
+#ifdef TRACY_ON_DEMAND
+        if( state.connection != GetProfiler().ConnectionId() || !GetProfiler().IsConnected() ) return;
+#endif
+        if( state.used != 0 ) FlushZoneAggregates( state );
+    }
+};
+
+static tracy_no_inline void RegisterZoneAggregateState( ZoneAggregateState& state )
+{
+    // Thread local data used by the exit handler has to be created before it,
+    // so that it is destroyed after it.
+    InitRPMallocThread();
+    GetToken();
+    static thread_local ZoneAggregateExit exitHandler;
+    (void)exitHandler;
+
+    state.thread = detail::GetThreadHandleImpl();
+    state.registered = true;
+    LockZoneAggregates( s_zoneAggregateListLock );
+    state.prev = nullptr;
+    state.next = s_zoneAggregateList;
+    if( s_zoneAggregateList ) s_zoneAggregateList->prev = &state;
+    s_zoneAggregateList = &state;
+    s_zoneAggregateListLock.store( 0, std::memory_order_release );
+}
+
+void Profiler::AggregateZone( const SourceLocationData* srcloc, int64_t begin, int64_t end )
+{
+    auto& state = s_zoneAggregateState;
+    if( !state.registered ) RegisterZoneAggregateState( state );
+    LockZoneAggregates( state.lock );
+#ifdef TRACY_ON_DEMAND
+    const auto connection = GetProfiler().ConnectionId();
+    if( state.connection != connection )
+    {
+        state.connection = connection;
+        state.used = 0;
+    }
+#endif
+    if( state.used != 0 && end >= state.deadline ) FlushZoneAggregates( state );
+
+    QueueZoneAggregateEntry* entry = nullptr;
+    for( uint32_t i=0; i<state.used; i++ )
+    {
+        if( state.entry[i].srcloc == uint64_t( srcloc ) )
+        {
+            entry = state.entry + i;
+            break;
+        }
+    }
+    if( !entry )
+    {
+        if( state.used == ZoneAggregateSlots ) FlushZoneAggregates( state );
+        if( state.used == 0 ) state.deadline = begin + GetProfiler().m_zoneAggregateInterval;
+        entry = state.entry + state.used++;
+        entry->srcloc = uint64_t( srcloc );
+        entry->start = begin;
+        entry->total = 0;
+        entry->min = std::numeric_limits<int64_t>::max();
+        entry->max = 0;
+        entry->count = 0;
+        memset( entry->hist, 0, sizeof( entry->hist ) );
+    }
+
+    const auto dt = end - begin;
+    entry->end = end;
+    entry->total += dt;
+    if( dt < entry->min ) entry->min = dt;
+    if( dt > entry->max ) entry->max = dt;
+    entry->count++;
+    entry->hist[ZoneAggregateBucket( dt )]++;
+    state.lock.store( 0, std::memory_order_release );
+}
+
+void Profiler::ProcessZoneAggregates()
+{
+    if( m_zoneAggregateInterval == 0 ) return;
+    const auto t = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    if( t - m_zoneAggregateLast < 10ll * 1000 * 1000 ) return;
+    m_zoneAggregateLast = t;
+
+    const auto now = GetTime();
+#ifdef TRACY_ON_DEMAND
+    const auto connection = ConnectionId();
+#endif
+    // Sending may block on the socket, so it is done after the list lock is
+    // released. Threads registering or exiting would spin on it otherwise.
+    LockZoneAggregates( s_zoneAggregateListLock );
+    for( auto state = s_zoneAggregateList; state; state = state->next )
+    {
+        // A busy thread will send the interval by itself.
+        if( state->lock.exchange( 1, std::memory_order_acquire ) != 0 ) continue;
+#ifdef TRACY_ON_DEMAND
+        if( state->used != 0 && now >= state->deadline && state->connection == connection )
+#else
+        if( state->used != 0 && now >= state->deadline )
+#endif
+        {
+            auto qi = m_zoneAggregateQueue.push_next();
+            qi->thread = state->thread;
+            qi->payload = TakeZoneAggregates( *state );
+        }
+        state->lock.store( 0, std::memory_order_release );
+    }
+    s_zoneAggregateListLock.store( 0, std::memory_order_release );
+
+    for( auto& qi : m_zoneAggregateQueue )
+    {
+        QueueItem item;
+        if( qi.thread != m_threadCtx )
+        {
+            MemWrite( &item.hdr.type, QueueType::ThreadContext );
+            MemWrite( &item.threadCtx.thread, qi.thread );
+            AppendData( &item, QueueDataSize[(int)QueueType::ThreadContext] );
+            m_threadCtx = qi.thread;
+            m_refTimeThread = 0;
+        }
+        SendZoneAggregatePayload( uint64_t( qi.payload ) );
+        MemWrite( &item.hdr.type, QueueType::ZoneAggregate );
+        MemWrite( &item.zoneAggregate.ptr, uint64_t( qi.payload ) );
+        AppendData( &item, QueueDataSize[(int)QueueType::ZoneAggregate] );
+        tracy_free( qi.payload );
+    }
+    m_zoneAggregateQueue.clear();
+}
+
+#ifdef TRACY_MEMORY_SAMPLING
+// Plain data, zero initialized without running any constructor. Safe to use
+// from allocator hooks, before any of the profiler state exists.
+static thread_local MemSampleState s_memSampleState;
+
+TRACY_API MemSampleState& GetMemSampleState() { return s_memSampleState; }
+
+// Open addressing set of sampled pointers still alive. It has a fixed size
+// and probe length, so that the cost of checking each free is bounded. If a
+// sampled pointer can't be stored, the sample is dropped.
+enum { MemSampleTableSize = 64 * 1024 };
+enum { MemSampleMaxProbe = 16 };
+enum : uint64_t { MemSampleEmpty = 0, MemSampleTombstone = 1 };
+
+static std::atomic<uint64_t> s_memSampleTable[MemSampleTableSize];
+static std::atomic<uint32_t> s_memSampleLive { 0 };
+
+static tracy_force_inline uint32_t MemSampleHash( uint64_t ptr )
+{
+    ptr ^= ptr >> 33;
+    ptr *= 0xff51afd7ed558ccdull;
+    ptr ^= ptr >> 33;
+    return uint32_t( ptr ) & ( MemSampleTableSize - 1 );
+}
+
+static bool MemSampleInsert( uint64_t ptr )
+{
+    const auto hash = MemSampleHash( ptr );
+    for( uint32_t i=0; i<MemSampleMaxProbe; i++ )
+    {
+        auto& slot = s_memSampleTable[( hash + i ) & ( MemSampleTableSize - 1 )];
+        auto val = slot.load( std::memory_order_relaxed );
+        if( val != MemSampleEmpty && val != MemSampleTombstone ) continue;
+        if( slot.compare_exchange_strong( val, ptr, std::memory_order_relaxed ) )
+        {
+            s_memSampleLive.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+        }
+    }
+    return false;
+}
+
+static int64_t MemSampleNextCountdown( MemSampleState& state )
+{
+    if( state.rng == 0 ) state.rng = ( ( GetThreadHandle() * 0x9e3779b97f4a7c15ull ) ^ uint64_t( Profiler::GetTime() ) ) | 1;
+    state.rng ^= state.rng >> 12;
+    state.rng ^= state.rng << 25;
+    state.rng ^= state.rng >> 27;
+    const auto rnd = state.rng * 0x2545f4914f6cdd1dull;
+    // Uniform in (0, 1], so that the logarithm is always finite.
+    const auto u = double( ( rnd >> 11 ) + 1 ) * ( 1.0 / 9007199254740992.0 );
+    return int64_t( -log( u ) * double( TRACY_MEMORY_SAMPLING ) ) + 1;
+}
+#endif
+
 Profiler::Profiler()
     : m_timeBegin( 0 )
     , m_mainThread( detail::GetThreadHandleImpl() )
@@ -1032,7 +1327,9 @@ Profiler::Profiler()
     , m_noExit( false )
     , m_userPort( 0 )
     , m_zoneId( 1 )
+    , m_memOrder( 0 )
     , m_samplingPeriod( 0 )
+    , m_zoneAggregateInterval( 0 )
     , m_stream( LZ4_createStream() )
     , m_buffer( (char*)tracy_malloc( TargetFrameSize*3 ) )
     , m_bufferOffset( 0 )
@@ -1042,6 +1339,13 @@ Profiler::Profiler()
     , m_serialDequeue( 1024*1024 )
     , m_fiQueue( 16 )
     , m_fiDequeue( 16 )
+    , m_zoneAggregateQueue( 16 )
+    , m_zoneThrottleCount( 0 )
+    , m_dataLossLevel( DataLossNone )
+    , m_dataLossCallstacks( 0 )
+    , m_dataLossZones( 0 )
+    , m_dataLossOther( 0 )
+    , m_drainRate( 0 )
     , m_frameCount( 0 )
 #ifdef TRACY_ON_DEMAND
     , m_isConnected( false )
@@ -1053,6 +1357,8 @@ Profiler::Profiler()
     assert( !s_instance );
     s_instance = this;
 
+    ResetZoneThrottle();
+
 #ifndef TRACY_DELAYED_INIT
 #  ifdef _MSC_VER
     // 3. But these variables need to be initialized in main thread within the .CRT$XCB section. Do it here.
@@ -1064,6 +1370,7 @@ Profiler::Profiler()
 
     CalibrateTimer();
     CalibrateDelay();
+    m_zoneAggregateInterval = int64_t( TRACY_ZONE_AGGREGATE_INTERVAL * 1000000. / m_timerMul );
     ReportTopology();
 
 #ifndef TRACY_NO_EXIT
@@ -1086,6 +1393,11 @@ Profiler::Profiler()
     s_compressThread = (Thread*)tracy_malloc( sizeof( Thread ) );
     new(s_compressThread) Thread( LaunchCompressWorker, this );
 
+#ifdef TRACY_QUEUE_BUDGET
+    s_budgetThread = (Thread*)tracy_malloc( sizeof( Thread ) );
+    new(s_budgetThread) Thread( LaunchBudgetWorker, this );
+#endif
+
 #ifdef TRACY_HAS_SYSTEM_TRACING
     if( SysTraceStart( m_samplingPeriod ) )
     {
@@ -1135,6 +1447,10 @@ Profiler::~Profiler()
     }
 #endif
 
+#ifdef TRACY_QUEUE_BUDGET
+    s_budgetThread->~Thread();
+    tracy_free( s_budgetThread );
+#endif
     s_compressThread->~Thread();
     tracy_free( s_compressThread );
     s_thread->~Thread();
@@ -1144,11 +1460,15 @@ Profiler::~Profiler()
     tracy_free( m_buffer );
     LZ4_freeStream( (LZ4_stream_t*)m_stream );
 
+#ifdef TRACY_ON_DEMAND
+    while( m_numSubscribers > 0 ) RemoveSubscriber( m_numSubscribers - 1 );
+#else
     if( m_sock )
     {
         m_sock->~Socket();
         tracy_free( m_sock );
     }
+#endif
 
     if( m_broadcast )
     {
@@ -1210,6 +1530,12 @@ void Profiler::Worker()
     uint8_t isApple = 0;
 #endif
 
+#ifdef TRACY_QUEUE_BUDGET
+    uint8_t queueBudget = 1;
+#else
+    uint8_t queueBudget = 0;
+#endif
+
 #if defined __i386 || defined _M_IX86
     uint8_t cpuArch = CpuArchX86;
 #elif defined __x86_64__ || defined _M_X64
@@ -1231,9 +1557,15 @@ void Profiler::Worker()
     MemWrite( &welcome.epoch, m_epoch );
     MemWrite( &welcome.pid, pid );
     MemWrite( &welcome.samplingPeriod, m_samplingPeriod );
+#ifdef TRACY_MEMORY_SAMPLING
+    MemWrite( &welcome.memSampleInterval, uint64_t( TRACY_MEMORY_SAMPLING ) );
+#else
+    MemWrite( &welcome.memSampleInterval, uint64_t( 0 ) );
+#endif
     MemWrite( &welcome.onDemand, onDemand );
     MemWrite( &welcome.isApple, isApple );
     MemWrite( &welcome.cpuArch, cpuArch );
+    MemWrite( &welcome.queueBudget, queueBudget );
     memcpy( welcome.programName, procname, pnsz );
     memset( welcome.programName + pnsz, 0, WelcomeMessageProgramNameSize - pnsz );
     memcpy( welcome.hostInfo, hostinfo, hisz );
@@ -1359,6 +1691,7 @@ void Profiler::Worker()
 #ifdef TRACY_ON_DEMAND
         const auto currentTime = GetTime();
         ClearQueues( token );
+        const auto memOrder = m_memOrder.load( std::memory_order_relaxed );
         m_connectionId.fetch_add( 1, std::memory_order_release );
         m_isConnected.store( true, std::memory_order_release );
 #endif
@@ -1378,37 +1711,33 @@ void Profiler::Worker()
         OnDemandPayloadMessage onDemand;
         onDemand.frames = m_frameCount.load( std::memory_order_relaxed );
         onDemand.currentTime = currentTime;
+        onDemand.memOrder = memOrder;
+        onDemand.lateJoin = 0;
 
         m_sock->Send( &onDemand, sizeof( onDemand ) );
 
-        m_deferredLock.lock();
-        for( auto& item : m_deferredQueue )
-        {
-            uint64_t ptr;
-            const auto idx = MemRead<uint8_t>( &item.hdr.idx );
-            switch( (QueueType)idx )
-            {
-            case QueueType::MessageAppInfo:
-                ptr = MemRead<uint64_t>( &item.message.text );
-                SendString( ptr, (const char*)ptr, QueueType::CustomStringData );
-                break;
-            case QueueType::LockName:
-                ptr = MemRead<uint64_t>( &item.lockName.name );
-                SendString( ptr, (const char*)ptr, QueueType::CustomStringData );
-                break;
-            default:
-                break;
-            }
-            AppendData( &item, QueueDataSize[idx] );
-        }
-        m_deferredLock.unlock();
+        m_subscribers[0] = Subscriber { m_sock, 0, false, false };
+        m_numSubscribers = 1;
+        m_querySubscriber = 0;
+        m_independentFrames = false;
+
+        SendDeferredItems();
+        uint64_t lastAccept = 0;
 #endif
 
         // Main communications loop
         int keepAlive = 0;
+#ifdef TRACY_HW_TIMER_TSC
+        m_timerCalibLast = 0;
+#endif
+        ResetZoneThrottle();
+        m_drainRate.store( 0, std::memory_order_relaxed );
         for(;;)
         {
             ProcessSysTime();
+            ProcessTimerCalibration();
+            ProcessZoneThrottle();
+            ProcessZoneAggregates();
             const auto status = Dequeue( token );
             const auto serialStatus = DequeueSerial();
             if( status == DequeueStatus::ConnectionLost || serialStatus == DequeueStatus::ConnectionLost )
@@ -1442,12 +1771,25 @@ void Profiler::Worker()
                 keepAlive = 0;
             }
 
-            bool connActive = true;
-            while( m_sock->HasData() && connActive )
+            if( !HandleServerQueries() ) break;
+
+#ifdef TRACY_ON_DEMAND
+            if( m_numSubscribers < MaxSubscribers )
             {
-                connActive = HandleServerQuery();
+                const auto t = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+                if( t - lastAccept > 100000000 )  // 100 ms
+                {
+                    lastAccept = t;
+                    if( !m_pendingSubscriber )
+                    {
+                        m_pendingSubscriber = listen.Accept( 0 );
+                        m_pendingHandshakeSize = 0;
+                        m_pendingSince = t;
+                    }
+                    if( m_pendingSubscriber ) HandshakeSubscriber( welcome, t );
+                }
             }
-            if( !connActive ) break;
+#endif
         }
         if( ShouldExit() ) break;
 
@@ -1455,10 +1797,18 @@ void Profiler::Worker()
         m_isConnected.store( false, std::memory_order_release );
         m_bufferOffset = 0;
         m_bufferStart = 0;
-#endif
 
+        while( m_numSubscribers > 0 ) RemoveSubscriber( m_numSubscribers - 1 );
+        if( m_pendingSubscriber )
+        {
+            m_pendingSubscriber->~Socket();
+            tracy_free( m_pendingSubscriber );
+            m_pendingSubscriber = nullptr;
+        }
+#else
         m_sock->~Socket();
         tracy_free( m_sock );
+#endif
         m_sock = nullptr;
 
 #ifndef TRACY_ON_DEMAND
@@ -1522,13 +1872,10 @@ void Profiler::Worker()
             break;
         }
 
-        while( m_sock->HasData() )
+        if( !HandleServerQueries() )
         {
-            if( !HandleServerQuery() )
-            {
-                m_shutdownFinished.store( true, std::memory_order_relaxed );
-                return;
-            }
+            m_shutdownFinished.store( true, std::memory_order_relaxed );
+            return;
         }
     }
 
@@ -1543,15 +1890,12 @@ void Profiler::Worker()
     // Handle remaining server queries
     for(;;)
     {
-        if( m_sock->HasData() )
+        if( HasServerQueries() )
         {
-            while( m_sock->HasData() )
+            if( !HandleServerQueries() )
             {
-                if( !HandleServerQuery() )
-                {
-                    m_shutdownFinished.store( true, std::memory_order_relaxed );
-                    return;
-                }
+                m_shutdownFinished.store( true, std::memory_order_relaxed );
+                return;
             }
             while( Dequeue( token ) == DequeueStatus::DataDequeued ) {}
             while( DequeueSerial() == DequeueStatus::DataDequeued ) {}
@@ -1686,6 +2030,10 @@ static void FreeAssociatedMemory( const QueueItem& item )
         ptr = MemRead<uint64_t>( &item.frameImage.image );
         tracy_free( (void*)ptr );
         break;
+    case QueueType::ZoneAggregate:
+        ptr = MemRead<uint64_t>( &item.zoneAggregate.ptr );
+        tracy_free( (void*)ptr );
+        break;
 #ifndef TRACY_ON_DEMAND
     case QueueType::LockName:
         ptr = MemRead<uint64_t>( &item.lockName.name );
@@ -1837,6 +2185,11 @@ Profiler::DequeueStatus Profiler::Dequeue( moodycamel::ConsumerToken& token )
                         tracy_free( (void*)ptr );
                         break;
                     }
+                    case QueueType::ZoneAggregate:
+                        ptr = MemRead<uint64_t>( &item->zoneAggregate.ptr );
+                        SendZoneAggregatePayload( ptr );
+                        tracy_free( (void*)ptr );
+                        break;
                     case QueueType::ZoneBegin:
                     case QueueType::ZoneBeginCallstack:
                     {
@@ -1861,6 +2214,56 @@ Profiler::DequeueStatus Profiler::Dequeue( moodycamel::ConsumerToken& token )
                         tracy_free( (void*)ptr );
 #endif
                         break;
+                    case QueueType::CallstackMemory:
+                        ptr = MemRead<uint64_t>( &item->callstackMemory.ptr );
+                        SendCallstackPayload( ptr );
+                        tracy_free( (void*)ptr );
+                        break;
+                    case QueueType::MemAlloc:
+                    case QueueType::MemAllocCallstack:
+                    {
+                        int64_t t = MemRead<int64_t>( &item->memAlloc.time );
+                        int64_t dt = t - refThread;
+                        refThread = t;
+                        MemWrite( &item->memAlloc.time, dt );
+                        break;
+                    }
+                    case QueueType::MemFree:
+                    case QueueType::MemFreeCallstack:
+                    {
+                        int64_t t = MemRead<int64_t>( &item->memFree.time );
+                        int64_t dt = t - refThread;
+                        refThread = t;
+                        MemWrite( &item->memFree.time, dt );
+                        break;
+                    }
+                    case QueueType::LockWait:
+                    case QueueType::LockSharedWait:
+                    {
+                        int64_t t = MemRead<int64_t>( &item->lockWait.time );
+                        int64_t dt = t - refThread;
+                        refThread = t;
+                        MemWrite( &item->lockWait.time, dt );
+                        break;
+                    }
+                    case QueueType::LockObtain:
+                    case QueueType::LockSharedObtain:
+                    {
+                        int64_t t = MemRead<int64_t>( &item->lockObtain.time );
+                        int64_t dt = t - refThread;
+                        refThread = t;
+                        MemWrite( &item->lockObtain.time, dt );
+                        break;
+                    }
+                    case QueueType::LockRelease:
+                    case QueueType::LockSharedRelease:
+                    {
+                        int64_t t = MemRead<int64_t>( &item->lockRelease.time );
+                        int64_t dt = t - refThread;
+                        refThread = t;
+                        MemWrite( &item->lockRelease.time, dt );
+                        break;
+                    }
                     case QueueType::GpuZoneBegin:
                     case QueueType::GpuZoneBeginCallstack:
                     {
@@ -2021,62 +2424,11 @@ Profiler::DequeueStatus Profiler::DequeueSerial()
         auto end = item + sz;
         while( item != end )
         {
-            uint64_t ptr;
             const auto idx = MemRead<uint8_t>( &item->hdr.idx );
             if( idx < (int)QueueType::Terminate )
             {
                 switch( (QueueType)idx )
                 {
-                case QueueType::CallstackMemory:
-                    ptr = MemRead<uint64_t>( &item->callstackMemory.ptr );
-                    SendCallstackPayload( ptr );
-                    tracy_free( (void*)ptr );
-                    break;
-                case QueueType::LockWait:
-                case QueueType::LockSharedWait:
-                {
-                    int64_t t = MemRead<int64_t>( &item->lockWait.time );
-                    int64_t dt = t - refSerial;
-                    refSerial = t;
-                    MemWrite( &item->lockWait.time, dt );
-                    break;
-                }
-                case QueueType::LockObtain:
-                case QueueType::LockSharedObtain:
-                {
-                    int64_t t = MemRead<int64_t>( &item->lockObtain.time );
-                    int64_t dt = t - refSerial;
-                    refSerial = t;
-                    MemWrite( &item->lockObtain.time, dt );
-                    break;
-                }
-                case QueueType::LockRelease:
-                case QueueType::LockSharedRelease:
-                {
-                    int64_t t = MemRead<int64_t>( &item->lockRelease.time );
-                    int64_t dt = t - refSerial;
-                    refSerial = t;
-                    MemWrite( &item->lockRelease.time, dt );
-                    break;
-                }
-                case QueueType::MemAlloc:
-                case QueueType::MemAllocCallstack:
-                {
-                    int64_t t = MemRead<int64_t>( &item->memAlloc.time );
-                    int64_t dt = t - refSerial;
-                    refSerial = t;
-                    MemWrite( &item->memAlloc.time, dt );
-                    break;
-                }
-                case QueueType::MemFree:
-                case QueueType::MemFreeCallstack:
-                {
-                    int64_t t = MemRead<int64_t>( &item->memFree.time );
-                    int64_t dt = t - refSerial;
-                    refSerial = t;
-                    MemWrite( &item->memFree.time, dt );
-                    break;
-                }
                 case QueueType::GpuZoneBeginSerial:
                 case QueueType::GpuZoneBeginCallstackSerial:
                 {
@@ -2131,9 +2483,36 @@ bool Profiler::CommitData()
 
 bool Profiler::SendData( const char* data, size_t len )
 {
+#ifdef TRACY_ON_DEMAND
+    // Once the stream was split between subscribers, their decoders no longer
+    // share the history of frames, so each frame has to be decodable on its own.
+    if( m_independentFrames ) LZ4_resetStream_fast( (LZ4_stream_t*)m_stream );
+#endif
     const lz4sz_t lz4sz = LZ4_compress_fast_continue( (LZ4_stream_t*)m_stream, data, m_lz4Buf + sizeof( lz4sz_t ), (int)len, LZ4Size, 1 );
     memcpy( m_lz4Buf, &lz4sz, sizeof( lz4sz ) );
+#ifdef TRACY_ON_DEMAND
+    if( m_privateSend )
+    {
+        if( m_sock->Send( m_lz4Buf, lz4sz + sizeof( lz4sz_t ) ) != -1 ) return true;
+        m_subscribers[m_querySubscriber].lost = true;
+        return false;
+    }
+    bool ret = false;
+    for( int i=0; i<m_numSubscribers; i++ )
+    {
+        auto& sub = m_subscribers[i];
+        if( sub.lost ) continue;
+        if( !sub.terminated && sub.sock->Send( m_lz4Buf, lz4sz + sizeof( lz4sz_t ) ) == -1 )
+        {
+            sub.lost = true;
+            continue;
+        }
+        ret = true;
+    }
+    return ret;
+#else
     return m_sock->Send( m_lz4Buf, lz4sz + sizeof( lz4sz_t ) ) != -1;
+#endif
 }
 
 void Profiler::SendString( uint64_t str, const char* ptr, QueueType type )
@@ -2247,6 +2626,25 @@ void Profiler::SendCallstackPayload( uint64_t _ptr )
     }
 }
 
+void Profiler::SendZoneAggregatePayload( uint64_t _ptr )
+{
+    auto ptr = (const char*)_ptr;
+
+    QueueItem item;
+    MemWrite( &item.hdr.type, QueueType::ZoneAggregatePayload );
+    MemWrite( &item.stringTransfer.ptr, _ptr );
+
+    uint32_t cnt;
+    memcpy( &cnt, ptr, sizeof( cnt ) );
+    const auto l16 = uint16_t( cnt * sizeof( QueueZoneAggregateEntry ) );
+
+    NeedDataSize( QueueDataSize[(int)QueueType::ZoneAggregatePayload] + sizeof( l16 ) + l16 );
+
+    AppendDataUnsafe( &item, QueueDataSize[(int)QueueType::ZoneAggregatePayload] );
+    AppendDataUnsafe( &l16, sizeof( l16 ) );
+    AppendDataUnsafe( ptr + sizeof( cnt ), l16 );
+}
+
 void Profiler::SendCallstackPayload64( uint64_t _ptr )
 {
     auto ptr = (uint64_t*)_ptr;
@@ -2375,6 +2773,13 @@ bool Profiler::HandleServerQuery()
         SendString( ptr, (const char*)ptr, QueueType::FrameName );
         break;
     case ServerQueryDisconnect:
+#ifdef TRACY_ON_DEMAND
+        if( m_numSubscribers > 1 )
+        {
+            DetachSubscriber();
+            break;
+        }
+#endif
         HandleDisconnect();
         return false;
 #ifdef TRACY_HAS_SYSTEM_TRACING
@@ -2394,6 +2799,12 @@ bool Profiler::HandleServerQuery()
     case ServerQueryCodeLocation:
         SendCodeLocation( ptr );
         break;
+    case ServerQueryZoneThrottle:
+        HandleZoneThrottle( ptr, extra );
+        break;
+    case ServerQueryDrainRate:
+        HandleDrainRate( ptr );
+        break;
     default:
         assert( false );
         break;
@@ -2402,6 +2813,206 @@ bool Profiler::HandleServerQuery()
     return true;
 }
 
+bool Profiler::HandleServerQueries()
+{
+#ifdef TRACY_ON_DEMAND
+    const bool fanOut = m_numSubscribers > 1 || m_subscribers[0].terminated;
+    for( int i=0; i<m_numSubscribers; i++ )
+    {
+        auto& sub = m_subscribers[i];
+        if( sub.lost || !sub.sock->HasData() ) continue;
+
+        // Responses are private, so the shared data has to be sent out first.
+        if( fanOut && m_bufferOffset != m_bufferStart ) CommitData();
+        m_sock = sub.sock;
+        m_querySubscriber = i;
+        m_privateSend = fanOut;
+
+        bool connActive = true;
+        while( sub.sock->HasData() && connActive )
+        {
+            connActive = HandleServerQuery();
+        }
+        if( fanOut && m_bufferOffset != m_bufferStart ) CommitData();
+        m_privateSend = false;
+        if( !connActive ) sub.lost = true;
+    }
+
+    for( int i=m_numSubscribers-1; i>=0; i-- )
+    {
+        if( m_subscribers[i].lost ) RemoveSubscriber( i );
+    }
+    if( m_numSubscribers == 0 ) return false;
+    m_sock = m_subscribers[0].sock;
+    m_querySubscriber = 0;
+    return true;
+#else
+    while( m_sock->HasData() )
+    {
+        if( !HandleServerQuery() ) return false;
+    }
+    return true;
+#endif
+}
+
+bool Profiler::HasServerQueries()
+{
+#ifdef TRACY_ON_DEMAND
+    for( int i=0; i<m_numSubscribers; i++ )
+    {
+        if( m_subscribers[i].sock->HasData() ) return true;
+    }
+    return false;
+#else
+    return m_sock->HasData();
+#endif
+}
+
+#ifdef TRACY_ON_DEMAND
+void Profiler::SendDeferredItems()
+{
+    m_deferredLock.lock();
+    for( auto& item : m_deferredQueue )
+    {
+        uint64_t ptr;
+        const auto idx = MemRead<uint8_t>( &item.hdr.idx );
+        switch( (QueueType)idx )
+        {
+        case QueueType::MessageAppInfo:
+            ptr = MemRead<uint64_t>( &item.message.text );
+            SendString( ptr, (const char*)ptr, QueueType::CustomStringData );
+            break;
+        case QueueType::LockName:
+            ptr = MemRead<uint64_t>( &item.lockName.name );
+            SendString( ptr, (const char*)ptr, QueueType::CustomStringData );
+            break;
+        default:
+            break;
+        }
+        AppendData( &item, QueueDataSize[idx] );
+    }
+    m_deferredLock.unlock();
+}
+
+// The handshake of a joining server is read without blocking, as the session
+// must not stall on a server which doesn't handshake promptly. The server is
+// dropped if the handshake is not complete in two seconds.
+void Profiler::HandshakeSubscriber( const WelcomeMessage& welcome, int64_t t )
+{
+    auto sock = m_pendingSubscriber;
+    bool closed = false;
+    while( m_pendingHandshakeSize < PendingHandshakeSize && sock->HasData() )
+    {
+        if( !sock->ReadRaw( m_pendingHandshake + m_pendingHandshakeSize, 1, 0 ) )
+        {
+            closed = true;
+            break;
+        }
+        m_pendingHandshakeSize++;
+    }
+    if( !closed && m_pendingHandshakeSize < PendingHandshakeSize && t - m_pendingSince < 2000000000ll ) return;
+
+    m_pendingSubscriber = nullptr;
+    if( m_pendingHandshakeSize < PendingHandshakeSize || memcmp( m_pendingHandshake, HandshakeShibboleth, HandshakeShibbolethSize ) != 0 )
+    {
+        sock->~Socket();
+        tracy_free( sock );
+        return;
+    }
+    uint32_t protocolVersion;
+    memcpy( &protocolVersion, m_pendingHandshake + HandshakeShibbolethSize, sizeof( protocolVersion ) );
+    if( protocolVersion != ProtocolVersion )
+    {
+        HandshakeStatus status = HandshakeProtocolMismatch;
+        sock->Send( &status, sizeof( status ) );
+        sock->~Socket();
+        tracy_free( sock );
+        return;
+    }
+
+    AddSubscriber( sock, welcome );
+}
+
+// Attaches another server to the running session. It gets the same preamble
+// as the first server, after which it receives the shared data stream.
+void Profiler::AddSubscriber( Socket* sock, const WelcomeMessage& welcome )
+{
+    if( m_bufferOffset != m_bufferStart ) CommitData();
+
+    HandshakeStatus handshake = HandshakeWelcome;
+    sock->Send( &handshake, sizeof( handshake ) );
+    sock->Send( &welcome, sizeof( welcome ) );
+
+    OnDemandPayloadMessage onDemand;
+    onDemand.frames = m_frameCount.load( std::memory_order_relaxed );
+    onDemand.currentTime = GetTime();
+    onDemand.memOrder = m_memOrder.load( std::memory_order_relaxed );
+    onDemand.lateJoin = 1;
+    sock->Send( &onDemand, sizeof( onDemand ) );
+
+    const auto idx = m_numSubscribers++;
+    m_subscribers[idx] = Subscriber { sock, 0, false, false };
+    m_independentFrames = true;
+
+    m_sock = sock;
+    m_querySubscriber = idx;
+    m_privateSend = true;
+    SendDeferredItems();
+    if( m_bufferOffset != m_bufferStart ) CommitData();
+    m_privateSend = false;
+    m_sock = m_subscribers[0].sock;
+    m_querySubscriber = 0;
+
+    // The new subscriber has no reference times, so they restart for everyone.
+    m_threadCtx = 0;
+    m_refTimeThread = 0;
+    m_refTimeSerial = 0;
+    m_refTimeCtx = 0;
+    m_refTimeGpu = 0;
+
+    QueueItem item;
+    MemWrite( &item.hdr.type, QueueType::TimeReferenceReset );
+    AppendData( &item, QueueDataSize[(int)QueueType::TimeReferenceReset] );
+}
+
+void Profiler::RemoveSubscriber( int idx )
+{
+    assert( idx < m_numSubscribers );
+    m_subscribers[idx].sock->~Socket();
+    tracy_free( m_subscribers[idx].sock );
+    m_numSubscribers--;
+    for( int i=idx; i<m_numSubscribers; i++ ) m_subscribers[i] = m_subscribers[i+1];
+    UpdateDrainRate();
+}
+
+// Disconnect request of one of several subscribers. Only this subscriber is
+// terminated, but its queries are still answered until it closes the connection.
+void Profiler::DetachSubscriber()
+{
+    auto& sub = m_subscribers[m_querySubscriber];
+    if( sub.terminated ) return;
+    sub.terminated = true;
+    UpdateDrainRate();
+
+    QueueItem terminate;
+    MemWrite( &terminate.hdr.type, QueueType::Terminate );
+    AppendData( &terminate, QueueDataSize[(int)QueueType::Terminate] );
+}
+
+// The slowest subscriber determines how much data the client may keep.
+void Profiler::UpdateDrainRate()
+{
+    uint64_t rate = 0;
+    for( int i=0; i<m_numSubscribers; i++ )
+    {
+        const auto& sub = m_subscribers[i];
+        if( sub.terminated || sub.drainRate == 0 ) continue;
+        if( rate == 0 || sub.drainRate < rate ) rate = sub.drainRate;
+    }
+    m_drainRate.store( rate, std::memory_order_relaxed );
+}
+#endif
+
 void Profiler::HandleDisconnect()
 {
     moodycamel::ConsumerToken token( GetQueue() );
@@ -2505,6 +3116,9 @@ void Profiler::CalibrateTimer()
 
     m_timerMul = double( dt ) / double( dr );
 #  endif
+#  ifdef TRACY_HW_TIMER_TSC
+    m_timerCalibInterval = IsTscReliable() ? 1000000000 : 100000000;
+#  endif
 #else
     m_timerMul = 1.;
 #endif
@@ -2734,6 +3348,30 @@ void Profiler::CutCallstack( void* callstack, const char* skipBefore )
 #endif
 }
 
+#ifdef TRACY_HW_TIMER_TSC
+// Sends pairs of timer and monotonic clock readings, which the server uses to
+// correct the drift of the initial timer calibration.
+void Profiler::ProcessTimerCalibration()
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto ns0 = std::chrono::duration_cast<std::chrono::nanoseconds>( t0.time_since_epoch() ).count();
+    if( m_timerCalibLast != 0 && ns0 - m_timerCalibLast < m_timerCalibInterval ) return;
+
+    std::atomic_signal_fence( std::memory_order_acq_rel );
+    const auto time = GetTime();
+    std::atomic_signal_fence( std::memory_order_acq_rel );
+    const auto t1 = std::chrono::steady_clock::now();
+    const auto ns1 = std::chrono::duration_cast<std::chrono::nanoseconds>( t1.time_since_epoch() ).count();
+    m_timerCalibLast = ns1;
+
+    QueueItem item;
+    MemWrite( &item.hdr.type, QueueType::TimerCalibration );
+    MemWrite( &item.timerCalibration.time, time );
+    MemWrite( &item.timerCalibration.ns, ns0 + ( ns1 - ns0 ) / 2 );
+    AppendData( &item, QueueDataSize[(int)QueueType::TimerCalibration] );
+}
+#endif
+
 #ifdef TRACY_HAS_SYSTIME
 void Profiler::ProcessSysTime()
 {
@@ -2761,8 +3399,10 @@ void Profiler::HandleParameter( uint64_t payload )
     const auto idx = uint32_t( payload >> 32 );
     const auto val = int32_t( payload & 0xFFFFFFFF );
     m_paramCallback( idx, val );
-    TracyLfqPrepare( QueueType::ParamPingback );
-    TracyLfqCommit;
+
+    QueueItem item;
+    MemWrite( &item.hdr.type, QueueType::ParamPingback );
+    AppendData( &item, QueueDataSize[(int)QueueType::ParamPingback] );
 }
 
 void Profiler::HandleSymbolQuery( uint64_t symbol )
@@ -2808,6 +3448,343 @@ void Profiler::SendCodeLocation( uint64_t ptr )
 #endif
 }
 
+// Interned source locations are never freed, as the server may query them at
+// any time. Lookups are lock-free: nodes are immutable once published, and
+// new nodes are only prepended to the bucket chains.
+struct InternedSourceLocation
+{
+    SourceLocationData data;
+    InternedSourceLocation* next;
+    uint64_t hash;
+    uint32_t sourceSz;
+    uint32_t functionSz;
+    uint32_t nameSz;
+};
+
+enum { SourceLocationInternBuckets = 16 * 1024 };
+static std::atomic<InternedSourceLocation*> s_srclocIntern[SourceLocationInternBuckets];
+
+static tracy_force_inline uint64_t SourceLocationHash( uint64_t hash, const char* ptr, size_t sz )
+{
+    for( size_t i=0; i<sz; i++ )
+    {
+        hash ^= uint8_t( ptr[i] );
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static tracy_force_inline bool SourceLocationMatch( const InternedSourceLocation* node, uint64_t hash, uint32_t line, const char* source, size_t sourceSz, const char* function, size_t functionSz, const char* name, size_t nameSz, uint32_t color )
+{
+    if( node->hash != hash || node->data.line != line || node->data.color != color ) return false;
+    if( node->sourceSz != sourceSz || node->functionSz != functionSz ) return false;
+    if( ( node->data.name == nullptr ) != ( name == nullptr ) ) return false;
+    if( name && ( node->nameSz != nameSz || memcmp( node->data.name, name, nameSz ) != 0 ) ) return false;
+    return memcmp( node->data.file, source, sourceSz ) == 0 && memcmp( node->data.function, function, functionSz ) == 0;
+}
+
+const SourceLocationData* Profiler::InternSourceLocation( uint32_t line, const char* source, size_t sourceSz, const char* function, size_t functionSz, const char* name, size_t nameSz, uint32_t color )
+{
+    auto hash = SourceLocationHash( 0xcbf29ce484222325ull ^ ( uint64_t( line ) << 32 ) ^ color, source, sourceSz );
+    hash = SourceLocationHash( hash, function, functionSz );
+    if( name ) hash = SourceLocationHash( hash ^ 1, name, nameSz );
+
+    auto& bucket = s_srclocIntern[hash & ( SourceLocationInternBuckets - 1 )];
+    auto head = bucket.load( std::memory_order_acquire );
+    for( auto node = head; node; node = node->next )
+    {
+        if( SourceLocationMatch( node, hash, line, source, sourceSz, function, functionSz, name, nameSz, color ) ) return &node->data;
+    }
+
+    auto& profiler = GetProfiler();
+    std::lock_guard<TracyMutex> lock( profiler.m_srclocInternLock );
+    // Another thread may have added the same location in the meantime.
+    auto first = bucket.load( std::memory_order_relaxed );
+    for( auto node = first; node != head; node = node->next )
+    {
+        if( SourceLocationMatch( node, hash, line, source, sourceSz, function, functionSz, name, nameSz, color ) ) return &node->data;
+    }
+
+    InitRPMallocThread();
+    const auto sz = sizeof( InternedSourceLocation ) + sourceSz + 1 + functionSz + 1 + ( name ? nameSz + 1 : 0 );
+    auto node = (InternedSourceLocation*)tracy_malloc( sz );
+    auto str = (char*)( node + 1 );
+    memcpy( str, source, sourceSz );
+    str[sourceSz] = '\0';
+    node->data.file = str;
+    str += sourceSz + 1;
+    memcpy( str, function, functionSz );
+    str[functionSz] = '\0';
+    node->data.function = str;
+    str += functionSz + 1;
+    if( name )
+    {
+        memcpy( str, name, nameSz );
+        str[nameSz] = '\0';
+        node->data.name = str;
+    }
+    else
+    {
+        node->data.name = nullptr;
+    }
+    node->data.line = line;
+    node->data.color = color;
+    node->next = first;
+    node->hash = hash;
+    node->sourceSz = uint32_t( sourceSz );
+    node->functionSz = uint32_t( functionSz );
+    node->nameSz = uint32_t( nameSz );
+    bucket.store( node, std::memory_order_release );
+    return &node->data;
+}
+
+static tracy_force_inline uint32_t ZoneThrottleHash( uint64_t srcloc )
+{
+    return uint32_t( ( srcloc * 0x9E3779B97F4A7C15ull ) >> 56 );
+}
+
+bool Profiler::ZoneThrottledSlow( const SourceLocationData* srcloc )
+{
+    const auto key = uint64_t( srcloc );
+    auto idx = ZoneThrottleHash( key );
+    for( int i=0; i<ZoneThrottleSlots; i++ )
+    {
+        auto& slot = m_zoneThrottle[idx];
+        const auto ptr = slot.srcloc.load( std::memory_order_acquire );
+        if( ptr == 0 ) return false;
+        if( ptr == key )
+        {
+            const auto setting = slot.setting.load( std::memory_order_relaxed );
+            const auto value = setting & ZoneThrottleValueMask;
+            switch( setting >> ZoneThrottleValueBits )
+            {
+            case ZoneThrottleOneInN:
+                return slot.calls.fetch_add( 1, std::memory_order_relaxed ) % value != 0;
+            case ZoneThrottlePerSecond:
+                return slot.calls.fetch_add( 1, std::memory_order_relaxed ) >= value;
+            default:
+                return false;
+            }
+        }
+        idx = ( idx + 1 ) % ZoneThrottleSlots;
+    }
+    return false;
+}
+
+void Profiler::ResetZoneThrottle()
+{
+    m_zoneThrottleCount.store( 0, std::memory_order_relaxed );
+    for( auto& slot : m_zoneThrottle )
+    {
+        slot.setting.store( 0, std::memory_order_relaxed );
+        slot.calls.store( 0, std::memory_order_relaxed );
+        slot.srcloc.store( 0, std::memory_order_release );
+    }
+    m_zoneThrottleLast = 0;
+}
+
+void Profiler::HandleZoneThrottle( uint64_t srcloc, uint32_t setting )
+{
+    auto mode = setting >> ZoneThrottleValueBits;
+    const auto value = setting & ZoneThrottleValueMask;
+    if( mode > ZoneThrottlePerSecond || ( mode == ZoneThrottleOneInN && value < 2 ) ) mode = ZoneThrottleNone;
+    if( mode == ZoneThrottleNone ) setting = 0;
+
+    // Slots are never released while connected, so that the lock-free readers
+    // always see a consistent table. Disabled slots may be taken over by other
+    // source locations if the table runs out of space.
+    auto idx = ZoneThrottleHash( srcloc );
+    ZoneThrottleSlot* found = nullptr;
+    ZoneThrottleSlot* spare = nullptr;
+    for( int i=0; i<ZoneThrottleSlots; i++ )
+    {
+        auto& slot = m_zoneThrottle[idx];
+        const auto ptr = slot.srcloc.load( std::memory_order_relaxed );
+        if( ptr == srcloc )
+        {
+            found = &slot;
+            break;
+        }
+        if( !spare && slot.setting.load( std::memory_order_relaxed ) == 0 ) spare = &slot;
+        if( ptr == 0 ) break;
+        idx = ( idx + 1 ) % ZoneThrottleSlots;
+    }
+
+    if( found )
+    {
+        const auto old = found->setting.load( std::memory_order_relaxed );
+        if( old != 0 && setting == 0 ) m_zoneThrottleCount.fetch_sub( 1, std::memory_order_relaxed );
+        else if( old == 0 && setting != 0 ) m_zoneThrottleCount.fetch_add( 1, std::memory_order_relaxed );
+        found->calls.store( 0, std::memory_order_relaxed );
+        found->setting.store( setting, std::memory_order_relaxed );
+    }
+    else if( setting != 0 && spare )
+    {
+        spare->calls.store( 0, std::memory_order_relaxed );
+        spare->srcloc.store( srcloc, std::memory_order_release );
+        spare->setting.store( setting, std::memory_order_relaxed );
+        m_zoneThrottleCount.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    QueueItem item;
+    MemWrite( &item.hdr.type, QueueType::ParamPingback );
+    AppendData( &item, QueueDataSize[(int)QueueType::ParamPingback] );
+}
+
+// Reports how many zones were dropped by throttling in the last interval.
+// The call counters are reset, which also starts a new per-second window.
+void Profiler::ProcessZoneThrottle()
+{
+    if( m_zoneThrottleCount.load( std::memory_order_relaxed ) == 0 ) return;
+    const auto t = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    if( m_zoneThrottleLast != 0 && t - m_zoneThrottleLast < 1000ll * 1000 * 1000 ) return;
+    m_zoneThrottleLast = t;
+
+    for( auto& slot : m_zoneThrottle )
+    {
+        const auto setting = slot.setting.load( std::memory_order_relaxed );
+        if( setting == 0 ) continue;
+        const auto calls = slot.calls.exchange( 0, std::memory_order_relaxed );
+        if( calls == 0 ) continue;
+        const auto value = setting & ZoneThrottleValueMask;
+        uint32_t kept;
+        if( ( setting >> ZoneThrottleValueBits ) == ZoneThrottleOneInN )
+        {
+            kept = uint32_t( ( uint64_t( calls ) + value - 1 ) / value );
+        }
+        else
+        {
+            kept = std::min( calls, value );
+        }
+
+        QueueItem item;
+        MemWrite( &item.hdr.type, QueueType::ZoneThrottleReport );
+        MemWrite( &item.zoneThrottleReport.srcloc, slot.srcloc.load( std::memory_order_relaxed ) );
+        MemWrite( &item.zoneThrottleReport.calls, calls );
+        MemWrite( &item.zoneThrottleReport.dropped, calls - kept );
+        AppendData( &item, QueueDataSize[(int)QueueType::ZoneThrottleReport] );
+    }
+}
+
+void Profiler::HandleDrainRate( uint64_t rate )
+{
+#ifdef TRACY_ON_DEMAND
+    m_subscribers[m_querySubscriber].drainRate = rate;
+    UpdateDrainRate();
+#else
+    m_drainRate.store( rate, std::memory_order_relaxed );
+#endif
+
+    QueueItem item;
+    MemWrite( &item.hdr.type, QueueType::ParamPingback );
+    AppendData( &item, QueueDataSize[(int)QueueType::ParamPingback] );
+}
+
+#ifdef TRACY_QUEUE_BUDGET
+void Profiler::BudgetWorker()
+{
+    SetThreadName( "Tracy Budget" );
+    while( m_timeBegin.load( std::memory_order_relaxed ) == 0 ) std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    rpmalloc_thread_initialize();
+    while( !ShouldExit() )
+    {
+        ProcessQueueBudget();
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    }
+}
+
+// Checked on a separate thread, because the profiler thread may be blocked on
+// the socket for a long time when the server doesn't keep up. The level is
+// raised as soon as the queues cross 1/2, 3/4 and the whole budget. It is
+// lowered one step at a time, no sooner than 100 ms after the last change,
+// when the usage is a quarter of the budget below the threshold, and the
+// server is able to drain the queued data in 250 ms.
+void Profiler::ProcessQueueBudget()
+{
+    const uint64_t budget = uint64_t( TRACY_QUEUE_BUDGET ) * 1024 * 1024;
+
+    m_serialLock.lock();
+    const auto serial = m_serialQueue.size();
+    m_serialLock.unlock();
+    const auto items = uint64_t( GetQueue().size_approx() + serial );
+    const auto used = items * sizeof( QueueItem );
+    const auto quarters = used * 4 / budget;
+
+    const auto t = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    const auto level = m_dataLossLevel.load( std::memory_order_relaxed );
+    const uint8_t target = quarters >= 4 ? DataLossAll : ( quarters >= 3 ? DataLossNestedZones : ( quarters >= 2 ? DataLossCallstacks : DataLossNone ) );
+    uint8_t next = level;
+    if( target > level )
+    {
+        next = target;
+    }
+    else if( level != DataLossNone && quarters < level && t - m_dataLossChange >= 100ll * 1000 * 1000 )
+    {
+        const auto drainRate = m_drainRate.load( std::memory_order_relaxed );
+        if( drainRate == 0 || items < drainRate / 4 ) next = level - 1;
+    }
+    if( next == level ) return;
+    m_dataLossLevel.store( next, std::memory_order_relaxed );
+    m_dataLossChange = t;
+
+    auto item = QueueSerial();
+    MemWrite( &item->hdr.type, QueueType::DataLoss );
+    MemWrite( &item->dataLoss.time, GetTime() );
+    MemWrite( &item->dataLoss.callstacks, m_dataLossCallstacks.exchange( 0, std::memory_order_relaxed ) );
+    MemWrite( &item->dataLoss.zones, m_dataLossZones.exchange( 0, std::memory_order_relaxed ) );
+    MemWrite( &item->dataLoss.other, m_dataLossOther.exchange( 0, std::memory_order_relaxed ) );
+    MemWrite( &item->dataLoss.level, next );
+    QueueSerialFinish();
+}
+#endif
+
+#ifdef TRACY_MEMORY_SAMPLING
+void Profiler::MemAllocSample( const void* ptr, size_t size, int depth )
+{
+    auto& state = GetMemSampleState();
+    if( !state.init )
+    {
+        // The first countdown of each thread starts at zero. Skip the free
+        // sample it would produce and draw a proper sampling point.
+        state.init = true;
+        state.countdown += MemSampleNextCountdown( state );
+        if( state.countdown > 0 ) return;
+    }
+    // The distance to the next sampling point is memoryless. A large
+    // allocation covering several sampling points is reported once, and the
+    // server weights each sample by its size.
+    state.countdown = MemSampleNextCountdown( state );
+
+    if( (uint64_t)ptr <= MemSampleTombstone ) return;
+#ifdef TRACY_ON_DEMAND
+    if( !GetProfiler().IsConnected() ) return;
+#endif
+    if( !MemSampleInsert( (uint64_t)ptr ) ) return;
+    MemAllocCallstack( ptr, size, depth );
+}
+
+bool Profiler::MemSampleRelease( const void* ptr )
+{
+    if( s_memSampleLive.load( std::memory_order_relaxed ) == 0 ) return false;
+    const auto p = (uint64_t)ptr;
+    if( p <= MemSampleTombstone ) return false;
+    const auto hash = MemSampleHash( p );
+    for( uint32_t i=0; i<MemSampleMaxProbe; i++ )
+    {
+        auto& slot = s_memSampleTable[( hash + i ) & ( MemSampleTableSize - 1 )];
+        const auto val = slot.load( std::memory_order_relaxed );
+        if( val == MemSampleEmpty ) return false;
+        if( val == p )
+        {
+            slot.store( MemSampleTombstone, std::memory_order_relaxed );
+            s_memSampleLive.fetch_sub( 1, std::memory_order_relaxed );
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
 #if ( defined _WIN32 || defined __CYGWIN__ ) && defined TRACY_TIMER_QPC
 int64_t Profiler::GetTimeQpc()
 {
@@ -2827,9 +3804,9 @@ TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin( const struct ___tracy_source_l
 {
     ___tracy_c_zone_context ctx;
 #ifdef TRACY_ON_DEMAND
-    ctx.active = active && tracy::GetProfiler().IsConnected();
+    ctx.active = active && tracy::GetProfiler().IsConnected() && !tracy::Profiler::ZoneThrottled( (const tracy::SourceLocationData*)srcloc ) && !tracy::Profiler::DropZone();
 #else
-    ctx.active = active;
+    ctx.active = active && !tracy::Profiler::ZoneThrottled( (const tracy::SourceLocationData*)srcloc ) && !tracy::Profiler::DropZone();
 #endif
     if( !ctx.active ) return ctx;
     const auto id = tracy::GetProfiler().GetNextZoneId();
@@ -2855,9 +3832,9 @@ TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin_callstack( const struct ___trac
 {
     ___tracy_c_zone_context ctx;
 #ifdef TRACY_ON_DEMAND
-    ctx.active = active && tracy::GetProfiler().IsConnected();
+    ctx.active = active && tracy::GetProfiler().IsConnected() && !tracy::Profiler::ZoneThrottled( (const tracy::SourceLocationData*)srcloc ) && !tracy::Profiler::DropZone();
 #else
-    ctx.active = active;
+    ctx.active = active && !tracy::Profiler::ZoneThrottled( (const tracy::SourceLocationData*)srcloc ) && !tracy::Profiler::DropZone();
 #endif
     if( !ctx.active ) return ctx;
     const auto id = tracy::GetProfiler().GetNextZoneId();
@@ -2870,14 +3847,15 @@ TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin_callstack( const struct ___trac
         TracyLfqCommitC;
     }
 #endif
+    const auto callstack = !tracy::Profiler::DropCallstack();
     {
-        TracyLfqPrepareC( tracy::QueueType::ZoneBeginCallstack );
+        TracyLfqPrepareC( callstack ? tracy::QueueType::ZoneBeginCallstack : tracy::QueueType::ZoneBegin );
         tracy::MemWrite( &item->zoneBegin.time, tracy::Profiler::GetTime() );
         tracy::MemWrite( &item->zoneBegin.srcloc, (uint64_t)srcloc );
         TracyLfqCommitC;
     }
 
-    tracy::GetProfiler().SendCallstack( depth );
+    if( callstack ) tracy::GetProfiler().SendCallstack( depth );
     return ctx;
 }
 
@@ -2885,9 +3863,9 @@ TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin_alloc( uint64_t srcloc, int act
 {
     ___tracy_c_zone_context ctx;
 #ifdef TRACY_ON_DEMAND
-    ctx.active = active && tracy::GetProfiler().IsConnected();
+    ctx.active = active && tracy::GetProfiler().IsConnected() && !tracy::Profiler::DropZone();
 #else
-    ctx.active = active;
+    ctx.active = active && !tracy::Profiler::DropZone();
 #endif
     if( !ctx.active )
     {
@@ -2917,9 +3895,9 @@ TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin_alloc_callstack( uint64_t srclo
 {
     ___tracy_c_zone_context ctx;
 #ifdef TRACY_ON_DEMAND
-    ctx.active = active && tracy::GetProfiler().IsConnected();
+    ctx.active = active && tracy::GetProfiler().IsConnected() && !tracy::Profiler::DropZone();
 #else
-    ctx.active = active;
+    ctx.active = active && !tracy::Profiler::DropZone();
 #endif
     if( !ctx.active )
     {
@@ -2936,20 +3914,22 @@ TRACY_API TracyCZoneCtx ___tracy_emit_zone_begin_alloc_callstack( uint64_t srclo
         TracyLfqCommitC;
     }
 #endif
+    const auto callstack = !tracy::Profiler::DropCallstack();
     {
-        TracyLfqPrepareC( tracy::QueueType::ZoneBeginAllocSrcLocCallstack );
+        TracyLfqPrepareC( callstack ? tracy::QueueType::ZoneBeginAllocSrcLocCallstack : tracy::QueueType::ZoneBeginAllocSrcLoc );
         tracy::MemWrite( &item->zoneBegin.time, tracy::Profiler::GetTime() );
         tracy::MemWrite( &item->zoneBegin.srcloc, srcloc );
         TracyLfqCommitC;
     }
 
-    tracy::GetProfiler().SendCallstack( depth );
+    if( callstack ) tracy::GetProfiler().SendCallstack( depth );
     return ctx;
 }
 
 TRACY_API void ___tracy_emit_zone_end( TracyCZoneCtx ctx )
 {
     if( !ctx.active ) return;
+    tracy::Profiler::DropZoneEnd();
 #ifndef TRACY_NO_VERIFY
     {
         TracyLfqPrepareC( tracy::QueueType::ZoneValidation );
@@ -3004,10 +3984,17 @@ TRACY_API void ___tracy_emit_zone_name( TracyCZoneCtx ctx, const char* txt, size
     }
 }
 
+#ifdef TRACY_MEMORY_SAMPLING
+TRACY_API void ___tracy_emit_memory_alloc( const void* ptr, size_t size ) { tracy::Profiler::MemAllocSampled( ptr, size, TRACY_MEMORY_SAMPLING_DEPTH ); }
+TRACY_API void ___tracy_emit_memory_alloc_callstack( const void* ptr, size_t size, int depth ) { tracy::Profiler::MemAllocSampled( ptr, size, depth ); }
+TRACY_API void ___tracy_emit_memory_free( const void* ptr ) { tracy::Profiler::MemFreeSampled( ptr, TRACY_MEMORY_SAMPLING_DEPTH ); }
+TRACY_API void ___tracy_emit_memory_free_callstack( const void* ptr, int depth ) { tracy::Profiler::MemFreeSampled( ptr, depth ); }
+#else
 TRACY_API void ___tracy_emit_memory_alloc( const void* ptr, size_t size ) { tracy::Profiler::MemAlloc( ptr, size ); }
 TRACY_API void ___tracy_emit_memory_alloc_callstack( const void* ptr, size_t size, int depth ) { tracy::Profiler::MemAllocCallstack( ptr, size, depth ); }
 TRACY_API void ___tracy_emit_memory_free( const void* ptr ) { tracy::Profiler::MemFree( ptr ); }
 TRACY_API void ___tracy_emit_memory_free_callstack( const void* ptr, int depth ) { tracy::Profiler::MemFreeCallstack( ptr, depth ); }
+#endif
 TRACY_API void ___tracy_emit_frame_mark( const char* name ) { tracy::Profiler::SendFrameMark( name ); }
 TRACY_API void ___tracy_emit_frame_mark_start( const char* name ) { tracy::Profiler::SendFrameMark( name, tracy::QueueType::FrameMarkMsgStart ); }
 TRACY_API void ___tracy_emit_frame_mark_end( const char* name ) { tracy::Profiler::SendFrameMark( name, tracy::QueueType::FrameMarkMsgEnd ); }
@@ -3020,6 +4007,7 @@ TRACY_API void ___tracy_emit_messageLC( const char* txt, uint32_t color, int cal
 TRACY_API void ___tracy_emit_message_appinfo( const char* txt, size_t size ) { tracy::Profiler::MessageAppInfo( txt, size ); }
 TRACY_API uint64_t ___tracy_alloc_srcloc( uint32_t line, const char* source, const char* function ) { return tracy::Profiler::AllocSourceLocation( line, source, function ); }
 TRACY_API uint64_t ___tracy_alloc_srcloc_name( uint32_t line, const char* source, const char* function, const char* name, size_t nameSz ) { return tracy::Profiler::AllocSourceLocation( line, source, function, name, nameSz ); }
+TRACY_API const struct ___tracy_source_location_data* ___tracy_intern_srcloc( uint32_t line, const char* source, size_t sourceSz, const char* function, size_t functionSz, const char* name, size_t nameSz, uint32_t color ) { return (const ___tracy_source_location_data*)tracy::Profiler::InternSourceLocation( line, source, sourceSz, function, functionSz, name, nameSz, color ); }
 
 #ifdef __cplusplus
 }
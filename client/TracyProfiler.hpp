@@ -28,10 +28,31 @@
 #  define TRACY_HW_TIMER
 #endif
 
+#if defined TRACY_HW_TIMER && ( defined __i386 || defined _M_IX86 || defined __x86_64__ || defined _M_X64 ) && !defined TRACY_TIMER_QPC
+#  define TRACY_HW_TIMER_TSC
+#endif
+
 #if !defined TRACY_HW_TIMER || ( __ARM_ARCH >= 6 && !defined CLOCK_MONOTONIC_RAW )
   #include <chrono>
 #endif
 
+#if defined TRACY_MEMORY_SAMPLING && !defined TRACY_MEMORY_SAMPLING_DEPTH
+#  ifdef TRACY_CALLSTACK
+#    define TRACY_MEMORY_SAMPLING_DEPTH TRACY_CALLSTACK
+#  else
+#    define TRACY_MEMORY_SAMPLING_DEPTH 16
+#  endif
+#endif
+
+// Length of the zone aggregation interval, in milliseconds.
+#ifndef TRACY_ZONE_AGGREGATE_INTERVAL
+#  define TRACY_ZONE_AGGREGATE_INTERVAL 100
+#endif
+
+// Memory budget of the client queues, in megabytes. When it is defined, data
+// is dropped if the server can't keep up, instead of queueing it without bound.
+// #define TRACY_QUEUE_BUDGET 256
+
 #ifndef TracyConcat
 #  define TracyConcat(x,y) TracyConcatIndirect(x,y)
 #endif
@@ -60,6 +81,17 @@ TRACY_API GpuCtxWrapper& GetGpuCtx();
 TRACY_API uint64_t GetThreadHandle();
 TRACY_API void InitRPMallocThread();
 
+#ifdef TRACY_MEMORY_SAMPLING
+struct MemSampleState
+{
+    int64_t countdown;
+    uint64_t rng;
+    bool init;
+};
+
+TRACY_API MemSampleState& GetMemSampleState();
+#endif
+
 struct SourceLocationData
 {
     const char* name;
@@ -113,6 +145,12 @@ class Profiler
         bool flip;
     };
 
+    struct ZoneAggregateQueueItem
+    {
+        uint64_t thread;
+        char* payload;
+    };
+
 public:
     Profiler();
     ~Profiler();
@@ -200,6 +238,7 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !profiler.IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
         const auto sz = size_t( w ) * size_t( h ) * 4;
         auto ptr = (char*)tracy_malloc( sz );
         memcpy( ptr, image, sz );
@@ -220,6 +259,7 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
         TracyLfqPrepare( QueueType::PlotData );
         MemWrite( &item->plotData.name, (uint64_t)name );
         MemWrite( &item->plotData.time, GetTime() );
@@ -233,6 +273,7 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
         TracyLfqPrepare( QueueType::PlotData );
         MemWrite( &item->plotData.name, (uint64_t)name );
         MemWrite( &item->plotData.time, GetTime() );
@@ -246,6 +287,7 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
         TracyLfqPrepare( QueueType::PlotData );
         MemWrite( &item->plotData.name, (uint64_t)name );
         MemWrite( &item->plotData.time, GetTime() );
@@ -272,6 +314,8 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
+        if( callstack != 0 && DropCallstack() ) callstack = 0;
         auto ptr = (char*)tracy_malloc( size+1 );
         memcpy( ptr, txt, size );
         ptr[size] = '\0';
@@ -288,6 +332,8 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
+        if( callstack != 0 && DropCallstack() ) callstack = 0;
         TracyLfqPrepare( callstack == 0 ? QueueType::MessageLiteral : QueueType::MessageLiteralCallstack );
         MemWrite( &item->message.time, GetTime() );
         MemWrite( &item->message.text, (uint64_t)txt );
@@ -301,6 +347,8 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
+        if( callstack != 0 && DropCallstack() ) callstack = 0;
         auto ptr = (char*)tracy_malloc( size+1 );
         memcpy( ptr, txt, size );
         ptr[size] = '\0';
@@ -320,6 +368,8 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
+        if( DropEvent() ) return;
+        if( callstack != 0 && DropCallstack() ) callstack = 0;
         TracyLfqPrepare( callstack == 0 ? QueueType::MessageLiteralColor : QueueType::MessageLiteralColorCallstack );
         MemWrite( &item->messageColor.time, GetTime() );
         MemWrite( &item->messageColor.text, (uint64_t)txt );
@@ -352,11 +402,7 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
-        const auto thread = GetThreadHandle();
-
-        GetProfiler().m_serialLock.lock();
-        SendMemAlloc( QueueType::MemAlloc, thread, ptr, size );
-        GetProfiler().m_serialLock.unlock();
+        SendMemAlloc( QueueType::MemAlloc, ptr, size );
     }
 
     static tracy_force_inline void MemFree( const void* ptr )
@@ -364,29 +410,25 @@ public:
 #ifdef TRACY_ON_DEMAND
         if( !GetProfiler().IsConnected() ) return;
 #endif
-        const auto thread = GetThreadHandle();
-
-        GetProfiler().m_serialLock.lock();
-        SendMemFree( QueueType::MemFree, thread, ptr );
-        GetProfiler().m_serialLock.unlock();
+        SendMemFree( QueueType::MemFree, ptr );
     }
 
     static tracy_force_inline void MemAllocCallstack( const void* ptr, size_t size, int depth )
     {
 #ifdef TRACY_HAS_CALLSTACK
-        auto& profiler = GetProfiler();
 #  ifdef TRACY_ON_DEMAND
-        if( !profiler.IsConnected() ) return;
+        if( !GetProfiler().IsConnected() ) return;
 #  endif
-        const auto thread = GetThreadHandle();
-
+        if( DropCallstack() )
+        {
+            SendMemAlloc( QueueType::MemAlloc, ptr, size );
+            return;
+        }
         InitRPMallocThread();
         auto callstack = Callstack( depth );
 
-        profiler.m_serialLock.lock();
-        SendMemAlloc( QueueType::MemAllocCallstack, thread, ptr, size );
+        SendMemAlloc( QueueType::MemAllocCallstack, ptr, size );
         SendCallstackMemory( callstack );
-        profiler.m_serialLock.unlock();
 #else
         MemAlloc( ptr, size );
 #endif
@@ -395,24 +437,43 @@ public:
     static tracy_force_inline void MemFreeCallstack( const void* ptr, int depth )
     {
 #ifdef TRACY_HAS_CALLSTACK
-        auto& profiler = GetProfiler();
 #  ifdef TRACY_ON_DEMAND
-        if( !profiler.IsConnected() ) return;
+        if( !GetProfiler().IsConnected() ) return;
 #  endif
-        const auto thread = GetThreadHandle();
-
+        if( DropCallstack() )
+        {
+            SendMemFree( QueueType::MemFree, ptr );
+            return;
+        }
         InitRPMallocThread();
         auto callstack = Callstack( depth );
 
-        profiler.m_serialLock.lock();
-        SendMemFree( QueueType::MemFreeCallstack, thread, ptr );
+        SendMemFree( QueueType::MemFreeCallstack, ptr );
         SendCallstackMemory( callstack );
-        profiler.m_serialLock.unlock();
 #else
         MemFree( ptr );
 #endif
     }
 
+#ifdef TRACY_MEMORY_SAMPLING
+    // Only allocations crossing a sampling point are reported. The distance
+    // between sampling points is exponentially distributed, with the mean of
+    // TRACY_MEMORY_SAMPLING bytes. Frees are reported only for sampled pointers.
+    static tracy_force_inline void MemAllocSampled( const void* ptr, size_t size, int depth )
+    {
+        auto& state = GetMemSampleState();
+        state.countdown -= int64_t( size );
+        if( state.countdown > 0 ) return;
+        MemAllocSample( ptr, size, depth );
+    }
+
+    static tracy_force_inline void MemFreeSampled( const void* ptr, int depth )
+    {
+        if( !MemSampleRelease( ptr ) ) return;
+        MemFreeCallstack( ptr, depth );
+    }
+#endif
+
     static tracy_force_inline void SendCallstack( int depth )
     {
 #ifdef TRACY_HAS_CALLSTACK
@@ -439,6 +500,62 @@ public:
         TracyLfqCommit;
     }
 
+    // Aggregated zones are accumulated per thread and source location, and
+    // sent as a single summary record once per interval.
+    static void AggregateZone( const SourceLocationData* srcloc, int64_t begin, int64_t end );
+
+    // Zones of source locations throttled by the server are not emitted at all.
+    static tracy_force_inline bool ZoneThrottled( const SourceLocationData* srcloc )
+    {
+        auto& profiler = GetProfiler();
+        if( profiler.m_zoneThrottleCount.load( std::memory_order_relaxed ) == 0 ) return false;
+        return profiler.ZoneThrottledSlow( srcloc );
+    }
+
+    // Data dropped when the client queues are over the memory budget. With
+    // TRACY_QUEUE_BUDGET every zone which is not dropped is counted in the
+    // nesting depth of the thread, and must be ended with DropZoneEnd().
+    static tracy_force_inline bool DropCallstack()
+    {
+        auto& profiler = GetProfiler();
+        if( profiler.m_dataLossLevel.load( std::memory_order_relaxed ) == DataLossNone ) return false;
+        profiler.m_dataLossCallstacks.fetch_add( 1, std::memory_order_relaxed );
+        return true;
+    }
+
+    static tracy_force_inline bool DropZone()
+    {
+#ifdef TRACY_QUEUE_BUDGET
+        auto& profiler = GetProfiler();
+        auto& depth = DataLossDepth();
+        const auto level = profiler.m_dataLossLevel.load( std::memory_order_relaxed );
+        if( level == DataLossAll || ( level == DataLossNestedZones && depth >= DataLossKeepDepth ) )
+        {
+            profiler.m_dataLossZones.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+        }
+        depth++;
+#endif
+        return false;
+    }
+
+    static tracy_force_inline void DropZoneEnd()
+    {
+#ifdef TRACY_QUEUE_BUDGET
+        auto& depth = DataLossDepth();
+        assert( depth > 0 );
+        depth--;
+#endif
+    }
+
+    static tracy_force_inline bool DropEvent()
+    {
+        auto& profiler = GetProfiler();
+        if( profiler.m_dataLossLevel.load( std::memory_order_relaxed ) != DataLossAll ) return false;
+        profiler.m_dataLossOther.fetch_add( 1, std::memory_order_relaxed );
+        return true;
+    }
+
     void SendCallstack( int depth, const char* skipBefore );
     static void CutCallstack( void* callstack, const char* skipBefore );
 
@@ -509,6 +626,11 @@ public:
         return uint64_t( ptr );
     }
 
+    // Returns a permanent source location with the given contents, to be used
+    // with the non-allocating zone events. Each unique location is stored
+    // only once, so it is only suitable for a bounded set of locations.
+    static const SourceLocationData* InternSourceLocation( uint32_t line, const char* source, size_t sourceSz, const char* function, size_t functionSz, const char* name, size_t nameSz, uint32_t color = 0 );
+
 private:
     enum class DequeueStatus { DataDequeued, ConnectionLost, QueueEmpty };
 
@@ -518,6 +640,12 @@ private:
     static void LaunchCompressWorker( void* ptr ) { ((Profiler*)ptr)->CompressWorker(); }
     void CompressWorker();
 
+#ifdef TRACY_QUEUE_BUDGET
+    static void LaunchBudgetWorker( void* ptr ) { ((Profiler*)ptr)->BudgetWorker(); }
+    void BudgetWorker();
+    void ProcessQueueBudget();
+#endif
+
     void ClearQueues( tracy::moodycamel::ConsumerToken& token );
     void ClearSerial();
     DequeueStatus Dequeue( tracy::moodycamel::ConsumerToken& token );
@@ -557,36 +685,47 @@ private:
     void SendCallstackPayload64( uint64_t ptr );
     void SendCallstackAlloc( uint64_t ptr );
     void SendCallstackFrame( uint64_t ptr );
+    void SendZoneAggregatePayload( uint64_t ptr );
+    void ProcessZoneAggregates();
     void SendCodeLocation( uint64_t ptr );
 
     bool HandleServerQuery();
+    bool HandleServerQueries();
+    bool HasServerQueries();
     void HandleDisconnect();
     void HandleParameter( uint64_t payload );
     void HandleSymbolQuery( uint64_t symbol );
     void HandleSymbolCodeQuery( uint64_t symbol, uint32_t size );
+    void HandleZoneThrottle( uint64_t srcloc, uint32_t setting );
+    void HandleDrainRate( uint64_t rate );
 
     void CalibrateTimer();
     void CalibrateDelay();
     void ReportTopology();
 
+#ifdef TRACY_MEMORY_SAMPLING
+    static void MemAllocSample( const void* ptr, size_t size, int depth );
+    static bool MemSampleRelease( const void* ptr );
+#endif
+
     static tracy_force_inline void SendCallstackMemory( void* ptr )
     {
 #ifdef TRACY_HAS_CALLSTACK
-        auto item = GetProfiler().m_serialQueue.prepare_next();
-        MemWrite( &item->hdr.type, QueueType::CallstackMemory );
+        TracyLfqPrepare( QueueType::CallstackMemory );
         MemWrite( &item->callstackMemory.ptr, (uint64_t)ptr );
-        GetProfiler().m_serialQueue.commit_next();
+        TracyLfqCommit;
 #endif
     }
 
-    static tracy_force_inline void SendMemAlloc( QueueType type, const uint64_t thread, const void* ptr, size_t size )
+    // Memory events are sent through the per-thread queues. The server needs
+    // them in global order, which is recovered with the order stamp.
+    static tracy_force_inline void SendMemAlloc( QueueType type, const void* ptr, size_t size )
     {
         assert( type == QueueType::MemAlloc || type == QueueType::MemAllocCallstack );
 
-        auto item = GetProfiler().m_serialQueue.prepare_next();
-        MemWrite( &item->hdr.type, type );
+        TracyLfqPrepare( type );
         MemWrite( &item->memAlloc.time, GetTime() );
-        MemWrite( &item->memAlloc.thread, thread );
+        MemWrite( &item->memAlloc.order, GetProfiler().m_memOrder.fetch_add( 1, std::memory_order_relaxed ) );
         MemWrite( &item->memAlloc.ptr, (uint64_t)ptr );
         if( compile_time_condition<sizeof( size ) == 4>::value )
         {
@@ -599,19 +738,18 @@ private:
             memcpy( &item->memAlloc.size, &size, 4 );
             memcpy( ((char*)&item->memAlloc.size)+4, ((char*)&size)+4, 2 );
         }
-        GetProfiler().m_serialQueue.commit_next();
+        TracyLfqCommit;
     }
 
-    static tracy_force_inline void SendMemFree( QueueType type, const uint64_t thread, const void* ptr )
+    static tracy_force_inline void SendMemFree( QueueType type, const void* ptr )
     {
         assert( type == QueueType::MemFree || type == QueueType::MemFreeCallstack );
 
-        auto item = GetProfiler().m_serialQueue.prepare_next();
-        MemWrite( &item->hdr.type, type );
+        TracyLfqPrepare( type );
         MemWrite( &item->memFree.time, GetTime() );
-        MemWrite( &item->memFree.thread, thread );
+        MemWrite( &item->memFree.order, GetProfiler().m_memOrder.fetch_add( 1, std::memory_order_relaxed ) );
         MemWrite( &item->memFree.ptr, (uint64_t)ptr );
-        GetProfiler().m_serialQueue.commit_next();
+        TracyLfqCommit;
     }
 
 #if ( defined _WIN32 || defined __CYGWIN__ ) && defined TRACY_TIMER_QPC
@@ -627,12 +765,15 @@ private:
     std::atomic<bool> m_shutdown;
     std::atomic<bool> m_shutdownManual;
     std::atomic<bool> m_shutdownFinished;
-    Socket* m_sock;
+    Socket* m_sock;     // subscriber currently being served
     UdpBroadcast* m_broadcast;
     bool m_noExit;
     uint32_t m_userPort;
     std::atomic<uint32_t> m_zoneId;
+    std::atomic<uint32_t> m_memOrder;
     int64_t m_samplingPeriod;
+    int64_t m_zoneAggregateInterval;
+    int64_t m_zoneAggregateLast = 0;
 
     uint64_t m_threadCtx;
     int64_t m_refTimeThread;
@@ -653,6 +794,47 @@ private:
     FastVector<FrameImageQueueItem> m_fiQueue, m_fiDequeue;
     TracyMutex m_fiLock;
 
+    // Intervals of idle threads, collected under the list lock and sent after it is released.
+    FastVector<ZoneAggregateQueueItem> m_zoneAggregateQueue;
+
+    TracyMutex m_srclocInternLock;
+
+    // Zone throttle settings are written only by the profiler thread.
+    struct ZoneThrottleSlot
+    {
+        std::atomic<uint64_t> srcloc;
+        std::atomic<uint32_t> setting;
+        std::atomic<uint32_t> calls;
+    };
+
+    enum { ZoneThrottleSlots = 256 };
+
+    bool ZoneThrottledSlow( const SourceLocationData* srcloc );
+    void ResetZoneThrottle();
+    void ProcessZoneThrottle();
+
+    ZoneThrottleSlot m_zoneThrottle[ZoneThrottleSlots];
+    std::atomic<uint32_t> m_zoneThrottleCount;
+    int64_t m_zoneThrottleLast = 0;
+
+    // Zones nested deeper than this are dropped first.
+    enum { DataLossKeepDepth = 2 };
+
+#ifdef TRACY_QUEUE_BUDGET
+    static tracy_force_inline uint32_t& DataLossDepth()
+    {
+        static thread_local uint32_t depth = 0;
+        return depth;
+    }
+#endif
+
+    std::atomic<uint8_t> m_dataLossLevel;
+    std::atomic<uint32_t> m_dataLossCallstacks;
+    std::atomic<uint32_t> m_dataLossZones;
+    std::atomic<uint32_t> m_dataLossOther;
+    std::atomic<uint64_t> m_drainRate;      // queue items per second, advertised by the server
+    int64_t m_dataLossChange = 0;
+
     std::atomic<uint64_t> m_frameCount;
 #ifdef TRACY_ON_DEMAND
     std::atomic<bool> m_isConnected;
@@ -660,6 +842,48 @@ private:
 
     TracyMutex m_deferredLock;
     FastVector<QueueItem> m_deferredQueue;
+
+    // Further servers may attach to a running session. The data stream is
+    // compressed once and written to each subscriber, while query responses
+    // are sent only to the subscriber which asked for them.
+    enum { MaxSubscribers = 4 };
+
+    struct Subscriber
+    {
+        Socket* sock;
+        uint64_t drainRate;
+        bool terminated;
+        bool lost;
+    };
+
+    void SendDeferredItems();
+    void HandshakeSubscriber( const WelcomeMessage& welcome, int64_t t );
+    void AddSubscriber( Socket* sock, const WelcomeMessage& welcome );
+    void RemoveSubscriber( int idx );
+    void DetachSubscriber();
+    void UpdateDrainRate();
+
+    Subscriber m_subscribers[MaxSubscribers];
+    int m_numSubscribers = 0;
+    int m_querySubscriber = 0;
+    bool m_privateSend = false;
+    bool m_independentFrames = false;
+
+    enum { PendingHandshakeSize = HandshakeShibbolethSize + sizeof( uint32_t ) };
+
+    Socket* m_pendingSubscriber = nullptr;
+    char m_pendingHandshake[PendingHandshakeSize];
+    int m_pendingHandshakeSize = 0;
+    int64_t m_pendingSince = 0;
+#endif
+
+#ifdef TRACY_HW_TIMER_TSC
+    void ProcessTimerCalibration();
+
+    int64_t m_timerCalibLast = 0;
+    int64_t m_timerCalibInterval = 0;
+#else
+    void ProcessTimerCalibration() {}
 #endif
 
 #ifdef TRACY_HAS_SYSTIME
@@ -17,9 +17,9 @@ class ScopedZone
 public:
     tracy_force_inline ScopedZone( const SourceLocationData* srcloc, bool is_active = true )
 #ifdef TRACY_ON_DEMAND
-        : m_active( is_active && GetProfiler().IsConnected() )
+        : m_active( is_active && GetProfiler().IsConnected() && !Profiler::ZoneThrottled( srcloc ) && !Profiler::DropZone() )
 #else
-        : m_active( is_active )
+        : m_active( is_active && !Profiler::ZoneThrottled( srcloc ) && !Profiler::DropZone() )
 #endif
     {
         if( !m_active ) return;
@@ -34,26 +34,28 @@ public:
 
     tracy_force_inline ScopedZone( const SourceLocationData* srcloc, int depth, bool is_active = true )
 #ifdef TRACY_ON_DEMAND
-        : m_active( is_active && GetProfiler().IsConnected() )
+        : m_active( is_active && GetProfiler().IsConnected() && !Profiler::ZoneThrottled( srcloc ) && !Profiler::DropZone() )
 #else
-        : m_active( is_active )
+        : m_active( is_active && !Profiler::ZoneThrottled( srcloc ) && !Profiler::DropZone() )
 #endif
     {
         if( !m_active ) return;
 #ifdef TRACY_ON_DEMAND
         m_connectionId = GetProfiler().ConnectionId();
 #endif
-        TracyLfqPrepare( QueueType::ZoneBeginCallstack );
+        const auto callstack = !Profiler::DropCallstack();
+        TracyLfqPrepare( callstack ? QueueType::ZoneBeginCallstack : QueueType::ZoneBegin );
         MemWrite( &item->zoneBegin.time, Profiler::GetTime() );
         MemWrite( &item->zoneBegin.srcloc, (uint64_t)srcloc );
         TracyLfqCommit;
 
-        GetProfiler().SendCallstack( depth );
+        if( callstack ) GetProfiler().SendCallstack( depth );
     }
 
     tracy_force_inline ~ScopedZone()
     {
         if( !m_active ) return;
+        Profiler::DropZoneEnd();
 #ifdef TRACY_ON_DEMAND
         if( GetProfiler().ConnectionId() != m_connectionId ) return;
 #endif
@@ -98,6 +100,33 @@ private:
 #endif
 };
 
+class AggregatedZone
+{
+public:
+    tracy_force_inline AggregatedZone( const SourceLocationData* srcloc, bool is_active = true )
+#ifdef TRACY_ON_DEMAND
+        : m_active( is_active && GetProfiler().IsConnected() )
+#else
+        : m_active( is_active )
+#endif
+        , m_srcloc( srcloc )
+    {
+        if( !m_active ) return;
+        m_begin = Profiler::GetTime();
+    }
+
+    tracy_force_inline ~AggregatedZone()
+    {
+        if( !m_active ) return;
+        Profiler::AggregateZone( m_srcloc, m_begin, Profiler::GetTime() );
+    }
+
+private:
+    const bool m_active;
+    const SourceLocationData* m_srcloc;
+    int64_t m_begin;
+};
+
 }
 
 #endif
@@ -162,7 +162,7 @@ void WINAPI EventRecordCallback( PEVENT_RECORD record )
             if( sw->stackProcess == s_pid && ( sw->stack[0] & 0x8000000000000000 ) == 0 )
             {
                 const uint64_t sz = ( record->UserDataLength - 16 ) / 8;
-                if( sz > 0 )
+                if( sz > 0 && !Profiler::DropCallstack() )
                 {
                     auto trace = (uint64_t*)tracy_malloc( ( 1 + sz ) * sizeof( uint64_t ) );
                     memcpy( trace, &sz, sizeof( uint64_t ) );
@@ -9,7 +9,7 @@ namespace tracy
 
 constexpr unsigned Lz4CompressBound( unsigned isize ) { return isize + ( isize / 255 ) + 16; }
 
-enum : uint32_t { ProtocolVersion = 30 };
+enum : uint32_t { ProtocolVersion = 40 };
 enum : uint32_t { BroadcastVersion = 1 };
 
 using lz4sz_t = uint32_t;
@@ -51,7 +51,9 @@ enum ServerQuery : uint8_t
     ServerQueryParameter,
     ServerQuerySymbol,
     ServerQuerySymbolCode,
-    ServerQueryCodeLocation
+    ServerQueryCodeLocation,
+    ServerQueryZoneThrottle,
+    ServerQueryDrainRate
 };
 
 struct ServerQueryPacket
@@ -63,6 +65,30 @@ struct ServerQueryPacket
 
 enum { ServerQueryPacketSize = sizeof( ServerQueryPacket ) };
 
+// Zone throttle query payload: source location pointer in ptr, mode and value
+// packed in extra. This is not sent as ServerQueryParameter, which packs the
+// parameter index and value in ptr and hands them to the user parameter
+// callback, so there is no room for the 64-bit source location pointer.
+enum ZoneThrottleMode : uint32_t
+{
+    ZoneThrottleNone,
+    ZoneThrottleOneInN,
+    ZoneThrottlePerSecond
+};
+
+enum { ZoneThrottleValueBits = 30 };
+enum : uint32_t { ZoneThrottleValueMask = ( 1u << ZoneThrottleValueBits ) - 1 };
+
+// Data dropped by the client, when its queues exceed the memory budget. Each
+// level also includes the data dropped by the lower levels.
+enum DataLossLevel : uint8_t
+{
+    DataLossNone,
+    DataLossCallstacks,
+    DataLossNestedZones,
+    DataLossAll
+};
+
 
 enum CpuArchitecture : uint8_t
 {
@@ -84,9 +110,11 @@ struct WelcomeMessage
     uint64_t epoch;
     uint64_t pid;
     int64_t samplingPeriod;
+    uint64_t memSampleInterval;
     uint8_t onDemand;
     uint8_t isApple;
     uint8_t cpuArch;
+    uint8_t queueBudget;
     char programName[WelcomeMessageProgramNameSize];
     char hostInfo[WelcomeMessageHostInfoSize];
 };
@@ -98,6 +126,8 @@ struct OnDemandPayloadMessage
 {
     uint64_t frames;
     uint64_t currentTime;
+    uint32_t memOrder;
+    uint8_t lateJoin;
 };
 
 enum { OnDemandPayloadMessageSize = sizeof( OnDemandPayloadMessage ) };
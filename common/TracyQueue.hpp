@@ -22,6 +22,7 @@ enum class QueueType : uint8_t
     CallstackAlloc,
     CallstackSample,
     FrameImage,
+    ZoneAggregate,
     ZoneBegin,
     ZoneBeginCallstack,
     ZoneEnd,
@@ -69,6 +70,10 @@ enum class QueueType : uint8_t
     SymbolInformation,
     CodeInformation,
     SysTimeReport,
+    TimerCalibration,
+    ZoneThrottleReport,
+    DataLoss,
+    TimeReferenceReset,
     TidToPid,
     PlotConfig,
     ParamSetup,
@@ -81,6 +86,7 @@ enum class QueueType : uint8_t
     SourceLocationPayload,
     CallstackPayload,
     CallstackAllocPayload,
+    ZoneAggregatePayload,
     FrameName,
     FrameImageData,
     ExternalName,
@@ -107,6 +113,27 @@ struct QueueZoneEnd
     int64_t time;
 };
 
+struct QueueZoneAggregate
+{
+    uint64_t ptr;
+};
+
+// Zone aggregate payload entry. Durations are in timer ticks, the histogram
+// bucket i counts durations in [2^i, 2^(i+1)) ticks.
+enum { ZoneAggregateBuckets = 32 };
+
+struct QueueZoneAggregateEntry
+{
+    uint64_t srcloc;    // ptr
+    int64_t start;
+    int64_t end;
+    int64_t total;
+    int64_t min;
+    int64_t max;
+    uint32_t count;
+    uint32_t hist[ZoneAggregateBuckets];
+};
+
 struct QueueZoneValidation
 {
     uint32_t id;
@@ -171,7 +198,6 @@ struct QueueLockTerminate
 
 struct QueueLockWait
 {
-    uint64_t thread;
     uint32_t id;
     int64_t time;
     LockType type;
@@ -179,21 +205,18 @@ struct QueueLockWait
 
 struct QueueLockObtain
 {
-    uint64_t thread;
     uint32_t id;
     int64_t time;
 };
 
 struct QueueLockRelease
 {
-    uint64_t thread;
     uint32_t id;
     int64_t time;
 };
 
 struct QueueLockMark
 {
-    uint64_t thread;
     uint32_t id;
     uint64_t srcloc;    // ptr
 };
@@ -274,7 +297,7 @@ struct QueueGpuTime
 struct QueueMemAlloc
 {
     int64_t time;
-    uint64_t thread;
+    uint32_t order;
     uint64_t ptr;
     char size[6];
 };
@@ -282,7 +305,7 @@ struct QueueMemAlloc
 struct QueueMemFree
 {
     int64_t time;
-    uint64_t thread;
+    uint32_t order;
     uint64_t ptr;
 };
 
@@ -351,6 +374,28 @@ struct QueueSysTime
     float sysTime;
 };
 
+struct QueueTimerCalibration
+{
+    int64_t time;       // timer ticks
+    int64_t ns;         // monotonic clock
+};
+
+struct QueueZoneThrottleReport
+{
+    uint64_t srcloc;    // ptr
+    uint32_t calls;
+    uint32_t dropped;
+};
+
+struct QueueDataLoss
+{
+    int64_t time;
+    uint32_t callstacks;    // dropped since the previous level change
+    uint32_t zones;
+    uint32_t other;
+    uint8_t level;
+};
+
 struct QueueContextSwitch
 {
     int64_t time;
@@ -418,6 +463,7 @@ struct QueueItem
         QueueThreadContext threadCtx;
         QueueZoneBegin zoneBegin;
         QueueZoneEnd zoneEnd;
+        QueueZoneAggregate zoneAggregate;
         QueueZoneValidation zoneValidation;
         QueueStringTransfer stringTransfer;
         QueueFrameMark frameMark;
@@ -450,6 +496,9 @@ struct QueueItem
         QueueCodeInformation codeInformation;
         QueueCrashReport crashReport;
         QueueSysTime sysTime;
+        QueueTimerCalibration timerCalibration;
+        QueueZoneThrottleReport zoneThrottleReport;
+        QueueDataLoss dataLoss;
         QueueContextSwitch contextSwitch;
         QueueThreadWakeup threadWakeup;
         QueueTidToPid tidToPid;
@@ -478,6 +527,7 @@ static constexpr size_t QueueDataSize[] = {
     sizeof( QueueHeader ) + sizeof( QueueCallstackAlloc ),
     sizeof( QueueHeader ) + sizeof( QueueCallstackSample ),
     sizeof( QueueHeader ) + sizeof( QueueFrameImage ),
+    sizeof( QueueHeader ) + sizeof( QueueZoneAggregate ),
     sizeof( QueueHeader ) + sizeof( QueueZoneBegin ),
     sizeof( QueueHeader ) + sizeof( QueueZoneBegin ),       // callstack
     sizeof( QueueHeader ) + sizeof( QueueZoneEnd ),
@@ -526,6 +576,10 @@ static constexpr size_t QueueDataSize[] = {
     sizeof( QueueHeader ) + sizeof( QueueSymbolInformation ),
     sizeof( QueueHeader ) + sizeof( QueueCodeInformation ),
     sizeof( QueueHeader ) + sizeof( QueueSysTime ),
+    sizeof( QueueHeader ) + sizeof( QueueTimerCalibration ),
+    sizeof( QueueHeader ) + sizeof( QueueZoneThrottleReport ),
+    sizeof( QueueHeader ) + sizeof( QueueDataLoss ),
+    sizeof( QueueHeader ),                                  // time reference reset
     sizeof( QueueHeader ) + sizeof( QueueTidToPid ),
     sizeof( QueueHeader ) + sizeof( QueuePlotConfig ),
     sizeof( QueueHeader ) + sizeof( QueueParamSetup ),
@@ -539,6 +593,7 @@ static constexpr size_t QueueDataSize[] = {
     sizeof( QueueHeader ) + sizeof( QueueStringTransfer ),  // allocated source location payload
     sizeof( QueueHeader ) + sizeof( QueueStringTransfer ),  // callstack payload
     sizeof( QueueHeader ) + sizeof( QueueStringTransfer ),  // callstack alloc payload
+    sizeof( QueueHeader ) + sizeof( QueueStringTransfer ),  // zone aggregate payload
     sizeof( QueueHeader ) + sizeof( QueueStringTransfer ),  // frame name
     sizeof( QueueHeader ) + sizeof( QueueStringTransfer ),  // frame image data
     sizeof( QueueHeader ) + sizeof( QueueStringTransfer ),  // external name
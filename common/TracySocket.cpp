@@ -342,7 +342,7 @@ bool ListenSocket::Listen( int port, int backlog )
     return true;
 }
 
-Socket* ListenSocket::Accept()
+Socket* ListenSocket::Accept( int timeout )
 {
     struct sockaddr_storage remote;
     socklen_t sz = sizeof( remote );
@@ -351,7 +351,7 @@ Socket* ListenSocket::Accept()
     fd.fd = (socket_t)m_sock;
     fd.events = POLLIN;
 
-    if( poll( &fd, 1, 10 ) > 0 )
+    if( poll( &fd, 1, timeout ) > 0 )
     {
         int sock = accept( m_sock, (sockaddr*)&remote, &sz);
         if( sock == -1 ) return nullptr;
@@ -69,7 +69,7 @@ public:
     ~ListenSocket();
 
     bool Listen( int port, int backlog );
-    Socket* Accept();
+    Socket* Accept( int timeout = 10 );
     void Close();
 
     ListenSocket( const ListenSocket& ) = delete;
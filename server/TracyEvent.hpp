@@ -12,6 +12,7 @@
 #include "TracyVector.hpp"
 #include "tracy_robin_hood.h"
 #include "../common/TracyForceInline.hpp"
+#include "../common/TracyQueue.hpp"
 
 namespace tracy
 {
@@ -192,6 +193,19 @@ enum { ZoneEventSize = sizeof( ZoneEvent ) };
 static_assert( std::is_standard_layout<ZoneEvent>::value, "ZoneEvent is not standard layout" );
 
 
+// Start and end times of the last zone in each block of a finished zone
+// timeline, stored as separate contiguous arrays. Binary searches are done
+// on these columns first, and then only within a single block of zones.
+struct ZoneColumns
+{
+    enum { BlockSize = 64 };
+    enum { MinZones = 16 * BlockSize };
+
+    Vector<int64_t> start;
+    Vector<int64_t> end;
+};
+
+
 struct ZoneExtra
 {
     Int24 callstack;
@@ -524,6 +538,40 @@ enum { GhostZoneSize = sizeof( GhostZone ) };
 #pragma pack()
 
 
+// Summary of aggregated zones of a single source location, collected on the
+// client over one interval. Times are in nanoseconds, histogram buckets are in
+// timer ticks.
+struct ZoneAggregate
+{
+    int64_t start;
+    int64_t end;
+    int64_t total;
+    int64_t min;
+    int64_t max;
+    uint64_t count;
+    uint32_t hist[ZoneAggregateBuckets];
+};
+
+enum { ZoneAggregateSize = sizeof( ZoneAggregate ) };
+
+// Time range in which the client was dropping data, because its queues were
+// over the memory budget. Counts are the numbers of dropped events.
+struct DataLossRange
+{
+    int64_t start;
+    int64_t end;            // -1 while data is still being dropped
+    uint64_t callstacks;
+    uint64_t zones;
+    uint64_t other;
+    uint8_t level;
+};
+
+struct ZoneAggregateTrack
+{
+    int16_t srcloc;
+    Vector<ZoneAggregate> data;
+};
+
 struct ThreadData
 {
     uint64_t id;
@@ -538,6 +586,7 @@ struct ThreadData
     Vector<GhostZone> ghostZones;
 #endif
     Vector<SampleData> samples;
+    Vector<ZoneAggregateTrack> zoneAggregates;
 };
 
 struct GpuCtxThreadData
@@ -572,6 +621,7 @@ struct LockMap
     StringIdx customName;
     int16_t srcloc;
     Vector<LockEventPtr> timeline;
+    Vector<LockEventPtr> postpone;
     unordered_flat_map<uint64_t, uint8_t> threadMap;
     std::vector<uint64_t> threadList;
     LockType type;
@@ -626,6 +676,7 @@ struct MemData
     uint64_t high = std::numeric_limits<uint64_t>::min();
     uint64_t low = std::numeric_limits<uint64_t>::max();
     uint64_t usage = 0;
+    uint64_t sampleInterval = 0;
     PlotData* plot = nullptr;
 };
 
@@ -670,9 +721,26 @@ struct ContextSwitch
     int64_t runningTime = 0;
 };
 
+enum { PackedCpuChunkSize = 1024 };
+
+struct PackedCpuChunk
+{
+    int64_t start;
+    int64_t lastStart;
+    int64_t lastEnd;
+    const uint64_t* data;
+    uint16_t size;
+    uint8_t startBits;
+    uint8_t lengthBits;
+    uint8_t threadBits;
+};
+
 struct CpuData
 {
     Vector<ContextSwitchCpu> cs;
+    // Replaces cs for large loaded traces, see TracyPackedCpuData.hpp.
+    Vector<PackedCpuChunk> packed;
+    uint64_t packedSize = 0;
 };
 
 struct CpuThreadData
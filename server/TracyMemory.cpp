@@ -1,8 +1,134 @@
+#include <map>
+#include <mutex>
+#include <string>
+
+#if defined _MSC_VER || defined __MINGW32__ || defined __CYGWIN__
+#  include <fcntl.h>
+#  include <io.h>
+#  include <sys/stat.h>
+#else
+#  include <unistd.h>
+#endif
+
+#ifdef __linux__
+#  include <sys/mman.h>
+#endif
+
 #include "TracyMemory.hpp"
+#include "TracyMmap.hpp"
 
 namespace tracy
 {
 
 size_t memUsage = 0;
+size_t memLimit = 0;
+std::atomic<uint32_t> spillCount( 0 );
+bool memHugePages = getenv( "TRACY_HUGE_PAGES" ) != nullptr;
+MemStats memStats;
+
+static std::mutex s_spillLock;
+static std::string s_spillPath;
+static std::map<void*, size_t> s_spill;
+
+void SetSpillPath( const char* path )
+{
+    std::lock_guard<std::mutex> lock( s_spillLock );
+    s_spillPath = path ? path : "";
+}
+
+void* SpillAlloc( size_t size )
+{
+    std::lock_guard<std::mutex> lock( s_spillLock );
+#if defined _MSC_VER || defined __MINGW32__ || defined __CYGWIN__
+    auto name = _tempnam( s_spillPath.empty() ? nullptr : s_spillPath.c_str(), "tracy" );
+    if( !name ) return nullptr;
+    const auto fd = _open( name, _O_CREAT | _O_EXCL | _O_RDWR | _O_BINARY | _O_TEMPORARY, _S_IREAD | _S_IWRITE );
+    free( name );
+    if( fd == -1 ) return nullptr;
+    if( _chsize_s( fd, size ) != 0 )
+    {
+        _close( fd );
+        return nullptr;
+    }
+#else
+    std::string name = s_spillPath;
+    if( name.empty() )
+    {
+        auto tmp = getenv( "TMPDIR" );
+        name = tmp ? tmp : "/tmp";
+    }
+    name += "/tracy-spill-XXXXXX";
+    const auto fd = mkstemp( &name[0] );
+    if( fd == -1 ) return nullptr;
+    unlink( name.c_str() );
+    if( ftruncate( fd, size ) != 0 )
+    {
+        close( fd );
+        return nullptr;
+    }
+#endif
+
+    auto ptr = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+#if defined _MSC_VER || defined __MINGW32__ || defined __CYGWIN__
+    _close( fd );
+#else
+    close( fd );
+#endif
+    if( ptr == (void*)-1 ) return nullptr;
+
+    s_spill.emplace( ptr, size );
+    spillCount.fetch_add( 1, std::memory_order_relaxed );
+    return ptr;
+}
+
+bool SpillFree( void* ptr )
+{
+    std::lock_guard<std::mutex> lock( s_spillLock );
+    auto it = s_spill.find( ptr );
+    if( it == s_spill.end() ) return false;
+    munmap( it->first, it->second );
+    s_spill.erase( it );
+    spillCount.fetch_sub( 1, std::memory_order_relaxed );
+    return true;
+}
+
+void* MemAllocLarge( size_t size )
+{
+    memStats.large.fetch_add( 1, std::memory_order_relaxed );
+    memStats.largeBytes.fetch_add( size, std::memory_order_relaxed );
+
+    if( memLimit != 0 && memUsage > memLimit )
+    {
+        auto ptr = SpillAlloc( size );
+        if( ptr )
+        {
+            memStats.spill.fetch_add( 1, std::memory_order_relaxed );
+            memStats.spillBytes.fetch_add( size, std::memory_order_relaxed );
+            return ptr;
+        }
+    }
+
+#if defined __linux__ && defined MADV_HUGEPAGE
+    if( memHugePages && size >= HugePageSize )
+    {
+        // Pages are placed on the NUMA node of the thread which touches them
+        // first. Slab blocks and vector storage are filled by the thread that
+        // allocates them, so there is no need for explicit node binding.
+        const auto aligned = ( size + HugePageSize - 1 ) & ~size_t( HugePageSize - 1 );
+        void* ptr;
+        if( posix_memalign( &ptr, HugePageSize, aligned ) == 0 )
+        {
+            if( madvise( ptr, aligned, MADV_HUGEPAGE ) == 0 )
+            {
+                memStats.huge.fetch_add( 1, std::memory_order_relaxed );
+                memStats.hugeBytes.fetch_add( aligned, std::memory_order_relaxed );
+            }
+            return ptr;
+        }
+    }
+#endif
+
+    return malloc( size );
+}
 
 }
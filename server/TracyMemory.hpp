@@ -1,13 +1,65 @@
 #ifndef __TRACYMEMORY_HPP__
 #define __TRACYMEMORY_HPP__
 
+#include <atomic>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "../common/TracyForceInline.hpp"
+
 namespace tracy
 {
 
 extern size_t memUsage;
 
+// Once memUsage exceeds memLimit, large allocations are backed by unlinked
+// spill files instead of anonymous memory. The operating system may then
+// write their pages back to disk and drop them under memory pressure,
+// faulting them in again on access. Zero disables spilling.
+extern size_t memLimit;
+extern std::atomic<uint32_t> spillCount;
+
+// If enabled, large allocations are aligned to the huge page size and marked
+// as eligible for transparent huge pages, which reduces TLB misses when large
+// traces are traversed. Enabled by the TRACY_HUGE_PAGES environment variable.
+// Only available on Linux.
+extern bool memHugePages;
+
+enum { SpillMinSize = 1024 * 1024 };
+enum { HugePageSize = 2 * 1024 * 1024 };
+
+// Cumulative counts of allocations handled by MemAllocLarge().
+struct MemStats
+{
+    std::atomic<uint64_t> large;
+    std::atomic<uint64_t> largeBytes;
+    std::atomic<uint64_t> huge;
+    std::atomic<uint64_t> hugeBytes;
+    std::atomic<uint64_t> spill;
+    std::atomic<uint64_t> spillBytes;
+};
+
+extern MemStats memStats;
+
+void SetSpillPath( const char* path );
+void* SpillAlloc( size_t size );
+bool SpillFree( void* ptr );
+void* MemAllocLarge( size_t size );
+
+static tracy_force_inline void* MemAlloc( size_t size )
+{
+    if( size >= SpillMinSize ) return MemAllocLarge( size );
+    return malloc( size );
+}
+
+// Size must be the one passed to MemAlloc(). Only large allocations may be
+// spilled, so smaller ones skip the spill map lookup.
+static tracy_force_inline void MemFree( void* ptr, size_t size )
+{
+    if( size >= SpillMinSize && spillCount.load( std::memory_order_relaxed ) != 0 && SpillFree( ptr ) ) return;
+    free( ptr );
+}
+
 }
 
 #endif
@@ -0,0 +1,191 @@
+#ifndef __TRACYPACKEDCPUDATA_HPP__
+#define __TRACYPACKEDCPUDATA_HPP__
+
+#include <algorithm>
+#include <assert.h>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+
+#include "TracyEvent.hpp"
+#include "TracySlab.hpp"
+#include "../common/TracyForceInline.hpp"
+
+namespace tracy
+{
+
+// Each chunk of packed context switch regions stores, per region, the zigzag
+// encoded start delta to the previous region, the zigzag encoded region
+// length and the thread, using the smallest bit widths which fit the chunk.
+
+namespace detail
+{
+
+static tracy_force_inline uint64_t ZigZag( int64_t v ) { return ( uint64_t( v ) << 1 ) ^ uint64_t( v >> 63 ); }
+static tracy_force_inline int64_t UnZigZag( uint64_t v ) { return int64_t( v >> 1 ) ^ -int64_t( v & 1 ); }
+
+static tracy_force_inline uint8_t BitWidth( uint64_t v )
+{
+    uint8_t bits = 0;
+    while( v != 0 )
+    {
+        bits++;
+        v >>= 1;
+    }
+    return bits;
+}
+
+static tracy_force_inline void PutBits( uint64_t* dst, uint64_t& pos, uint64_t val, uint8_t bits )
+{
+    if( bits == 0 ) return;
+    const auto idx = pos >> 6;
+    const auto sh = pos & 63;
+    dst[idx] |= val << sh;
+    if( sh + bits > 64 ) dst[idx+1] |= val >> ( 64 - sh );
+    pos += bits;
+}
+
+static tracy_force_inline uint64_t GetBits( const uint64_t* src, uint64_t& pos, uint8_t bits )
+{
+    if( bits == 0 ) return 0;
+    const auto idx = pos >> 6;
+    const auto sh = pos & 63;
+    uint64_t val = src[idx] >> sh;
+    if( sh + bits > 64 ) val |= src[idx+1] << ( 64 - sh );
+    if( bits < 64 ) val &= ( 1ull << bits ) - 1;
+    pos += bits;
+    return val;
+}
+
+}
+
+template<size_t U>
+static inline void PackCpuChunk( PackedCpuChunk& chunk, const ContextSwitchCpu* data, size_t size, Slab<U>& slab )
+{
+    assert( size != 0 && size <= PackedCpuChunkSize );
+
+    uint64_t maxStart = 0;
+    uint64_t maxLength = 0;
+    uint16_t maxThread = 0;
+    int64_t prev = data[0].Start();
+    for( size_t i=0; i<size; i++ )
+    {
+        const auto start = data[i].Start();
+        maxStart |= detail::ZigZag( start - prev );
+        maxLength |= detail::ZigZag( data[i].End() - start );
+        maxThread |= data[i].Thread();
+        prev = start;
+    }
+
+    chunk.start = data[0].Start();
+    chunk.lastStart = data[size-1].Start();
+    chunk.lastEnd = data[size-1].End();
+    chunk.size = uint16_t( size );
+    chunk.startBits = detail::BitWidth( maxStart );
+    chunk.lengthBits = detail::BitWidth( maxLength );
+    chunk.threadBits = detail::BitWidth( maxThread );
+
+    const auto words = ( size * ( chunk.startBits + chunk.lengthBits + chunk.threadBits ) + 63 ) / 64;
+    auto dst = (uint64_t*)slab.AllocBig( std::max<size_t>( words, 1 ) * sizeof( uint64_t ) );
+    memset( dst, 0, std::max<size_t>( words, 1 ) * sizeof( uint64_t ) );
+
+    uint64_t pos = 0;
+    prev = chunk.start;
+    for( size_t i=0; i<size; i++ )
+    {
+        const auto start = data[i].Start();
+        detail::PutBits( dst, pos, detail::ZigZag( start - prev ), chunk.startBits );
+        detail::PutBits( dst, pos, detail::ZigZag( data[i].End() - start ), chunk.lengthBits );
+        detail::PutBits( dst, pos, data[i].Thread(), chunk.threadBits );
+        prev = start;
+    }
+    chunk.data = dst;
+}
+
+static inline void UnpackCpuChunk( const PackedCpuChunk& chunk, ContextSwitchCpu* out )
+{
+    uint64_t pos = 0;
+    int64_t start = chunk.start;
+    for( uint16_t i=0; i<chunk.size; i++ )
+    {
+        start += detail::UnZigZag( detail::GetBits( chunk.data, pos, chunk.startBits ) );
+        const auto end = start + detail::UnZigZag( detail::GetBits( chunk.data, pos, chunk.lengthBits ) );
+        const auto thread = uint16_t( detail::GetBits( chunk.data, pos, chunk.threadBits ) );
+        out[i].SetStartThread( start, thread );
+        out[i].SetEnd( end );
+    }
+}
+
+
+// Random access to the context switch regions of a CPU, regardless of them
+// being packed or not. Packed chunks are unpacked into a cache owned by the
+// reader, so each thread accessing the data has to use its own reader.
+class CpuDataReader
+{
+public:
+    explicit CpuDataReader( const CpuData& cpu )
+        : m_cpu( cpu )
+        , m_chunk( -1 )
+    {
+    }
+
+    tracy_force_inline size_t size() const { return m_cpu.packed.empty() ? m_cpu.cs.size() : m_cpu.packedSize; }
+    tracy_force_inline bool empty() const { return size() == 0; }
+
+    tracy_force_inline ContextSwitchCpu operator[]( size_t idx )
+    {
+        if( m_cpu.packed.empty() ) return m_cpu.cs[idx];
+        const auto chunk = idx / PackedCpuChunkSize;
+        if( chunk != m_chunk ) Unpack( chunk );
+        return m_cache[idx % PackedCpuChunkSize];
+    }
+
+    // First region in [first, last) with (uint64_t)End() >= time.
+    size_t LowerBoundEnd( size_t first, size_t last, int64_t time )
+    {
+        auto cmp = [] ( const ContextSwitchCpu& l, int64_t r ) { return (uint64_t)l.End() < (uint64_t)r; };
+        if( m_cpu.packed.empty() ) return std::lower_bound( m_cpu.cs.begin() + first, m_cpu.cs.begin() + last, time, cmp ) - m_cpu.cs.begin();
+        return LowerBound( first, last, time, [time] ( const PackedCpuChunk& c ) { return (uint64_t)c.lastEnd < (uint64_t)time; }, cmp );
+    }
+
+    // First region in [first, last) with Start() >= time.
+    size_t LowerBoundStart( size_t first, size_t last, int64_t time )
+    {
+        auto cmp = [] ( const ContextSwitchCpu& l, int64_t r ) { return l.Start() < r; };
+        if( m_cpu.packed.empty() ) return std::lower_bound( m_cpu.cs.begin() + first, m_cpu.cs.begin() + last, time, cmp ) - m_cpu.cs.begin();
+        return LowerBound( first, last, time, [time] ( const PackedCpuChunk& c ) { return c.lastStart < time; }, cmp );
+    }
+
+private:
+    void Unpack( size_t chunk )
+    {
+        if( !m_cache ) m_cache = std::make_unique<ContextSwitchCpu[]>( PackedCpuChunkSize );
+        UnpackCpuChunk( m_cpu.packed[chunk], m_cache.get() );
+        m_chunk = chunk;
+    }
+
+    // The chunk containing the searched region is found using the last
+    // region of each chunk, and only this chunk is unpacked.
+    template<typename F, typename Cmp>
+    size_t LowerBound( size_t first, size_t last, int64_t time, F chunkBefore, Cmp cmp )
+    {
+        if( first >= last ) return last;
+        const auto& packed = m_cpu.packed;
+        const auto it = std::partition_point( packed.begin() + first / PackedCpuChunkSize, packed.begin() + ( last - 1 ) / PackedCpuChunkSize + 1, chunkBefore );
+        const auto chunk = size_t( it - packed.begin() );
+        const auto base = chunk * PackedCpuChunkSize;
+        if( base >= last ) return last;
+        if( chunk != m_chunk ) Unpack( chunk );
+        const auto b = std::max( first, base ) - base;
+        const auto e = std::min( last, base + PackedCpuChunkSize ) - base;
+        return base + size_t( std::lower_bound( m_cache.get() + b, m_cache.get() + e, time, cmp ) - m_cache.get() );
+    }
+
+    const CpuData& m_cpu;
+    size_t m_chunk;
+    std::unique_ptr<ContextSwitchCpu[]> m_cache;
+};
+
+}
+
+#endif
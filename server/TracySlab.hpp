@@ -2,6 +2,7 @@
 #define __TRACYSLAB_HPP__
 
 #include <assert.h>
+#include <utility>
 #include <vector>
 
 #include "TracyMemory.hpp"
@@ -14,9 +15,9 @@ class Slab
 {
 public:
     Slab()
-        : m_ptr( new char[BlockSize] )
+        : m_ptr( (char*)MemAlloc( BlockSize ) )
         , m_offset( 0 )
-        , m_buffer( { m_ptr } )
+        , m_buffer( { { m_ptr, BlockSize } } )
         , m_usage( BlockSize )
     {
         memUsage += BlockSize;
@@ -27,7 +28,7 @@ public:
         memUsage -= m_usage;
         for( auto& v : m_buffer )
         {
-            delete[] v;
+            MemFree( v.first, v.second );
         }
     }
 
@@ -105,8 +106,8 @@ public:
         {
             memUsage += size;
             m_usage += size;
-            auto ret = new char[size];
-            m_buffer.emplace_back( ret );
+            auto ret = (char*)MemAlloc( size );
+            m_buffer.emplace_back( ret, size );
             return ret;
         }
     }
@@ -119,11 +120,11 @@ public:
             m_usage = BlockSize;
             for( int i=1; i<m_buffer.size(); i++ )
             {
-                delete[] m_buffer[i];
+                MemFree( m_buffer[i].first, m_buffer[i].second );
             }
-            m_ptr = m_buffer[0];
+            m_ptr = m_buffer[0].first;
             m_buffer.clear();
-            m_buffer.emplace_back( m_ptr );
+            m_buffer.emplace_back( m_ptr, BlockSize );
         }
         m_offset = 0;
     }
@@ -137,10 +138,10 @@ public:
 private:
     void* DoAlloc( uint32_t willUseBytes )
     {
-        auto ptr = new char[BlockSize];
+        auto ptr = (char*)MemAlloc( BlockSize );
         m_ptr = ptr;
         m_offset = willUseBytes;
-        m_buffer.emplace_back( m_ptr );
+        m_buffer.emplace_back( m_ptr, BlockSize );
         memUsage += BlockSize;
         m_usage += BlockSize;
         return ptr;
@@ -148,7 +149,7 @@ private:
 
     char* m_ptr;
     uint32_t m_offset;
-    std::vector<char*> m_buffer;
+    std::vector<std::pair<char*, size_t>> m_buffer;
     size_t m_usage;
 };
 
@@ -0,0 +1,146 @@
+#ifndef __TRACYSTRINGSEARCH_HPP__
+#define __TRACYSTRINGSEARCH_HPP__
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined __SSE2__ || defined _M_AMD64 || _M_IX86_FP == 2
+#  include <emmintrin.h>
+#  define TRACY_STRINGSEARCH_SSE2
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  endif
+#endif
+
+#include "../common/TracyForceInline.hpp"
+
+namespace tracy
+{
+
+// ASCII case insensitive substring search. Candidate positions are found by
+// comparing the first and the last character of the needle against sixteen
+// haystack positions at once, and only these candidates are verified.
+class StringSearch
+{
+public:
+    StringSearch( const char* needle, size_t sz )
+        : m_needle( sz, '\0' )
+    {
+        for( size_t i=0; i<sz; i++ ) m_needle[i] = Lower( needle[i] );
+    }
+
+    bool Match( const char* str, size_t sz ) const
+    {
+        const auto nsz = m_needle.size();
+        if( nsz == 0 ) return true;
+        if( sz < nsz ) return false;
+
+        const auto needle = m_needle.data();
+        const auto last = sz - nsz;
+        size_t i = 0;
+#ifdef TRACY_STRINGSEARCH_SSE2
+        const auto first = needle[0];
+        const auto tail = needle[nsz-1];
+        const auto vFirst = _mm_set1_epi8( first );
+        const auto vTail = _mm_set1_epi8( tail );
+        const auto vFirstCase = _mm_set1_epi8( IsAlpha( first ) ? 0x20 : 0 );
+        const auto vTailCase = _mm_set1_epi8( IsAlpha( tail ) ? 0x20 : 0 );
+        for( ; i + 16 <= last + 1; i += 16 )
+        {
+            const auto a = _mm_or_si128( _mm_loadu_si128( (const __m128i*)( str + i ) ), vFirstCase );
+            const auto b = _mm_or_si128( _mm_loadu_si128( (const __m128i*)( str + i + nsz - 1 ) ), vTailCase );
+            auto mask = (uint32_t)_mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( a, vFirst ), _mm_cmpeq_epi8( b, vTail ) ) );
+            while( mask != 0 )
+            {
+                if( Equal( str + i + CountTrailingZeros( mask ), needle, nsz ) ) return true;
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for( ; i <= last; i++ )
+        {
+            if( Equal( str + i, needle, nsz ) ) return true;
+        }
+        return false;
+    }
+
+private:
+    static tracy_force_inline char Lower( char c ) { return ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c; }
+    static tracy_force_inline bool IsAlpha( char c ) { return c >= 'a' && c <= 'z'; }
+
+    static tracy_force_inline bool Equal( const char* str, const char* needle, size_t sz )
+    {
+        for( size_t i=0; i<sz; i++ )
+        {
+            if( Lower( str[i] ) != needle[i] ) return false;
+        }
+        return true;
+    }
+
+#ifdef TRACY_STRINGSEARCH_SSE2
+    static tracy_force_inline uint32_t CountTrailingZeros( uint32_t mask )
+    {
+#  ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanForward( &idx, mask );
+        return idx;
+#  else
+        return __builtin_ctz( mask );
+#  endif
+    }
+#endif
+
+    std::string m_needle;
+};
+
+// Ordered list of included and excluded search terms, evaluated with the same
+// rules as ImGuiTextFilter. The first term which is found decides whether the
+// string passes. If no term is found, the string passes only if there are no
+// included terms.
+class StringFilter
+{
+public:
+    void Clear()
+    {
+        m_terms.clear();
+        m_include = 0;
+    }
+
+    void Add( const char* str, size_t sz, bool exclude )
+    {
+        // ImGuiTextFilter ignores terms which are empty, or consist of just
+        // the exclusion mark.
+        if( sz == 0 ) return;
+        m_terms.emplace_back( Term { StringSearch( str, sz ), exclude } );
+        if( !exclude ) m_include++;
+    }
+
+    bool IsActive() const { return !m_terms.empty(); }
+
+    bool Match( const char* str ) const
+    {
+        if( m_terms.empty() ) return true;
+        const auto sz = strlen( str );
+        for( auto& v : m_terms )
+        {
+            if( v.search.Match( str, sz ) ) return !v.exclude;
+        }
+        return m_include == 0;
+    }
+
+private:
+    struct Term
+    {
+        StringSearch search;
+        bool exclude;
+    };
+
+    std::vector<Term> m_terms;
+    size_t m_include = 0;
+};
+
+}
+
+#endif
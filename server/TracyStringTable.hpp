@@ -0,0 +1,94 @@
+#ifndef __TRACYSTRINGTABLE_HPP__
+#define __TRACYSTRINGTABLE_HPP__
+
+#include <assert.h>
+#include <limits>
+#include <stdint.h>
+#include <string.h>
+
+#include "../common/TracyForceInline.hpp"
+#include "tracy_robin_hood.h"
+#include "TracyCharUtil.hpp"
+#include "TracyVector.hpp"
+
+namespace tracy
+{
+
+// Interned strings, addressed by index. The deduplication set only keeps
+// 32-bit string indices and hashes the stored string data itself, instead of
+// keeping a pointer, a size and an index for each string.
+class StringTable
+{
+    struct Hasher
+    {
+        const Vector<const char*>* data;
+
+        tracy_force_inline size_t operator()( uint32_t idx ) const { return charutil::hash( (*data)[idx] ); }
+        tracy_force_inline size_t operator()( const charutil::StringKey& key ) const { return charutil::hash( key.ptr, key.sz ); }
+    };
+
+    struct Comparator
+    {
+        const Vector<const char*>* data;
+
+        tracy_force_inline bool operator()( uint32_t lhs, uint32_t rhs ) const { return lhs == rhs; }
+        tracy_force_inline bool operator()( const charutil::StringKey& lhs, uint32_t rhs ) const
+        {
+            const auto str = (*data)[rhs];
+            return strlen( str ) == lhs.sz && memcmp( str, lhs.ptr, lhs.sz ) == 0;
+        }
+    };
+
+public:
+    StringTable()
+        : m_set( 0, Hasher { &m_data }, Comparator { &m_data } )
+    {
+    }
+
+    StringTable( const StringTable& ) = delete;
+    StringTable( StringTable&& ) = delete;
+
+    StringTable& operator=( const StringTable& ) = delete;
+    StringTable& operator=( StringTable&& ) = delete;
+
+    tracy_force_inline size_t size() const { return m_data.size(); }
+    tracy_force_inline const char* operator[]( size_t idx ) const { return m_data[idx]; }
+
+    // Returns the index of the string, or -1 if it is not stored.
+    tracy_force_inline int64_t Find( const char* str, size_t sz ) const
+    {
+        auto it = m_set.find( charutil::StringKey { str, sz }, is_transparent_tag {} );
+        return it == m_set.end() ? -1 : int64_t( *it );
+    }
+
+    // The string must be null terminated, unique, and must outlive the table.
+    tracy_force_inline uint32_t Add( const char* str )
+    {
+        const auto idx = uint32_t( m_data.size() );
+        m_data.push_back( str );
+        m_set.emplace( idx );
+        return idx;
+    }
+
+    template<size_t U>
+    void ReserveExact( size_t sz, Slab<U>& slab )
+    {
+        assert( m_data.empty() );
+        m_data.reserve_exact( sz, slab );
+        m_set.reserve( sz );
+    }
+
+    tracy_force_inline void Set( uint32_t idx, const char* str )
+    {
+        m_data[idx] = str;
+        m_set.emplace( idx );
+    }
+
+private:
+    Vector<const char*> m_data;
+    unordered_flat_set<uint32_t, Hasher, Comparator> m_set;
+};
+
+}
+
+#endif
@@ -1,82 +1,243 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include "../common/TracySystem.hpp"
 #include "TracyTaskDispatch.hpp"
 
 namespace tracy
 {
 
-TaskDispatch::TaskDispatch( size_t workers )
-    : m_exit( false )
-    , m_jobs( 0 )
+static thread_local TaskDispatch* s_dispatch = nullptr;
+static thread_local size_t s_workerIdx = 0;
+
+// Tasks of a group, in the order they were queued. Referenced by the group and
+// by each ticket, as tickets may be taken after the group is destroyed.
+struct TaskGroupQueue
 {
-    assert( workers >= 1 );
+    std::mutex lock;
+    std::deque<Task> tasks;
+    std::atomic<size_t> queued { 0 };
+    std::atomic<size_t> refs { 1 };
+};
+
+static void Release( TaskGroupQueue* queue )
+{
+    if( queue->refs.fetch_sub( 1 ) == 1 ) delete queue;
+}
 
-    m_workers.reserve( workers );
-    for( size_t i=0; i<workers; i++ )
+// Takes the newest or the oldest task of the group queue.
+static bool TakeTask( TaskGroupQueue* queue, bool newest, Task& task )
+{
+    std::lock_guard<std::mutex> lock( queue->lock );
+    auto& tasks = queue->tasks;
+    if( tasks.empty() ) return false;
+    if( newest )
     {
-        m_workers.emplace_back( std::thread( [this]{ Worker(); } ) );
+        task = std::move( tasks.back() );
+        tasks.pop_back();
     }
+    else
+    {
+        task = std::move( tasks.front() );
+        tasks.pop_front();
+    }
+    queue->queued.fetch_sub( 1 );
+    return true;
+}
+
+TaskDispatch::TaskDispatch( size_t workers )
+    : m_queues( new Queue[workers] )
+    , m_numWorkers( workers )
+    , m_started( false )
+    , m_queued( 0 )
+    , m_sleeping( 0 )
+    , m_next( 0 )
+    , m_exit( false )
+{
+    assert( workers >= 1 );
 }
 
 TaskDispatch::~TaskDispatch()
 {
-    m_exit.store( true, std::memory_order_release );
-    m_queueLock.lock();
+    m_exit.store( true );
+    m_sleepLock.lock();
     m_cvWork.notify_all();
-    m_queueLock.unlock();
+    m_sleepLock.unlock();
 
     for( auto& worker : m_workers )
     {
         worker.join();
     }
+
+    for( size_t i=0; i<m_numWorkers; i++ )
+    {
+        for( auto& queue : m_queues[i].tickets ) Release( queue );
+    }
+}
+
+TaskDispatch& TaskDispatch::Get()
+{
+    static TaskDispatch td( std::max<int>( std::thread::hardware_concurrency(), 1 ) );
+    return td;
+}
+
+void TaskDispatch::Start()
+{
+    std::lock_guard<std::mutex> lock( m_startLock );
+    if( m_started.load( std::memory_order_relaxed ) ) return;
+    m_workers.reserve( m_numWorkers );
+    for( size_t i=0; i<m_numWorkers; i++ )
+    {
+        m_workers.emplace_back( std::thread( [this, i]{ Worker( i ); } ) );
+    }
+    m_started.store( true, std::memory_order_release );
+}
+
+void TaskDispatch::Push( TaskGroupQueue* queue )
+{
+    if( !m_started.load( std::memory_order_acquire ) ) Start();
+    const auto idx = s_dispatch == this ? s_workerIdx : m_next.fetch_add( 1, std::memory_order_relaxed ) % m_numWorkers;
+    queue->refs.fetch_add( 1 );
+    // Counted before the ticket is visible, so that the counter never underflows.
+    m_queued.fetch_add( 1 );
+    {
+        auto& q = m_queues[idx];
+        std::lock_guard<std::mutex> lock( q.lock );
+        q.tickets.emplace_back( queue );
+    }
+    if( m_sleeping.load() > 0 )
+    {
+        std::lock_guard<std::mutex> lock( m_sleepLock );
+        m_cvWork.notify_one();
+    }
 }
 
-void TaskDispatch::Queue( const std::function<void(void)>& f )
+bool TaskDispatch::Take( size_t idx, Task& task )
 {
-    std::lock_guard<std::mutex> lock( m_queueLock );
-    m_queue.emplace_back( f );
-    m_cvWork.notify_one();
+    const auto sz = m_numWorkers;
+    size_t i = 0;
+    while( i < sz && m_queued.load( std::memory_order_relaxed ) != 0 )
+    {
+        TaskGroupQueue* queue;
+        {
+            auto& q = m_queues[( idx + i ) % sz];
+            std::lock_guard<std::mutex> lock( q.lock );
+            if( q.tickets.empty() )
+            {
+                i++;
+                continue;
+            }
+            if( i == 0 )
+            {
+                queue = q.tickets.back();
+                q.tickets.pop_back();
+            }
+            else
+            {
+                queue = q.tickets.front();
+                q.tickets.pop_front();
+            }
+        }
+        m_queued.fetch_sub( 1 );
+        const auto found = TakeTask( queue, i == 0, task );
+        Release( queue );
+        if( found ) return true;
+    }
+    return false;
 }
 
-void TaskDispatch::Queue( std::function<void(void)>&& f )
+void TaskDispatch::Execute( Task&& task )
 {
-    std::lock_guard<std::mutex> lock( m_queueLock );
-    m_queue.emplace_back( std::move( f ) );
-    m_cvWork.notify_one();
+    auto group = task.Group();
+    {
+        Task t( std::move( task ) );
+        if( !group->IsCancelled() ) t.Run();
+        // Captured state must be released before the group is notified.
+    }
+    group->Finish();
 }
 
-void TaskDispatch::Sync()
+void TaskDispatch::Worker( size_t idx )
 {
-    std::unique_lock<std::mutex> lock( m_queueLock );
-    while( !m_queue.empty() )
+    SetThreadName( "Tracy Task" );
+    s_dispatch = this;
+    s_workerIdx = idx;
+
+    for(;;)
     {
-        auto f = m_queue.back();
-        m_queue.pop_back();
-        lock.unlock();
-        f();
-        lock.lock();
+        Task task;
+        if( Take( idx, task ) )
+        {
+            Execute( std::move( task ) );
+            continue;
+        }
+        std::unique_lock<std::mutex> lock( m_sleepLock );
+        m_sleeping.fetch_add( 1 );
+        m_cvWork.wait( lock, [this]{ return m_queued.load() > 0 || m_exit.load(); } );
+        m_sleeping.fetch_sub( 1 );
+        if( m_exit.load() ) return;
     }
-    m_cvJobs.wait( lock, [this]{ return m_jobs == 0; } );
 }
 
-void TaskDispatch::Worker()
+
+TaskGroup::TaskGroup( TaskDispatch& td )
+    : m_td( td )
+    , m_queue( new TaskGroupQueue )
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+    Release( m_queue );
+}
+
+void TaskGroup::Enqueue( Task&& task )
+{
+    m_pending.fetch_add( 1 );
+    {
+        std::lock_guard<std::mutex> lock( m_queue->lock );
+        m_queue->tasks.emplace_back( std::move( task ) );
+        m_queue->queued.fetch_add( 1 );
+    }
+    m_td.Push( m_queue );
+    if( m_waiting.load() )
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+        m_cv.notify_all();
+    }
+}
+
+bool TaskGroup::RunPending()
+{
+    // Tasks of nested groups, waited for by a worker, are the most recent ones.
+    Task task;
+    if( m_queue->queued.load() == 0 || !TakeTask( m_queue, s_dispatch == &m_td, task ) ) return false;
+    m_td.Execute( std::move( task ) );
+    return true;
+}
+
+void TaskGroup::Wait()
 {
     for(;;)
     {
-        std::unique_lock<std::mutex> lock( m_queueLock );
-        m_cvWork.wait( lock, [this]{ return !m_queue.empty() || m_exit.load( std::memory_order_acquire ); } );
-        if( m_exit.load( std::memory_order_acquire ) ) return;
-        auto f = m_queue.back();
-        m_queue.pop_back();
-        m_jobs++;
-        lock.unlock();
-        f();
-        lock.lock();
-        m_jobs--;
-        if( m_jobs == 0 && m_queue.empty() ) m_cvJobs.notify_one();
-        lock.unlock();
+        while( RunPending() ) {}
+        std::unique_lock<std::mutex> lock( m_lock );
+        if( m_pending.load() == 0 ) break;
+        m_waiting.store( true );
+        m_cv.wait( lock, [this]{ return m_pending.load() == 0 || m_queue->queued.load() > 0; } );
+        m_waiting.store( false );
+        if( m_pending.load() == 0 ) break;
     }
+    m_cancel.store( false, std::memory_order_relaxed );
+}
+
+void TaskGroup::Finish()
+{
+    // The group may be destroyed as soon as the waiting thread sees no pending
+    // tasks, which it checks with the lock held.
+    std::lock_guard<std::mutex> lock( m_lock );
+    if( m_pending.fetch_sub( 1 ) == 1 ) m_cv.notify_all();
 }
 
 }
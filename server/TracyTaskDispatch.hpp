@@ -1,39 +1,247 @@
 #ifndef __TRACYTASKDISPATCH_HPP__
 #define __TRACYTASKDISPATCH_HPP__
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
-#include <functional>
+#include <cstddef>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace tracy
 {
 
+class TaskGroup;
+struct TaskGroupQueue;
+
+// Type erased callable. Callables which fit in the inline buffer are stored in
+// place, so that queueing a task does not allocate memory.
+class Task
+{
+    enum { InlineSize = 48 };
+
+    struct Ops
+    {
+        void(*invoke)( void* );
+        void(*move)( void*, void* );
+        void(*destroy)( void* );
+    };
+
+    template<typename F>
+    static const Ops* InlineOps()
+    {
+        static const Ops ops = {
+            [] ( void* ptr ) { (*(F*)ptr)(); },
+            [] ( void* dst, void* src ) { new( dst ) F( std::move( *(F*)src ) ); ((F*)src)->~F(); },
+            [] ( void* ptr ) { ((F*)ptr)->~F(); }
+        };
+        return &ops;
+    }
+
+    template<typename F>
+    static const Ops* HeapOps()
+    {
+        static const Ops ops = {
+            [] ( void* ptr ) { (**(F**)ptr)(); },
+            [] ( void* dst, void* src ) { *(F**)dst = *(F**)src; },
+            [] ( void* ptr ) { delete *(F**)ptr; }
+        };
+        return &ops;
+    }
+
+public:
+    Task() = default;
+
+    template<typename F>
+    Task( TaskGroup* group, F&& f )
+        : m_group( group )
+    {
+        using T = typename std::decay<F>::type;
+        if constexpr( sizeof( T ) <= InlineSize && alignof( T ) <= alignof( std::max_align_t ) )
+        {
+            new( m_data ) T( std::forward<F>( f ) );
+            m_ops = InlineOps<T>();
+        }
+        else
+        {
+            *(T**)m_data = new T( std::forward<F>( f ) );
+            m_ops = HeapOps<T>();
+        }
+    }
+
+    Task( const Task& ) = delete;
+    Task( Task&& other ) { MoveFrom( other ); }
+    ~Task() { Reset(); }
+
+    Task& operator=( const Task& ) = delete;
+    Task& operator=( Task&& other )
+    {
+        if( this != &other )
+        {
+            Reset();
+            MoveFrom( other );
+        }
+        return *this;
+    }
+
+    void Run() { m_ops->invoke( m_data ); }
+    TaskGroup* Group() const { return m_group; }
+
+    void Reset()
+    {
+        if( m_ops )
+        {
+            m_ops->destroy( m_data );
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    void MoveFrom( Task& other )
+    {
+        m_group = other.m_group;
+        m_ops = other.m_ops;
+        if( m_ops )
+        {
+            m_ops->move( m_data, other.m_data );
+            other.m_ops = nullptr;
+        }
+    }
+
+    TaskGroup* m_group = nullptr;
+    const Ops* m_ops = nullptr;
+    alignas(std::max_align_t) char m_data[InlineSize];
+};
+
+// Work stealing thread pool. Tasks are kept in the queue of their group, each
+// worker has a deque of tickets, which refer to these queues. Tickets queued
+// by a worker go to the back of its deque and are taken by it in LIFO order,
+// idle workers steal the oldest tickets from the front of other deques.
+// Tickets queued from threads outside of the pool are distributed round robin.
+// A ticket may find its group queue empty, if the waiting thread has already
+// taken the task. Worker threads are started by the first queued task.
 class TaskDispatch
 {
 public:
     TaskDispatch( size_t workers );
     ~TaskDispatch();
 
-    void Queue( const std::function<void(void)>& f );
-    void Queue( std::function<void(void)>&& f );
+    // Pool shared by all trace loading and processing.
+    static TaskDispatch& Get();
 
-    void Sync();
+    size_t NumWorkers() const { return m_numWorkers; }
 
 private:
-    void Worker();
+    friend class TaskGroup;
+
+    struct alignas(64) Queue
+    {
+        std::mutex lock;
+        std::deque<TaskGroupQueue*> tickets;
+    };
 
-    std::vector<std::function<void(void)>> m_queue;
-    std::mutex m_queueLock;
-    std::condition_variable m_cvWork, m_cvJobs;
+    void Start();
+    void Push( TaskGroupQueue* queue );
+    bool Take( size_t idx, Task& task );
+    void Execute( Task&& task );
+
+    void Worker( size_t idx );
+
+    std::unique_ptr<Queue[]> m_queues;
+    size_t m_numWorkers;
+    std::atomic<bool> m_started;
+    std::mutex m_startLock;
+    std::atomic<size_t> m_queued;
+    std::atomic<size_t> m_sleeping;
+    std::atomic<size_t> m_next;
     std::atomic<bool> m_exit;
-    size_t m_jobs;
+    std::mutex m_sleepLock;
+    std::condition_variable m_cvWork;
 
     std::vector<std::thread> m_workers;
 };
 
+// Set of tasks which can be waited for. The waiting thread executes queued
+// tasks of the group itself, but never tasks belonging to other groups, as
+// these may need locks held by the waiting thread. This also makes nested
+// waits safe. Only one thread may wait for a group at a time.
+class TaskGroup
+{
+public:
+    TaskGroup( TaskDispatch& td = TaskDispatch::Get() );
+    ~TaskGroup();
+
+    TaskGroup( const TaskGroup& ) = delete;
+    TaskGroup( TaskGroup&& ) = delete;
+
+    TaskGroup& operator=( const TaskGroup& ) = delete;
+    TaskGroup& operator=( TaskGroup&& ) = delete;
+
+    template<typename F>
+    void Run( F&& f )
+    {
+        Enqueue( Task( this, std::forward<F>( f ) ) );
+    }
+
+    // Executes one queued task of the group on the calling thread. Returns
+    // false if there was none.
+    bool RunPending();
+    void Wait();
+
+    // Tasks which have not started yet are skipped, until the group is waited
+    // for. Running tasks may check IsCancelled() to stop early.
+    void Cancel() { m_cancel.store( true, std::memory_order_relaxed ); }
+    bool IsCancelled() const { return m_cancel.load( std::memory_order_relaxed ); }
+
+private:
+    friend class TaskDispatch;
+
+    void Enqueue( Task&& task );
+    void Finish();
+
+    TaskDispatch& m_td;
+    TaskGroupQueue* m_queue;
+    std::atomic<size_t> m_pending { 0 };
+    std::atomic<bool> m_cancel { false };
+    std::atomic<bool> m_waiting { false };
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+};
+
+// Calls f( first, last ) for consecutive subranges of [begin, end), each at
+// least grain elements long (except for the last one), in parallel. May be
+// nested.
+template<typename F>
+void ParallelFor( size_t begin, size_t end, size_t grain, F&& f, TaskDispatch& td = TaskDispatch::Get() )
+{
+    if( begin >= end ) return;
+    const auto cnt = end - begin;
+    grain = std::max<size_t>( grain, 1 );
+    const auto chunks = std::min<size_t>( ( cnt + grain - 1 ) / grain, td.NumWorkers() * 4 );
+    if( chunks <= 1 )
+    {
+        f( begin, end );
+        return;
+    }
+    const auto step = cnt / chunks;
+    const auto rem = cnt % chunks;
+    TaskGroup group( td );
+    auto first = begin;
+    for( size_t i=0; i<chunks; i++ )
+    {
+        const auto last = first + step + ( i < rem ? 1 : 0 );
+        group.Run( [&f, first, last] { f( first, last ); } );
+        first = last;
+    }
+    group.Wait();
+}
+
 }
 
 #endif
@@ -0,0 +1,67 @@
+#ifndef __TRACYTRIGRAMINDEX_HPP__
+#define __TRACYTRIGRAMINDEX_HPP__
+
+#include <limits>
+#include <stdint.h>
+#include <string.h>
+
+#include "../common/TracyForceInline.hpp"
+#include "tracy_robin_hood.h"
+#include "TracyVector.hpp"
+
+namespace tracy
+{
+
+// Maps case folded three character sequences to the ids of the strings which
+// contain them. Any string containing a query must also contain every one of
+// its trigrams, so the shortest posting list of the query trigrams is a
+// superset of the matches. The caller verifies the candidates.
+template<typename T>
+class TrigramIndex
+{
+public:
+    enum { MinQuery = 3 };
+
+    void Add( T id, const char* str )
+    {
+        const auto sz = strlen( str );
+        if( sz < MinQuery ) return;
+        for( size_t i=0; i<=sz-MinQuery; i++ )
+        {
+            auto& list = m_map[Trigram( str + i )];
+            if( list.empty() || list.back() != id ) list.push_back( id );
+        }
+    }
+
+    // Returns nullptr if the query is too short to use the index. Ids are
+    // listed in the order in which they were added.
+    const Vector<T>* Candidates( const char* query ) const
+    {
+        const auto sz = strlen( query );
+        if( sz < MinQuery ) return nullptr;
+        const Vector<T>* best = &m_empty;
+        size_t bestSize = std::numeric_limits<size_t>::max();
+        for( size_t i=0; i<=sz-MinQuery; i++ )
+        {
+            auto it = m_map.find( Trigram( query + i ) );
+            if( it == m_map.end() ) return &m_empty;
+            if( it->second.size() < bestSize )
+            {
+                best = &it->second;
+                bestSize = it->second.size();
+            }
+        }
+        return best;
+    }
+
+private:
+    static tracy_force_inline uint32_t Lower( char c ) { return uint8_t( ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c ); }
+    static tracy_force_inline uint32_t Trigram( const char* str ) { return Lower( str[0] ) | ( Lower( str[1] ) << 8 ) | ( Lower( str[2] ) << 16 ); }
+
+    unordered_flat_map<uint32_t, Vector<T>> m_map;
+    Vector<T> m_empty;
+};
+
+}
+
+#endif
@@ -42,7 +42,7 @@ public:
     }
 
     tracy_force_inline Vector( const T& value )
-        : m_ptr( (T*)malloc( sizeof( T ) ) )
+        : m_ptr( (T*)MemAlloc( sizeof( T ) ) )
         , m_size( 1 )
         , m_capacity( 0 )
         , m_magic( 0 )
@@ -56,7 +56,7 @@ public:
         if( m_capacity != MaxCapacity() && m_ptr )
         {
             memUsage -= Capacity() * sizeof( T );
-            free( m_ptr );
+            MemFree( m_ptr, Capacity() * sizeof( T ) );
         }
     }
 
@@ -66,7 +66,7 @@ public:
         if( m_capacity != MaxCapacity() && m_ptr )
         {
             memUsage -= Capacity() * sizeof( T );
-            free( m_ptr );
+            MemFree( m_ptr, Capacity() * sizeof( T ) );
         }
         memcpy( this, &src, sizeof( Vector<T> ) );
         memset( &src, 0, sizeof( Vector<T> ) );
@@ -254,9 +254,10 @@ public:
         cap |= cap >> 8;
         cap |= cap >> 16;
         cap = TracyCountBits( cap );
-        memUsage += ( ( 1 << cap ) - Capacity() ) * sizeof( T );
+        const auto oldCap = Capacity();
+        memUsage += ( ( 1 << cap ) - oldCap ) * sizeof( T );
         m_capacity = cap;
-        Realloc();
+        Realloc( oldCap );
     }
 
     tracy_force_inline void reserve_and_use( size_t sz )
@@ -292,20 +293,21 @@ private:
         if( m_ptr == nullptr )
         {
             memUsage += sizeof( T );
-            m_ptr = (T*)malloc( sizeof( T ) );
+            m_ptr = (T*)MemAlloc( sizeof( T ) );
             m_capacity = 0;
         }
         else
         {
-            memUsage += Capacity() * sizeof( T );
+            const auto oldCap = Capacity();
+            memUsage += oldCap * sizeof( T );
             m_capacity++;
-            Realloc();
+            Realloc( oldCap );
         }
     }
 
-    void Realloc()
+    void Realloc( uint32_t oldCap )
     {
-        T* ptr = (T*)malloc( sizeof( T ) * CapacityNoNullptrCheck() );
+        T* ptr = (T*)MemAlloc( sizeof( T ) * CapacityNoNullptrCheck() );
         if( m_size != 0 )
         {
             if( std::is_trivially_copyable<T>() )
@@ -319,7 +321,7 @@ private:
                     new(ptr+i) T( std::move( m_ptr[i] ) );
                 }
             }
-            free( m_ptr );
+            MemFree( m_ptr, oldCap * sizeof( T ) );
         }
         m_ptr = ptr;
     }
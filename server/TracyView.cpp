@@ -31,10 +31,12 @@
 #include "TracyFileRead.hpp"
 #include "TracyFileWrite.hpp"
 #include "TracyFilesystem.hpp"
+#include "TracyPackedCpuData.hpp"
 #include "TracyPopcnt.hpp"
 #include "TracyPrint.hpp"
 #include "TracySort.hpp"
 #include "TracySourceView.hpp"
+#include "TracyTaskDispatch.hpp"
 #include "TracyView.hpp"
 
 #ifndef TRACY_NO_FILESELECTOR
@@ -180,7 +182,9 @@ View::~View()
     m_userData.SaveSourceSubstitutions( m_sourceSubstitutions );
 
     if( m_compare.loadThread.joinable() ) m_compare.loadThread.join();
-    if( m_saveThread.joinable() ) m_saveThread.join();
+    m_compare.AbortDiff();
+    m_flameGraph.Abort();
+    m_saveTask.Wait();
 
     if( m_frameTexture ) FreeTexture( m_frameTexture );
     if( m_playback.texture ) FreeTexture( m_playback.texture );
@@ -436,7 +440,7 @@ bool View::DrawImpl()
     if( !m_userData.Valid() ) m_userData.Init( m_worker.GetCaptureProgram().c_str(), m_worker.GetCaptureTime() );
     if( m_saveThreadState.load( std::memory_order_acquire ) == SaveThreadState::NeedsJoin )
     {
-        m_saveThread.join();
+        m_saveTask.Wait();
         m_saveThreadState.store( SaveThreadState::Inert, std::memory_order_release );
         const auto src = m_srcFileBytes.load( std::memory_order_relaxed );
         const auto dst = m_dstFileBytes.load( std::memory_order_relaxed );
@@ -584,6 +588,10 @@ bool View::DrawImpl()
         {
             m_showAnnotationList = true;
         }
+        if( ImGui::Button( ICON_FA_FIRE " Flame graph" ) )
+        {
+            m_flameGraph.show = true;
+        }
         ImGui::EndPopup();
     }
     ImGui::SameLine();
@@ -668,6 +676,20 @@ bool View::DrawImpl()
         {
             ImGui::BeginTooltip();
             ImGui::Text( "Profiler memory usage" );
+            const auto large = memStats.large.load( std::memory_order_relaxed );
+            if( large != 0 )
+            {
+                ImGui::Separator();
+                TextFocused( "Large allocations:", RealToString( large ) );
+                ImGui::SameLine();
+                ImGui::TextDisabled( "(%s)", MemSizeToString( memStats.largeBytes.load( std::memory_order_relaxed ) ) );
+                TextFocused( "Huge page backed:", RealToString( memStats.huge.load( std::memory_order_relaxed ) ) );
+                ImGui::SameLine();
+                ImGui::TextDisabled( "(%s)", MemSizeToString( memStats.hugeBytes.load( std::memory_order_relaxed ) ) );
+                TextFocused( "Spilled to disk:", RealToString( memStats.spill.load( std::memory_order_relaxed ) ) );
+                ImGui::SameLine();
+                ImGui::TextDisabled( "(%s)", MemSizeToString( memStats.spillBytes.load( std::memory_order_relaxed ) ) );
+            }
             ImGui::EndTooltip();
         }
         ImGui::SameLine();
@@ -706,6 +728,7 @@ bool View::DrawImpl()
     if( m_showCpuDataWindow ) DrawCpuDataWindow();
     if( m_selectedAnnotation ) DrawSelectedAnnotation();
     if( m_showAnnotationList ) DrawAnnotationList();
+    if( m_flameGraph.show ) DrawFlameGraph();
     if( m_sampleParents.symAddr != 0 ) DrawSampleParents();
 
     if( m_zoomAnim.active )
@@ -1024,7 +1047,7 @@ bool View::DrawConnection()
             {
                 m_userData.StateShouldBePreserved();
                 m_saveThreadState.store( SaveThreadState::Saving, std::memory_order_relaxed );
-                m_saveThread = std::thread( [this, f{std::move( f )}] {
+                m_saveTask.Run( [this, f{std::move( f )}] {
                     std::shared_lock<std::shared_mutex> lock( m_worker.GetDataLock() );
                     m_worker.Write( *f );
                     f->Finish();
@@ -2523,6 +2546,13 @@ void View::DrawZones()
                     depth = DispatchZoneLevel( v->timeline, hover, pxns, int64_t( nspx ), wpos, offset, 0, yMin, yMax, v->id );
                 }
                 offset += ostep * depth;
+
+                if( !v->zoneAggregates.empty() )
+                {
+                    const auto aggDepth = DrawZoneAggregates( v->zoneAggregates, hover, pxns, wpos, offset, yMin, yMax );
+                    offset += ostep * aggDepth;
+                    depth += aggDepth;
+                }
             }
 
             if( m_vd.drawContextSwitches )
@@ -2907,6 +2937,38 @@ void View::DrawZones()
         }
     }
 
+    for( auto& loss : m_worker.GetDataLoss() )
+    {
+        const auto end = loss.end < 0 ? m_worker.GetLastTime() : loss.end;
+        if( loss.start >= m_vd.zvEnd || end <= m_vd.zvStart ) continue;
+        const auto px0 = ( loss.start - m_vd.zvStart ) * pxns;
+        const auto px1 = std::max( px0 + std::max( 1.0, pxns * 0.5 ), ( end - m_vd.zvStart ) * pxns );
+        const uint32_t color = loss.level == DataLossCallstacks ? 0x2288DD : ( loss.level == DataLossNestedZones ? 0x2255DD : 0x2222DD );
+        draw->AddRectFilled( linepos + ImVec2( px0, 0 ), linepos + ImVec2( px1, lineh ), color | 0x22000000 );
+        draw->AddRectFilled( linepos + ImVec2( px0, 0 ), linepos + ImVec2( px1, th * 0.5 ), color | 0xCC000000 );
+        if( drawMouseLine && ImGui::IsMouseHoveringRect( linepos + ImVec2( px0, 0 ), linepos + ImVec2( px1, th * 0.5 ) ) )
+        {
+            ImGui::BeginTooltip();
+            TextFocused( "Data lost:", loss.level == DataLossCallstacks ? "call stacks" : ( loss.level == DataLossNestedZones ? "call stacks, nested zones" : "call stacks, zones, messages, plots, frame images" ) );
+            TextDisabledUnformatted( "Client queues were over the memory budget" );
+            ImGui::Separator();
+            TextFocused( "Begin:", TimeToString( loss.start ) );
+            if( loss.end < 0 )
+            {
+                TextFocused( "Duration:", "still dropping data" );
+            }
+            else
+            {
+                TextFocused( "End:", TimeToString( loss.end ) );
+                TextFocused( "Duration:", TimeToString( loss.end - loss.start ) );
+                TextFocused( "Dropped call stacks:", RealToString( loss.callstacks ) );
+                TextFocused( "Dropped zones:", RealToString( loss.zones ) );
+                TextFocused( "Dropped other events:", RealToString( loss.other ) );
+            }
+            ImGui::EndTooltip();
+        }
+    }
+
     if( m_gpuStart != 0 && m_gpuEnd != 0 )
     {
         const auto px0 = ( m_gpuStart - m_vd.zvStart ) * pxns;
@@ -3255,6 +3317,98 @@ void View::DrawContextSwitches( const ContextSwitch* ctx, bool hover, double pxn
     }
 }
 
+// Each aggregated source location gets its own row. The height of the bar
+// shows which part of the summary interval was spent in the zone.
+int View::DrawZoneAggregates( const Vector<ZoneAggregateTrack>& tracks, bool hover, double pxns, const ImVec2& wpos, int _offset, float yMin, float yMax )
+{
+    const auto ty = ImGui::GetFontSize();
+    const auto ostep = ty + 1;
+    auto draw = ImGui::GetWindowDrawList();
+    const auto w = ImGui::GetWindowContentRegionWidth() - 1;
+
+    int depth = 0;
+    for( auto& track : tracks )
+    {
+        const auto offset = _offset + ostep * depth++;
+        const auto yPos = wpos.y + offset;
+        if( yPos + ostep < yMin || yPos > yMax ) continue;
+
+        auto& vec = track.data;
+        auto it = std::lower_bound( vec.begin(), vec.end(), m_vd.zvStart, [] ( const auto& l, const auto& r ) { return l.end < r; } );
+        if( it == vec.end() ) continue;
+        const auto itend = std::lower_bound( it, vec.end(), m_vd.zvEnd, [] ( const auto& l, const auto& r ) { return l.start < r; } );
+        if( it == itend ) continue;
+
+        auto& srcloc = m_worker.GetSourceLocation( track.srcloc );
+        const auto color = GetSrcLocColor( srcloc, 0 );
+        const auto dimColor = ( color & 0x00FFFFFF ) | 0x44000000;
+        bool hovered = false;
+
+        while( it < itend )
+        {
+            // Summaries smaller than a pixel are merged, showing the highest density.
+            const auto px0 = std::max( ( it->start - m_vd.zvStart ) * pxns, -10.0 );
+            auto px1 = std::min( ( it->end - m_vd.zvStart ) * pxns, double( w + 10 ) );
+            auto density = double( it->total ) / std::max<int64_t>( 1, it->end - it->start );
+            auto next = it + 1;
+            while( next < itend && ( next->start - m_vd.zvStart ) * pxns < px0 + 1 )
+            {
+                px1 = std::max( px1, std::min( ( next->end - m_vd.zvStart ) * pxns, double( w + 10 ) ) );
+                density = std::max( density, double( next->total ) / std::max<int64_t>( 1, next->end - next->start ) );
+                ++next;
+            }
+            px1 = std::max( px1, px0 + 1 );
+            density = std::min( density, 1.0 );
+
+            draw->AddRectFilled( wpos + ImVec2( px0, offset ), wpos + ImVec2( px1, offset + ty ), dimColor );
+            draw->AddRectFilled( wpos + ImVec2( px0, offset + ty * ( 1 - density ) ), wpos + ImVec2( px1, offset + ty ), color );
+
+            if( !hovered && hover && ImGui::IsMouseHoveringRect( wpos + ImVec2( px0, offset ), wpos + ImVec2( px1, offset + ty ) ) )
+            {
+                hovered = true;
+                uint64_t count = 0;
+                int64_t total = 0;
+                int64_t min = std::numeric_limits<int64_t>::max();
+                int64_t max = 0;
+                for( auto ag = it; ag < next; ++ag )
+                {
+                    count += ag->count;
+                    total += ag->total;
+                    min = std::min( min, ag->min );
+                    max = std::max( max, ag->max );
+                }
+                const auto t0 = it->start;
+                const auto t1 = (next-1)->end;
+
+                ImGui::BeginTooltip();
+                ImGui::TextUnformatted( m_worker.GetZoneName( srcloc ) );
+                ImGui::SameLine();
+                TextDisabledUnformatted( ICON_FA_LAYER_GROUP " Aggregated zone" );
+                ImGui::Text( "%s:%i", m_worker.GetString( srcloc.file ), srcloc.line );
+                ImGui::Separator();
+                TextFocused( "Time range:", TimeToString( t1 - t0 ) );
+                TextFocused( "Zone count:", RealToString( count ) );
+                TextFocused( "Total time:", TimeToString( total ) );
+                ImGui::SameLine();
+                char buf[64];
+                PrintStringPercent( buf, 100. * total / std::max<int64_t>( 1, t1 - t0 ) );
+                TextDisabledUnformatted( buf );
+                TextFocused( "Mean time:", TimeToString( total / std::max<uint64_t>( 1, count ) ) );
+                TextFocused( "Min time:", TimeToString( min ) );
+                TextFocused( "Max time:", TimeToString( max ) );
+                ImGui::EndTooltip();
+
+                if( ImGui::IsMouseClicked( 2 ) ) ZoomToRange( t0, t1 );
+            }
+            it = next;
+        }
+
+        const auto namepx = std::max( ( vec.front().start - m_vd.zvStart ) * pxns, 0.0 );
+        DrawTextContrast( draw, wpos + ImVec2( namepx + ty * 0.25f, offset ), 0xFFFFFFFF, m_worker.GetZoneName( srcloc ) );
+    }
+    return depth;
+}
+
 void View::DrawSamples( const Vector<SampleData>& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset )
 {
     auto it = std::lower_bound( vec.begin(), vec.end(), m_vd.zvStart, [] ( const auto& l, const auto& r ) { return l.time.Val() < r; } );
@@ -3640,36 +3794,68 @@ int View::DispatchZoneLevel( const Vector<short_ptr<ZoneEvent>>& vec, bool hover
     {
         if( vec.is_magic() )
         {
-            return DrawZoneLevel<VectorAdapterDirect<ZoneEvent>>( *(Vector<ZoneEvent>*)( &vec ), hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid );
+            auto& v = *(Vector<ZoneEvent>*)( &vec );
+            return DrawZoneLevel<VectorAdapterDirect<ZoneEvent>>( v, hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid, m_worker.GetZoneColumns( v ) );
         }
         else
         {
-            return DrawZoneLevel<VectorAdapterPointer<ZoneEvent>>( vec, hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid );
+            return DrawZoneLevel<VectorAdapterPointer<ZoneEvent>>( vec, hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid, nullptr );
         }
     }
     else
     {
         if( vec.is_magic() )
         {
-            return SkipZoneLevel<VectorAdapterDirect<ZoneEvent>>( *(Vector<ZoneEvent>*)( &vec ), hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid );
+            auto& v = *(Vector<ZoneEvent>*)( &vec );
+            return SkipZoneLevel<VectorAdapterDirect<ZoneEvent>>( v, hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid, m_worker.GetZoneColumns( v ) );
         }
         else
         {
-            return SkipZoneLevel<VectorAdapterPointer<ZoneEvent>>( vec, hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid );
+            return SkipZoneLevel<VectorAdapterPointer<ZoneEvent>>( vec, hover, pxns, nspx, wpos, _offset, depth, yMin, yMax, tid, nullptr );
         }
     }
 }
 
+// Zone columns, if available, limit the binary search to a single block of zones.
+template<typename T, typename Adapter, typename It, typename F>
+static tracy_force_inline It ZoneLowerBound( It begin, It first, It last, const Vector<int64_t>* col, T val, F key )
+{
+    if( col )
+    {
+        enum { Bs = ZoneColumns::BlockSize };
+        const auto b0 = size_t( first - begin ) / Bs;
+        const auto b1 = ( size_t( last - begin ) + Bs - 1 ) / Bs;
+        const auto bit = std::lower_bound( col->begin() + b0, col->begin() + b1, val, [] ( const auto& l, const auto& r ) { return T( l ) < r; } );
+        const auto blk = size_t( bit - col->begin() );
+        if( blk * Bs >= size_t( last - begin ) ) return last;
+        if( blk * Bs > size_t( first - begin ) ) first = begin + blk * Bs;
+        if( ( blk + 1 ) * Bs < size_t( last - begin ) ) last = begin + ( blk + 1 ) * Bs;
+    }
+    return std::lower_bound( first, last, val, [key] ( const auto& l, const auto& r ) { Adapter a; return T( key( a(l) ) ) < r; } );
+}
+
+// cast to uint64_t, so that unended zones (end = -1) are still drawn
+template<typename Adapter, typename It>
+static tracy_force_inline It ZoneEndLowerBound( It begin, It first, It last, const ZoneColumns* cols, int64_t val )
+{
+    return ZoneLowerBound<uint64_t, Adapter>( begin, first, last, cols ? &cols->end : nullptr, uint64_t( val ), [] ( const ZoneEvent& ev ) { return ev.End(); } );
+}
+
+template<typename Adapter, typename It>
+static tracy_force_inline It ZoneStartLowerBound( It begin, It first, It last, const ZoneColumns* cols, int64_t val )
+{
+    return ZoneLowerBound<int64_t, Adapter>( begin, first, last, cols ? &cols->start : nullptr, val, [] ( const ZoneEvent& ev ) { return ev.Start(); } );
+}
+
 template<typename Adapter, typename V>
-int View::DrawZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int _offset, int depth, float yMin, float yMax, uint64_t tid )
+int View::DrawZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int _offset, int depth, float yMin, float yMax, uint64_t tid, const ZoneColumns* cols )
 {
     const auto delay = m_worker.GetDelay();
     const auto resolution = m_worker.GetResolution();
-    // cast to uint64_t, so that unended zones (end = -1) are still drawn
-    auto it = std::lower_bound( vec.begin(), vec.end(), std::max<int64_t>( 0, m_vd.zvStart - delay ), [] ( const auto& l, const auto& r ) { Adapter a; return (uint64_t)a(l).End() < (uint64_t)r; } );
+    auto it = ZoneEndLowerBound<Adapter>( vec.begin(), vec.begin(), vec.end(), cols, std::max<int64_t>( 0, m_vd.zvStart - delay ) );
     if( it == vec.end() ) return depth;
 
-    const auto zitend = std::lower_bound( it, vec.end(), m_vd.zvEnd + resolution, [] ( const auto& l, const auto& r ) { Adapter a; return a(l).Start() < r; } );
+    const auto zitend = ZoneStartLowerBound<Adapter>( vec.begin(), it, vec.end(), cols, m_vd.zvEnd + resolution );
     if( it == zitend ) return depth;
     Adapter a;
     if( !a(*it).IsEndValid() && m_worker.GetZoneEnd( a(*it) ) < m_vd.zvStart ) return depth;
@@ -3705,7 +3891,7 @@ int View::DrawZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, co
             for(;;)
             {
                 const auto prevIt = it;
-                it = std::lower_bound( it, zitend, nextTime, [] ( const auto& l, const auto& r ) { Adapter a; return (uint64_t)a(l).End() < (uint64_t)r; } );
+                it = ZoneEndLowerBound<Adapter>( vec.begin(), it, zitend, cols, nextTime );
                 if( it == prevIt ) ++it;
                 num += std::distance( prevIt, it );
                 if( it == zitend ) break;
@@ -3884,15 +4070,14 @@ int View::DrawZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, co
 }
 
 template<typename Adapter, typename V>
-int View::SkipZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int _offset, int depth, float yMin, float yMax, uint64_t tid )
+int View::SkipZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int _offset, int depth, float yMin, float yMax, uint64_t tid, const ZoneColumns* cols )
 {
     const auto delay = m_worker.GetDelay();
     const auto resolution = m_worker.GetResolution();
-    // cast to uint64_t, so that unended zones (end = -1) are still drawn
-    auto it = std::lower_bound( vec.begin(), vec.end(), std::max<int64_t>( 0, m_vd.zvStart - delay ), [] ( const auto& l, const auto& r ) { Adapter a; return (uint64_t)a(l).End() < (uint64_t)r; } );
+    auto it = ZoneEndLowerBound<Adapter>( vec.begin(), vec.begin(), vec.end(), cols, std::max<int64_t>( 0, m_vd.zvStart - delay ) );
     if( it == vec.end() ) return depth;
 
-    const auto zitend = std::lower_bound( it, vec.end(), m_vd.zvEnd + resolution, [] ( const auto& l, const auto& r ) { Adapter a; return a(l).Start() < r; } );
+    const auto zitend = ZoneStartLowerBound<Adapter>( vec.begin(), it, vec.end(), cols, m_vd.zvEnd + resolution );
     if( it == zitend ) return depth;
 
     depth++;
@@ -3911,7 +4096,7 @@ int View::SkipZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, co
             for(;;)
             {
                 const auto prevIt = it;
-                it = std::lower_bound( it, zitend, nextTime, [] ( const auto& l, const auto& r ) { Adapter a; return (uint64_t)a(l).End() < (uint64_t)r; } );
+                it = ZoneEndLowerBound<Adapter>( vec.begin(), it, zitend, cols, nextTime );
                 if( it == prevIt ) ++it;
                 if( it == zitend ) break;
                 const auto nend = m_worker.GetZoneEnd( a(*it) );
@@ -5154,23 +5339,24 @@ int View::DrawCpuData( int offset, double pxns, const ImVec2& wpos, bool hover,
         const auto origOffset = offset;
         for( int i=0; i<cpuCnt; i++ )
         {
-            if( !cpuData[i].cs.empty() )
+            CpuDataReader cs( cpuData[i] );
+            if( !cs.empty() )
             {
                 if( wpos.y + offset + sty >= yMin && wpos.y + offset <= yMax )
                 {
                     draw->AddLine( wpos + ImVec2( 0, offset+sty ), wpos + ImVec2( w, offset+sty ), 0x22DD88DD );
 
-                    auto& cs = cpuData[i].cs;
                     auto tt = m_worker.GetThreadTopology( i );
 
-                    auto it = std::lower_bound( cs.begin(), cs.end(), std::max<int64_t>( 0, m_vd.zvStart ), [] ( const auto& l, const auto& r ) { return (uint64_t)l.End() < (uint64_t)r; } );
-                    if( it != cs.end() )
+                    auto it = cs.LowerBoundEnd( 0, cs.size(), std::max<int64_t>( 0, m_vd.zvStart ) );
+                    if( it != cs.size() )
                     {
-                        auto eit = std::lower_bound( it, cs.end(), m_vd.zvEnd, [] ( const auto& l, const auto& r ) { return l.Start() < r; } );
+                        auto eit = cs.LowerBoundStart( it, cs.size(), m_vd.zvEnd );
                         while( it < eit )
                         {
-                            const auto start = it->Start();
-                            const auto end = it->End();
+                            const auto cx = cs[it];
+                            const auto start = cx.Start();
+                            const auto end = cx.End();
                             const auto zsz = std::max( ( end - start ) * pxns, pxns * 0.5 );
                             if( zsz < MinVisSize )
                             {
@@ -5182,11 +5368,12 @@ int View::DrawCpuData( int offset, double pxns, const ImVec2& wpos, bool hover,
                                 for(;;)
                                 {
                                     const auto prevIt = it;
-                                    it = std::lower_bound( it, eit, nextTime, [] ( const auto& l, const auto& r ) { return (uint64_t)l.End() < (uint64_t)r; } );
+                                    it = cs.LowerBoundEnd( it, eit, nextTime );
                                     if( it == prevIt ) ++it;
-                                    num += std::distance( prevIt, it );
+                                    num += it - prevIt;
                                     if( it == eit ) break;
-                                    const auto nend = it->IsEndValid() ? it->End() : m_worker.GetLastTime();
+                                    const auto next = cs[it];
+                                    const auto nend = next.IsEndValid() ? next.End() : m_worker.GetLastTime();
                                     const auto pxnext = ( nend - m_vd.zvStart ) * pxns;
                                     if( pxnext - px1 >= MinVisSize * 2 ) break;
                                     px1 = pxnext;
@@ -5226,7 +5413,7 @@ int View::DrawCpuData( int offset, double pxns, const ImVec2& wpos, bool hover,
                             else
                             {
                                 char buf[256];
-                                const auto thread = m_worker.DecompressThreadExternal( it->Thread() );
+                                const auto thread = m_worker.DecompressThreadExternal( cx.Thread() );
                                 const auto local = m_worker.IsThreadLocal( thread );
                                 auto txt = local ? m_worker.GetThreadName( thread ) : m_worker.GetExternalName( thread ).first;
                                 auto label = txt;
@@ -8295,11 +8482,12 @@ void View::DrawMessages()
     size_t tsz = 0;
     for( const auto& t : m_threadOrder ) if( !t->messages.empty() ) tsz++;
 
-    m_messageFilter.Draw( ICON_FA_FILTER " Filter messages", 200 );
+    bool filterChanged = m_messageFilter.Draw( ICON_FA_FILTER " Filter messages", 200 );
     ImGui::SameLine();
     if( ImGui::Button( ICON_FA_BACKSPACE " Clear" ) )
     {
         m_messageFilter.Clear();
+        filterChanged = true;
     }
     ImGui::SameLine();
     ImGui::Spacing();
@@ -8308,7 +8496,7 @@ void View::DrawMessages()
     ImGui::SameLine();
     ImGui::Spacing();
     ImGui::SameLine();
-    TextFocused( "Visible messages:", RealToString( m_visibleMessages ) );
+    TextFocused( "Visible messages:", RealToString( m_msgList.size() ) );
     if( m_worker.GetFrameImageCount() != 0 )
     {
         ImGui::SameLine();
@@ -8331,6 +8519,7 @@ void View::DrawMessages()
             {
                 VisibleMsgThread( t->id ) = true;
             }
+            filterChanged = true;
         }
         ImGui::SameLine();
         if( ImGui::SmallButton( "Unselect all" ) )
@@ -8339,6 +8528,7 @@ void View::DrawMessages()
             {
                 VisibleMsgThread( t->id ) = false;
             }
+            filterChanged = true;
         }
 
         int idx = 0;
@@ -8349,7 +8539,7 @@ void View::DrawMessages()
             const auto threadColor = GetThreadColor( t->id, 0 );
             SmallColorBox( threadColor );
             ImGui::SameLine();
-            SmallCheckbox( m_worker.GetThreadName( t->id ), &VisibleMsgThread( t->id ) );
+            if( SmallCheckbox( m_worker.GetThreadName( t->id ), &VisibleMsgThread( t->id ) ) ) filterChanged = true;
             ImGui::PopID();
             ImGui::SameLine();
             ImGui::TextDisabled( "(%s)", RealToString( t->messages.size() ) );
@@ -8395,85 +8585,98 @@ void View::DrawMessages()
     }
     ImGui::Separator();
 
-    int msgcnt = 0;
-    const auto filterActive = m_messageFilter.IsActive();
+    if( filterChanged )
+    {
+        m_messageSearch.Clear();
+        for( auto& v : m_messageFilter.Filters )
+        {
+            if( v.empty() ) continue;
+            if( v.b[0] == '-' )
+            {
+                m_messageSearch.Add( v.b+1, v.e-v.b-1, true );
+            }
+            else
+            {
+                m_messageSearch.Add( v.b, v.e-v.b, false );
+            }
+        }
+        m_msgList.clear();
+        m_msgListProcessed = 0;
+    }
+    UpdateMessageList();
+
+    // Rows have different heights, as messages are wrapped, so the list is not
+    // clipped.
     int idx = 0;
-    for( const auto& v : msgs )
+    for( auto& msgIdx : m_msgList )
     {
+        const auto& v = msgs[msgIdx];
         const auto tid = m_worker.DecompressThread( v->thread );
-        if( VisibleMsgThread( tid ) )
+        const auto text = m_worker.GetString( v->ref );
+        ImGui::PushID( v );
+        if( ImGui::Selectable( TimeToStringExact( v->time ), m_msgHighlight == v, ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowItemOverlap ) )
         {
-            const auto text = m_worker.GetString( v->ref );
-            if( !filterActive || m_messageFilter.PassFilter( text ) )
+            CenterAtTime( v->time );
+        }
+        if( ImGui::IsItemHovered() )
+        {
+            m_msgHighlight = v;
+
+            if( m_showMessageImages )
             {
-                ImGui::PushID( v );
-                if( ImGui::Selectable( TimeToStringExact( v->time ), m_msgHighlight == v, ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowItemOverlap ) )
-                {
-                    CenterAtTime( v->time );
-                }
-                if( ImGui::IsItemHovered() )
+                const auto frameIdx = m_worker.GetFrameRange( *m_frames, v->time, v->time ).first;
+                auto fi = m_worker.GetFrameImage( *m_frames, frameIdx );
+                if( fi )
                 {
-                    m_msgHighlight = v;
-
-                    if( m_showMessageImages )
+                    ImGui::BeginTooltip();
+                    if( fi != m_frameTexturePtr )
                     {
-                        const auto frameIdx = m_worker.GetFrameRange( *m_frames, v->time, v->time ).first;
-                        auto fi = m_worker.GetFrameImage( *m_frames, frameIdx );
-                        if( fi )
-                        {
-                            ImGui::BeginTooltip();
-                            if( fi != m_frameTexturePtr )
-                            {
-                                if( !m_frameTexture ) m_frameTexture = MakeTexture();
-                                UpdateTexture( m_frameTexture, m_worker.UnpackFrameImage( *fi ), fi->w, fi->h );
-                                m_frameTexturePtr = fi;
-                            }
-                            if( fi->flip )
-                            {
-                                ImGui::Image( m_frameTexture, ImVec2( fi->w, fi->h ), ImVec2( 0, 1 ), ImVec2( 1, 0 ) );
-                            }
-                            else
-                            {
-                                ImGui::Image( m_frameTexture, ImVec2( fi->w, fi->h ) );
-                            }
-                            ImGui::EndTooltip();
-                        }
+                        if( !m_frameTexture ) m_frameTexture = MakeTexture();
+                        UpdateTexture( m_frameTexture, m_worker.UnpackFrameImage( *fi ), fi->w, fi->h );
+                        m_frameTexturePtr = fi;
                     }
-                }
-                if( m_msgToFocus == v )
-                {
-                    ImGui::SetScrollHereY();
-                    m_msgToFocus.Decay( nullptr );
-                    m_messagesScrollBottom = false;
-                }
-                ImGui::PopID();
-                ImGui::NextColumn();
-                SmallColorBox( GetThreadColor( tid, 0 ) );
-                ImGui::SameLine();
-                ImGui::TextUnformatted( m_worker.GetThreadName( tid ) );
-                ImGui::SameLine();
-                ImGui::TextDisabled( "(%s)", RealToString( tid ) );
-                ImGui::NextColumn();
-                ImGui::PushStyleColor( ImGuiCol_Text, v->color );
-                ImGui::TextWrapped( "%s", text );
-                ImGui::PopStyleColor();
-                ImGui::NextColumn();
-                if( hasCallstack )
-                {
-                    const auto cs = v->callstack.Val();
-                    if( cs != 0 )
+                    if( fi->flip )
                     {
-                        SmallCallstackButton( ICON_FA_ALIGN_JUSTIFY, cs, idx );
-                        ImGui::SameLine();
-                        DrawCallstackCalls( cs, 4 );
+                        ImGui::Image( m_frameTexture, ImVec2( fi->w, fi->h ), ImVec2( 0, 1 ), ImVec2( 1, 0 ) );
                     }
-                    ImGui::NextColumn();
+                    else
+                    {
+                        ImGui::Image( m_frameTexture, ImVec2( fi->w, fi->h ) );
+                    }
+                    ImGui::EndTooltip();
                 }
-                msgcnt++;
             }
         }
+        if( m_msgToFocus == v )
+        {
+            ImGui::SetScrollHereY();
+            m_msgToFocus.Decay( nullptr );
+            m_messagesScrollBottom = false;
+        }
+        ImGui::PopID();
+        ImGui::NextColumn();
+        SmallColorBox( GetThreadColor( tid, 0 ) );
+        ImGui::SameLine();
+        ImGui::TextUnformatted( m_worker.GetThreadName( tid ) );
+        ImGui::SameLine();
+        ImGui::TextDisabled( "(%s)", RealToString( tid ) );
+        ImGui::NextColumn();
+        ImGui::PushStyleColor( ImGuiCol_Text, v->color );
+        ImGui::TextWrapped( "%s", text );
+        ImGui::PopStyleColor();
+        ImGui::NextColumn();
+        if( hasCallstack )
+        {
+            const auto cs = v->callstack.Val();
+            if( cs != 0 )
+            {
+                SmallCallstackButton( ICON_FA_ALIGN_JUSTIFY, cs, idx );
+                ImGui::SameLine();
+                DrawCallstackCalls( cs, 4 );
+            }
+            ImGui::NextColumn();
+        }
     }
-    m_visibleMessages = msgcnt;
 
     if( m_worker.IsConnected() && ImGui::GetScrollY() >= ImGui::GetScrollMaxY() )
     {
@@ -8485,6 +8688,67 @@ void View::DrawMessages()
     ImGui::End();
 }
 
+void View::UpdateMessageList()
+{
+    const auto& msgs = m_worker.GetMessages();
+    const auto msgsz = msgs.size();
+    if( m_msgListProcessed != 0 && ( m_msgListProcessed > msgsz || msgs[m_msgListProcessed-1].get() != m_msgListLast ) )
+    {
+        // Messages were inserted out of order
+        m_msgList.clear();
+        m_msgListProcessed = 0;
+    }
+    if( m_msgListProcessed == msgsz ) return;
+
+    // Filtering runs in parallel, so the visibility map must not be modified by the jobs.
+    for( const auto& t : m_threadOrder )
+    {
+        if( !t->messages.empty() ) VisibleMsgThread( t->id );
+    }
+
+    auto filter = [this, &msgs] ( size_t start, size_t end, std::vector<uint32_t>& out ) {
+        for( size_t i=start; i<end; i++ )
+        {
+            const auto& v = msgs[i];
+            auto it = m_visibleMsgThread.find( m_worker.DecompressThread( v->thread ) );
+            if( it != m_visibleMsgThread.end() && !it->second ) continue;
+            if( m_messageSearch.Match( m_worker.GetString( v->ref ) ) ) out.emplace_back( uint32_t( i ) );
+        }
+    };
+
+    enum { ChunkSize = 64 * 1024 };
+    const auto start = m_msgListProcessed;
+    const auto chunks = ( msgsz - start + ChunkSize - 1 ) / ChunkSize;
+    std::vector<std::vector<uint32_t>> result( chunks );
+    if( chunks == 1 )
+    {
+        filter( start, msgsz, result[0] );
+    }
+    else
+    {
+        TaskGroup group;
+        for( size_t i=0; i<chunks; i++ )
+        {
+            group.Run( [&filter, &result, start, msgsz, i] {
+                const auto first = start + i * ChunkSize;
+                filter( first, std::min<size_t>( first + ChunkSize, msgsz ), result[i] );
+            } );
+        }
+        group.Wait();
+    }
+
+    size_t total = m_msgList.size();
+    for( auto& v : result ) total += v.size();
+    m_msgList.reserve( total );
+    for( auto& v : result )
+    {
+        for( auto& idx : v ) m_msgList.push_back_no_space_check( idx );
+    }
+
+    m_msgListProcessed = msgsz;
+    m_msgListLast = msgs.back().get();
+}
+
 uint64_t View::GetSelectionTarget( const Worker::ZoneThreadData& ev, FindZone::GroupBy groupBy ) const
 {
     switch( groupBy )
@@ -10203,6 +10467,7 @@ void View::DrawCompare()
 
     if( ImGui::Button( ICON_FA_TRASH_ALT " Unload" ) )
     {
+        m_compare.AbortDiff();
         m_compare.Reset();
         m_compare.second.reset();
         m_compare.userData.reset();
@@ -10218,11 +10483,20 @@ void View::DrawCompare()
     ImGui::RadioButton( "Zones", &m_compare.compareMode, 0 );
     ImGui::SameLine();
     ImGui::RadioButton( "Frames", &m_compare.compareMode, 1 );
+    ImGui::SameLine();
+    ImGui::RadioButton( "All zones", &m_compare.compareMode, 2 );
     if( oldMode != m_compare.compareMode )
     {
         m_compare.Reset();
     }
 
+    if( m_compare.compareMode == 2 )
+    {
+        DrawCompareDiff();
+        ImGui::End();
+        return;
+    }
+
     bool findClicked = false;
 
     if( m_compare.compareMode == 0 )
@@ -11087,6 +11361,60 @@ void View::DrawCompare()
     ImGui::End();
 }
 
+void View::DrawZoneThrottlePopup( int16_t srcloc )
+{
+    if( !ImGui::BeginPopup( "ZoneThrottlePopup" ) ) return;
+    TextDisabledUnformatted( "Zone throttling" );
+    ImGui::Separator();
+    ImGui::RadioButton( "Record all", &m_zoneThrottleMode, ZoneThrottleNone );
+    ImGui::RadioButton( "Record one in N calls", &m_zoneThrottleMode, ZoneThrottleOneInN );
+    ImGui::RadioButton( "Record at most N calls per second", &m_zoneThrottleMode, ZoneThrottlePerSecond );
+    if( m_zoneThrottleMode != ZoneThrottleNone )
+    {
+        ImGui::SetNextItemWidth( 120 );
+        ImGui::InputInt( "N", &m_zoneThrottleValue );
+        m_zoneThrottleValue = std::max( m_zoneThrottleMode == ZoneThrottleOneInN ? 2 : 1, std::min( m_zoneThrottleValue, int( ZoneThrottleValueMask ) ) );
+    }
+    if( ImGui::Button( ICON_FA_CHECK " Apply" ) )
+    {
+        m_worker.SetZoneThrottle( srcloc, ZoneThrottleMode( m_zoneThrottleMode ), uint32_t( m_zoneThrottleValue ) );
+        ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
+}
+
+void View::ZoneAggregateTooltip( int16_t srcloc )
+{
+    auto& zas = m_worker.GetZoneAggregateStats();
+    auto it = zas.find( srcloc );
+    if( it == zas.end() ) return;
+    auto& stats = it->second;
+
+    ImGui::BeginTooltip();
+    ImGui::TextUnformatted( m_worker.GetZoneName( m_worker.GetSourceLocation( srcloc ) ) );
+    ImGui::SameLine();
+    TextDisabledUnformatted( ICON_FA_LAYER_GROUP " Aggregated zone" );
+    ImGui::Separator();
+    TextFocused( "Zone count:", RealToString( stats.count ) );
+    TextFocused( "Total time:", TimeToString( stats.total ) );
+    TextFocused( "Min time:", TimeToString( stats.min ) );
+    TextFocused( "Max time:", TimeToString( stats.max ) );
+    ImGui::Separator();
+    TextDisabledUnformatted( "Time histogram:" );
+    uint64_t maxCount = 0;
+    for( auto& v : stats.hist ) maxCount = std::max( maxCount, v );
+    for( int i=0; i<ZoneAggregateBuckets; i++ )
+    {
+        if( stats.hist[i] == 0 ) continue;
+        char buf[64];
+        sprintf( buf, "%s", TimeToString( m_worker.GetZoneAggregateBucketTime( i ) ) );
+        ImGui::ProgressBar( float( stats.hist[i] ) / maxCount, ImVec2( ImGui::GetFontSize() * 8, 0 ), RealToString( stats.hist[i] ) );
+        ImGui::SameLine();
+        ImGui::Text( "%s - %s", buf, i == ZoneAggregateBuckets - 1 ? "" : TimeToString( m_worker.GetZoneAggregateBucketTime( i + 1 ) ) );
+    }
+    ImGui::EndTooltip();
+}
+
 void View::DrawStatistics()
 {
     ImGui::SetNextWindowSize( ImVec2( 1400, 600 ), ImGuiCond_FirstUseEver );
@@ -11172,20 +11500,54 @@ void View::DrawStatistics()
             }
         }
 
+        // Zones dropped by client-side throttling are accounted for by
+        // extrapolating from the recorded ones.
+        const auto zoneCount = [this]( const auto& v ) { return v->second.zones.size() + m_worker.GetZonesDropped( v->first ); };
+        const auto zoneTime = [this]( const auto& v, int64_t time ) {
+            const auto dropped = m_worker.GetZonesDropped( v->first );
+            if( dropped == 0 ) return time;
+            const auto recorded = v->second.zones.size();
+            return int64_t( double( time ) * ( recorded + dropped ) / recorded );
+        };
+
+        auto& zas = m_worker.GetZoneAggregateStats();
+        Vector<decltype(zas.begin())> aggregates;
+        aggregates.reserve( zas.size() );
+        for( auto it = zas.begin(); it != zas.end(); ++it )
+        {
+            if( filterActive && !m_statisticsFilter.PassFilter( m_worker.GetZoneName( m_worker.GetSourceLocation( it->first ) ) ) ) continue;
+            aggregates.push_back_no_space_check( it );
+        }
+        switch( m_statSort )
+        {
+        case 0:
+            pdqsort_branchless( aggregates.begin(), aggregates.end(), []( const auto& lhs, const auto& rhs ) { return lhs->second.total > rhs->second.total; } );
+            break;
+        case 1:
+            pdqsort_branchless( aggregates.begin(), aggregates.end(), []( const auto& lhs, const auto& rhs ) { return lhs->second.count > rhs->second.count; } );
+            break;
+        case 2:
+            pdqsort_branchless( aggregates.begin(), aggregates.end(), []( const auto& lhs, const auto& rhs ) { return lhs->second.total / lhs->second.count > rhs->second.total / rhs->second.count; } );
+            break;
+        default:
+            assert( false );
+            break;
+        }
+
         switch( m_statSort )
         {
         case 0:
             if( m_statSelf )
             {
-                pdqsort_branchless( srcloc.begin(), srcloc.end(), []( const auto& lhs, const auto& rhs ) { return lhs->second.selfTotal > rhs->second.selfTotal; } );
+                pdqsort_branchless( srcloc.begin(), srcloc.end(), [&]( const auto& lhs, const auto& rhs ) { return zoneTime( lhs, lhs->second.selfTotal ) > zoneTime( rhs, rhs->second.selfTotal ); } );
             }
             else
             {
-                pdqsort_branchless( srcloc.begin(), srcloc.end(), []( const auto& lhs, const auto& rhs ) { return lhs->second.total > rhs->second.total; } );
+                pdqsort_branchless( srcloc.begin(), srcloc.end(), [&]( const auto& lhs, const auto& rhs ) { return zoneTime( lhs, lhs->second.total ) > zoneTime( rhs, rhs->second.total ); } );
             }
             break;
         case 1:
-            pdqsort_branchless( srcloc.begin(), srcloc.end(), []( const auto& lhs, const auto& rhs ) { return lhs->second.zones.size() > rhs->second.zones.size(); } );
+            pdqsort_branchless( srcloc.begin(), srcloc.end(), [&]( const auto& lhs, const auto& rhs ) { return zoneCount( lhs ) > zoneCount( rhs ); } );
             break;
         case 2:
             if( m_statSelf )
@@ -11210,6 +11572,13 @@ void View::DrawStatistics()
         ImGui::Spacing();
         ImGui::SameLine();
         TextFocused( "Visible zones:", RealToString( srcloc.size() ) );
+        if( !zas.empty() )
+        {
+            ImGui::SameLine();
+            ImGui::Spacing();
+            ImGui::SameLine();
+            TextFocused( ICON_FA_LAYER_GROUP " Aggregated:", RealToString( aggregates.size() ) );
+        }
         ImGui::SameLine();
         ImGui::Spacing();
         ImGui::SameLine();
@@ -11217,7 +11586,7 @@ void View::DrawStatistics()
 
         ImGui::Separator();
 
-        if( srcloc.empty() )
+        if( srcloc.empty() && aggregates.empty() )
         {
             ImGui::TextUnformatted( "No entries to be displayed." );
         }
@@ -11262,6 +11631,17 @@ void View::DrawStatistics()
                 {
                     m_findZone.ShowZone( v->first, name );
                 }
+                if( v->first > 0 && m_worker.IsConnected() )
+                {
+                    if( ImGui::IsItemClicked( 1 ) )
+                    {
+                        const auto setting = m_worker.GetZoneThrottle( v->first );
+                        m_zoneThrottleMode = int( setting >> ZoneThrottleValueBits );
+                        m_zoneThrottleValue = setting == 0 ? 10 : int( setting & ZoneThrottleValueMask );
+                        ImGui::OpenPopup( "ZoneThrottlePopup" );
+                    }
+                    DrawZoneThrottlePopup( v->first );
+                }
                 ImGui::NextColumn();
                 float indentVal = 0.f;
                 if( m_statBuzzAnim.Match( v->first ) )
@@ -11289,20 +11669,74 @@ void View::DrawStatistics()
                     ImGui::Unindent( indentVal );
                 }
                 ImGui::NextColumn();
-                const auto time = m_statSelf ? v->second.selfTotal : v->second.total;
-                ImGui::TextUnformatted( TimeToString( time ) );
+                const auto dropped = m_worker.GetZonesDropped( v->first );
+                const auto time = zoneTime( v, m_statSelf ? v->second.selfTotal : v->second.total );
+                if( dropped == 0 )
+                {
+                    ImGui::TextUnformatted( TimeToString( time ) );
+                }
+                else
+                {
+                    ImGui::Text( "~%s", TimeToString( time ) );
+                }
                 ImGui::SameLine();
                 char buf[64];
                 PrintStringPercent( buf, 100. * time / lastTime );
                 TextDisabledUnformatted( buf );
                 ImGui::NextColumn();
-                ImGui::TextUnformatted( RealToString( v->second.zones.size() ) );
+                if( dropped == 0 )
+                {
+                    ImGui::TextUnformatted( RealToString( v->second.zones.size() ) );
+                }
+                else
+                {
+                    ImGui::Text( "~%s", RealToString( zoneCount( v ) ) );
+                    if( ImGui::IsItemHovered() )
+                    {
+                        ImGui::BeginTooltip();
+                        TextFocused( "Recorded zones:", RealToString( v->second.zones.size() ) );
+                        TextFocused( "Dropped by throttling:", RealToString( dropped ) );
+                        ImGui::TextDisabled( "Total time is extrapolated from the recorded zones." );
+                        ImGui::EndTooltip();
+                    }
+                }
                 ImGui::NextColumn();
                 ImGui::TextUnformatted( TimeToString( ( m_statSelf ? v->second.selfTotal : v->second.total ) / v->second.zones.size() ) );
                 ImGui::NextColumn();
 
                 ImGui::PopID();
             }
+            // Aggregated zones don't carry self time, the total time is always shown.
+            for( auto& v : aggregates )
+            {
+                ImGui::PushID( v->first );
+                auto& srcloc = m_worker.GetSourceLocation( v->first );
+                SmallColorBox( GetSrcLocColor( srcloc, 0 ) );
+                ImGui::SameLine();
+                ImGui::TextUnformatted( m_worker.GetZoneName( srcloc ) );
+                ImGui::SameLine();
+                TextDisabledUnformatted( ICON_FA_LAYER_GROUP );
+                if( ImGui::IsItemHovered() ) ZoneAggregateTooltip( v->first );
+                ImGui::NextColumn();
+                const auto file = m_worker.GetString( srcloc.file );
+                ImGui::TextDisabled( "%s:%i", file, srcloc.line );
+                if( ImGui::IsItemClicked( 1 ) && SourceFileValid( file, m_worker.GetCaptureTime(), *this ) )
+                {
+                    ViewSource( file, srcloc.line );
+                }
+                ImGui::NextColumn();
+                ImGui::TextUnformatted( TimeToString( v->second.total ) );
+                ImGui::SameLine();
+                char buf[64];
+                PrintStringPercent( buf, 100. * v->second.total / lastTime );
+                TextDisabledUnformatted( buf );
+                ImGui::NextColumn();
+                ImGui::TextUnformatted( RealToString( v->second.count ) );
+                ImGui::NextColumn();
+                ImGui::TextUnformatted( TimeToString( v->second.total / v->second.count ) );
+                ImGui::NextColumn();
+                ImGui::PopID();
+            }
             ImGui::EndColumns();
             ImGui::EndChild();
         }
@@ -12419,7 +12853,34 @@ void View::DrawInfo()
             ImGui::TextUnformatted( "Coarse CPU core context switch data" );
             ImGui::EndTooltip();
         }
-        ImGui::TreePop();
+        auto& dataLoss = m_worker.GetDataLoss();
+        if( !dataLoss.empty() )
+        {
+            int64_t lossTime = 0;
+            uint64_t lossCallstacks = 0, lossZones = 0, lossOther = 0;
+            for( auto& v : dataLoss )
+            {
+                lossTime += ( v.end < 0 ? m_worker.GetLastTime() : v.end ) - v.start;
+                lossCallstacks += v.callstacks;
+                lossZones += v.zones;
+                lossOther += v.other;
+            }
+            TextColoredUnformatted( ImVec4( 1.f, 0.3f, 0.3f, 1.f ), ICON_FA_EXCLAMATION_TRIANGLE );
+            ImGui::SameLine();
+            TextFocused( "Data lost:", TimeToString( lossTime ) );
+            if( ImGui::IsItemHovered() )
+            {
+                ImGui::BeginTooltip();
+                ImGui::TextUnformatted( "Client dropped data, because its queues were over the memory budget" );
+                ImGui::Separator();
+                TextFocused( "Ranges:", RealToString( dataLoss.size() ) );
+                TextFocused( "Dropped call stacks:", RealToString( lossCallstacks ) );
+                TextFocused( "Dropped zones:", RealToString( lossZones ) );
+                TextFocused( "Dropped other events:", RealToString( lossOther ) );
+                ImGui::EndTooltip();
+            }
+        }
+        ImGui::TreePop();
     }
 
     if( ImGui::TreeNode( "Frame statistics" ) )
@@ -14354,12 +14815,12 @@ unordered_flat_map<uint32_t, View::PathData> View::GetCallstackPaths( const MemD
             auto it = pathSum.find( ev.CsAlloc() );
             if( it == pathSum.end() )
             {
-                pathSum.emplace( ev.CsAlloc(), PathData { 1, ev.Size() } );
+                pathSum.emplace( ev.CsAlloc(), PathData { 1, m_worker.EstimateMemSize( ev.Size() ) } );
             }
             else
             {
                 it->second.cnt++;
-                it->second.mem += ev.Size();
+                it->second.mem += m_worker.EstimateMemSize( ev.Size() );
             }
         }
     }
@@ -14373,12 +14834,12 @@ unordered_flat_map<uint32_t, View::PathData> View::GetCallstackPaths( const MemD
             auto it = pathSum.find( ev.CsAlloc() );
             if( it == pathSum.end() )
             {
-                pathSum.emplace( ev.CsAlloc(), PathData { 1, ev.Size() } );
+                pathSum.emplace( ev.CsAlloc(), PathData { 1, m_worker.EstimateMemSize( ev.Size() ) } );
             }
             else
             {
                 it->second.cnt++;
-                it->second.mem += ev.Size();
+                it->second.mem += m_worker.EstimateMemSize( ev.Size() );
             }
         }
     }
@@ -14669,19 +15130,40 @@ void View::DrawMemory()
     ImGui::SameLine();
     ImGui::Spacing();
     ImGui::SameLine();
-    TextDisabledUnformatted( "Total allocations:" );
-    ImGui::SameLine();
-    ImGui::Text( "%-15s", RealToString( mem.data.size() ) );
-    ImGui::SameLine();
-    TextDisabledUnformatted( "Active allocations:" );
-    ImGui::SameLine();
-    ImGui::Text( "%-15s", RealToString( mem.active.size() ) );
-    ImGui::SameLine();
-    TextDisabledUnformatted( "Memory usage:" );
-    ImGui::SameLine();
-    ImGui::Text( "%-15s", MemSizeToString( mem.usage ) );
-    ImGui::SameLine();
-    TextFocused( "Memory span:", MemSizeToString( mem.high - mem.low ) );
+    if( mem.sampleInterval != 0 )
+    {
+        TextDisabledUnformatted( "Sampled allocations:" );
+        ImGui::SameLine();
+        ImGui::Text( "%-15s", RealToString( mem.data.size() ) );
+        ImGui::SameLine();
+        TextDisabledUnformatted( "Active samples:" );
+        ImGui::SameLine();
+        ImGui::Text( "%-15s", RealToString( mem.active.size() ) );
+        ImGui::SameLine();
+        TextDisabledUnformatted( "Estimated memory usage:" );
+        ImGui::SameLine();
+        ImGui::Text( "%-15s", MemSizeToString( mem.usage ) );
+        ImGui::SameLine();
+        TextFocused( "Sampling interval:", MemSizeToString( mem.sampleInterval ) );
+        ImGui::SameLine();
+        DrawHelpMarker( "Allocations were sampled on average once per sampling interval bytes. Memory usage and call stack allocation sizes are estimated by scaling up the samples." );
+    }
+    else
+    {
+        TextDisabledUnformatted( "Total allocations:" );
+        ImGui::SameLine();
+        ImGui::Text( "%-15s", RealToString( mem.data.size() ) );
+        ImGui::SameLine();
+        TextDisabledUnformatted( "Active allocations:" );
+        ImGui::SameLine();
+        ImGui::Text( "%-15s", RealToString( mem.active.size() ) );
+        ImGui::SameLine();
+        TextDisabledUnformatted( "Memory usage:" );
+        ImGui::SameLine();
+        ImGui::Text( "%-15s", MemSizeToString( mem.usage ) );
+        ImGui::SameLine();
+        TextFocused( "Memory span:", MemSizeToString( mem.high - mem.low ) );
+    }
 
     const auto zvMid = m_vd.zvStart + ( m_vd.zvEnd - m_vd.zvStart ) / 2;
 
@@ -14981,9 +15463,24 @@ void View::DrawFrameTreeLevel( const unordered_flat_map<uint64_t, CallstackFrame
             if( io.KeyCtrl && ImGui::IsItemHovered() )
             {
                 ImGui::BeginTooltip();
-                TextFocused( "Allocations size:", MemSizeToString( v.alloc ) );
-                TextFocused( "Allocations count:", RealToString( v.count ) );
-                TextFocused( "Mean allocation size:", MemSizeToString( v.alloc / v.count ) );
+                if( m_worker.GetMemData().sampleInterval != 0 )
+                {
+                    TextFocused( "Estimated allocations size:", MemSizeToString( v.alloc ) );
+                    TextFocused( "Sampled allocations:", RealToString( v.count ) );
+                    const auto span = m_memInfo.restrictTime ? m_vd.zvStart + ( m_vd.zvEnd - m_vd.zvStart ) / 2 : m_worker.GetLastTime();
+                    if( span > 0 )
+                    {
+                        TextDisabledUnformatted( "Estimated allocation rate:" );
+                        ImGui::SameLine();
+                        ImGui::Text( "%s/s", MemSizeToString( int64_t( v.alloc * 1000000000. / span ) ) );
+                    }
+                }
+                else
+                {
+                    TextFocused( "Allocations size:", MemSizeToString( v.alloc ) );
+                    TextFocused( "Allocations count:", RealToString( v.count ) );
+                    TextFocused( "Mean allocation size:", MemSizeToString( v.alloc / v.count ) );
+                }
                 ImGui::SameLine();
                 ImGui::EndTooltip();
             }
@@ -15917,6 +16414,609 @@ void View::FindZonesCompare()
         }
     }
 }
+
+void View::CalcCompareDiff()
+{
+    // Source locations are matched by name, in the same way as selection linking works.
+    // Multiple source locations with the same name are merged together.
+    Worker* worker[2] = { &m_worker, m_compare.second.get() };
+    unordered_flat_map<std::string, std::vector<int16_t>> groups[2];
+    for( int k=0; k<2; k++ )
+    {
+        std::shared_lock<std::shared_mutex> lock( worker[k]->GetDataLock() );
+        for( auto& v : worker[k]->GetSourceLocationZones() )
+        {
+            if( v.second.zones.empty() ) continue;
+            auto& srcloc = worker[k]->GetSourceLocation( v.first );
+            groups[k][worker[k]->GetString( srcloc.name.active ? srcloc.name : srcloc.function )].emplace_back( v.first );
+        }
+    }
+
+    std::vector<std::pair<const std::vector<int16_t>*, const std::vector<int16_t>*>> matched;
+    for( auto& v : groups[0] )
+    {
+        auto it = groups[1].find( v.first );
+        if( it != groups[1].end() ) matched.emplace_back( &v.second, &it->second );
+    }
+
+    std::vector<CompDiff> diff( matched.size() );
+    TaskGroup group;
+    for( size_t i=0; i<matched.size(); i++ )
+    {
+        group.Run( [this, &worker, &matched, &diff, i] {
+            if( m_compare.diffAbort.load( std::memory_order_relaxed ) ) return;
+            const std::vector<int16_t>* srclocs[2] = { matched[i].first, matched[i].second };
+            auto& res = diff[i];
+            double var[2];
+            for( int k=0; k<2; k++ )
+            {
+                std::vector<int64_t> times;
+                {
+                    std::shared_lock<std::shared_mutex> lock( worker[k]->GetDataLock() );
+                    for( auto& sl : *srclocs[k] )
+                    {
+                        auto& zones = worker[k]->GetZonesForSourceLocation( sl ).zones;
+                        times.reserve( times.size() + zones.size() );
+                        for( auto& v : zones ) times.emplace_back( v.Zone()->End() - v.Zone()->Start() );
+                    }
+                    if( k == 0 )
+                    {
+                        auto& srcloc = m_worker.GetSourceLocation( srclocs[k]->front() );
+                        res.name = m_worker.GetString( srcloc.name.active ? srcloc.name : srcloc.function );
+                    }
+                }
+                const auto sz = times.size();
+                double total = 0;
+                for( auto& v : times ) total += v;
+                const auto mean = total / sz;
+                double sumSq = 0;
+                for( auto& v : times ) sumSq += ( v - mean ) * ( v - mean );
+                auto p99 = times.begin() + size_t( ( sz - 1 ) * 0.99 );
+                std::nth_element( times.begin(), p99, times.end() );
+                res.p99[k] = *p99;
+                auto median = times.begin() + sz / 2;
+                std::nth_element( times.begin(), median, p99 );
+                res.median[k] = *median;
+                res.count[k] = sz;
+                res.mean[k] = mean;
+                var[k] = sz > 1 ? sumSq / ( sz - 1 ) : 0;
+                res.srcloc[k] = srclocs[k]->front();
+            }
+            // Welch's t-test, with normal approximation of the t distribution.
+            const auto se = sqrt( var[0] / res.count[0] + var[1] / res.count[1] );
+            if( res.count[0] > 1 && res.count[1] > 1 && se > 0 )
+            {
+                const auto t = ( res.mean[0] - res.mean[1] ) / se;
+                res.pValue = erfc( fabs( t ) / sqrt( 2. ) );
+            }
+            else
+            {
+                res.pValue = 1;
+            }
+        } );
+    }
+    group.Wait();
+
+    if( !m_compare.diffAbort.load( std::memory_order_relaxed ) ) m_compare.diff = std::move( diff );
+    m_compare.diffReady.store( true, std::memory_order_release );
+}
+
+static double RelativeChange( double v0, double v1 )
+{
+    return v1 == 0 ? 0 : ( v0 - v1 ) / v1;
+}
+
+static void TextRelativeChange( double v0, double v1 )
+{
+    const auto change = RelativeChange( v0, v1 ) * 100;
+    ImGui::SameLine();
+    if( change > 0 )
+    {
+        ImGui::TextColored( ImVec4( 1.f, 0.4f, 0.4f, 1.f ), "(+%.2f%%)", change );
+    }
+    else if( change < 0 )
+    {
+        ImGui::TextColored( ImVec4( 0.4f, 1.f, 0.4f, 1.f ), "(%.2f%%)", change );
+    }
+    else
+    {
+        TextDisabledUnformatted( "(=)" );
+    }
+}
+
+void View::DrawCompareDiff()
+{
+    auto SortDiff = [this] {
+        auto& diff = m_compare.diff;
+        switch( m_compare.diffSort )
+        {
+        case 0:
+            pdqsort_branchless( diff.begin(), diff.end(), []( const auto& lhs, const auto& rhs ) { return fabs( RelativeChange( lhs.mean[0], lhs.mean[1] ) ) > fabs( RelativeChange( rhs.mean[0], rhs.mean[1] ) ); } );
+            break;
+        case 1:
+            pdqsort_branchless( diff.begin(), diff.end(), []( const auto& lhs, const auto& rhs ) { return fabs( RelativeChange( lhs.count[0], lhs.count[1] ) ) > fabs( RelativeChange( rhs.count[0], rhs.count[1] ) ); } );
+            break;
+        case 2:
+            pdqsort_branchless( diff.begin(), diff.end(), []( const auto& lhs, const auto& rhs ) { return fabs( RelativeChange( lhs.median[0], lhs.median[1] ) ) > fabs( RelativeChange( rhs.median[0], rhs.median[1] ) ); } );
+            break;
+        case 3:
+            pdqsort_branchless( diff.begin(), diff.end(), []( const auto& lhs, const auto& rhs ) { return fabs( RelativeChange( lhs.p99[0], lhs.p99[1] ) ) > fabs( RelativeChange( rhs.p99[0], rhs.p99[1] ) ); } );
+            break;
+        case 4:
+            pdqsort_branchless( diff.begin(), diff.end(), []( const auto& lhs, const auto& rhs ) { return lhs.pValue < rhs.pValue; } );
+            break;
+        default:
+            assert( false );
+            break;
+        }
+    };
+
+    ImGui::Separator();
+    if( !m_compare.diffReady.load( std::memory_order_acquire ) )
+    {
+        if( !m_compare.diffRunning )
+        {
+            m_compare.diffRunning = true;
+            m_compare.diffTask.Run( [this] { CalcCompareDiff(); } );
+        }
+        ImGui::TextWrapped( "Please wait, computing data..." );
+        DrawWaitingDots( s_time );
+        return;
+    }
+    if( m_compare.diffRunning )
+    {
+        m_compare.diffTask.Wait();
+        m_compare.diffRunning = false;
+        SortDiff();
+    }
+
+    if( ImGui::Button( ICON_FA_REDO_ALT " Recalculate" ) )
+    {
+        m_compare.AbortDiff();
+        return;
+    }
+#ifndef TRACY_NO_FILESELECTOR
+    ImGui::SameLine();
+    if( ImGui::Button( ICON_FA_SAVE " Export" ) && !m_compare.diff.empty() )
+    {
+        nfdchar_t* fn;
+        auto res = NFD_SaveDialog( "csv", nullptr, &fn );
+        if( res == NFD_OKAY )
+        {
+            const auto sz = strlen( fn );
+            if( sz < 5 || memcmp( fn + sz - 4, ".csv", 4 ) != 0 )
+            {
+                char tmp[1024];
+                sprintf( tmp, "%s.csv", fn );
+                ExportCompareDiff( tmp );
+            }
+            else
+            {
+                ExportCompareDiff( fn );
+            }
+        }
+    }
+#endif
+    ImGui::SameLine();
+    ImGui::Spacing();
+    ImGui::SameLine();
+    TextFocused( "Matched source locations:", RealToString( m_compare.diff.size() ) );
+    ImGui::SameLine();
+    DrawHelpMarker( "Source locations are matched by name. Changes are displayed for this trace, relative to the external trace. Significance of mean time change is estimated with Welch's t-test. Click on a name to compare zones in detail." );
+    ImGui::Separator();
+
+    if( m_compare.diff.empty() )
+    {
+        ImGui::TextUnformatted( "No entries to be displayed." );
+        return;
+    }
+
+    ImGui::BeginChild( "##comparediff" );
+    const auto w = ImGui::GetWindowWidth();
+    static bool widthSet = false;
+    ImGui::Columns( 6 );
+    if( !widthSet )
+    {
+        widthSet = true;
+        ImGui::SetColumnWidth( 0, w * 0.25f );
+        ImGui::SetColumnWidth( 1, w * 0.15f );
+        ImGui::SetColumnWidth( 2, w * 0.15f );
+        ImGui::SetColumnWidth( 3, w * 0.15f );
+        ImGui::SetColumnWidth( 4, w * 0.15f );
+        ImGui::SetColumnWidth( 5, w * 0.15f );
+    }
+    const auto prevSort = m_compare.diffSort;
+    ImGui::TextUnformatted( "Name" );
+    ImGui::NextColumn();
+    if( ImGui::SmallButton( "Counts" ) ) m_compare.diffSort = 1;
+    ImGui::NextColumn();
+    if( ImGui::SmallButton( "Mean" ) ) m_compare.diffSort = 0;
+    ImGui::NextColumn();
+    if( ImGui::SmallButton( "Median" ) ) m_compare.diffSort = 2;
+    ImGui::NextColumn();
+    if( ImGui::SmallButton( "P99" ) ) m_compare.diffSort = 3;
+    ImGui::NextColumn();
+    if( ImGui::SmallButton( "p-value" ) ) m_compare.diffSort = 4;
+    ImGui::NextColumn();
+    ImGui::Separator();
+    if( prevSort != m_compare.diffSort ) SortDiff();
+
+    int idx = 0;
+    for( auto& v : m_compare.diff )
+    {
+        ImGui::PushID( idx++ );
+        SmallColorBox( GetSrcLocColor( m_worker.GetSourceLocation( v.srcloc[0] ), 0 ) );
+        ImGui::SameLine();
+        if( ImGui::Selectable( v.name, false, ImGuiSelectableFlags_SpanAllColumns ) )
+        {
+            m_compare.compareMode = 0;
+            m_compare.Reset();
+            strncpy( m_compare.pattern, v.name, 1023 );
+            m_compare.pattern[1023] = '\0';
+            FindZonesCompare();
+        }
+        ImGui::NextColumn();
+        ImGui::TextUnformatted( RealToString( v.count[0] ) );
+        TextRelativeChange( v.count[0], v.count[1] );
+        ImGui::NextColumn();
+        ImGui::TextUnformatted( TimeToString( v.mean[0] ) );
+        TextRelativeChange( v.mean[0], v.mean[1] );
+        ImGui::NextColumn();
+        ImGui::TextUnformatted( TimeToString( v.median[0] ) );
+        TextRelativeChange( v.median[0], v.median[1] );
+        ImGui::NextColumn();
+        ImGui::TextUnformatted( TimeToString( v.p99[0] ) );
+        TextRelativeChange( v.p99[0], v.p99[1] );
+        ImGui::NextColumn();
+        if( v.pValue < 0.05 )
+        {
+            ImGui::Text( "%.3g", v.pValue );
+        }
+        else
+        {
+            ImGui::TextDisabled( "%.3g", v.pValue );
+        }
+        ImGui::NextColumn();
+        ImGui::PopID();
+    }
+    ImGui::EndColumns();
+    ImGui::EndChild();
+}
+
+bool View::ExportCompareDiff( const char* fn )
+{
+    FILE* f = fopen( fn, "wb" );
+    if( !f ) return false;
+    fprintf( f, "name,location,count,count_ext,mean_ns,mean_ext_ns,median_ns,median_ext_ns,p99_ns,p99_ext_ns,p_value\n" );
+    for( auto& v : m_compare.diff )
+    {
+        fputc( '"', f );
+        for( auto ptr = v.name; *ptr; ptr++ )
+        {
+            if( *ptr == '"' ) fputc( '"', f );
+            fputc( *ptr, f );
+        }
+        auto& srcloc = m_worker.GetSourceLocation( v.srcloc[0] );
+        fprintf( f, "\",\"%s:%i\",%zu,%zu,%.1f,%.1f,%" PRIi64 ",%" PRIi64 ",%" PRIi64 ",%" PRIi64 ",%g\n", m_worker.GetString( srcloc.file ), srcloc.line,
+            v.count[0], v.count[1], v.mean[0], v.mean[1], v.median[0], v.median[1], v.p99[0], v.p99[1], v.pValue );
+    }
+    fclose( f );
+    return true;
+}
+
+void View::DrawFlameGraph()
+{
+    ImGui::SetNextWindowSize( ImVec2( 1000, 500 ), ImGuiCond_FirstUseEver );
+    ImGui::Begin( "Flame graph", &m_flameGraph.show );
+    if( ImGui::Checkbox( "Limit range", &m_flameGraph.limitRange ) )
+    {
+        m_flameGraph.focus.clear();
+        if( m_flameGraph.limitRange )
+        {
+            m_flameGraph.rangeMin = m_vd.zvStart;
+            m_flameGraph.rangeMax = m_vd.zvEnd;
+        }
+    }
+    if( m_flameGraph.limitRange )
+    {
+        ImGui::SameLine();
+        ImGui::TextUnformatted( ICON_FA_LOCK );
+        ImGui::SameLine();
+        TextFocused( "Time range:", TimeToStringExact( m_flameGraph.rangeMin ) );
+        ImGui::SameLine();
+        TextFocused( "-", TimeToStringExact( m_flameGraph.rangeMax ) );
+        ImGui::SameLine();
+        ImGui::TextDisabled( "(%s)", TimeToString( m_flameGraph.rangeMax - m_flameGraph.rangeMin ) );
+        ImGui::SameLine();
+        if( ImGui::SmallButton( "Limit to view" ) )
+        {
+            m_flameGraph.focus.clear();
+            m_flameGraph.rangeMin = m_vd.zvStart;
+            m_flameGraph.rangeMax = m_vd.zvEnd;
+        }
+    }
+    ImGui::Separator();
+
+    // The full range ends at the last time of the trace, so that it is
+    // recalculated as a live capture grows.
+    const auto fullRange = !m_flameGraph.limitRange;
+    const auto range = fullRange ? std::make_pair( int64_t( 0 ), m_worker.GetLastTime() ) : std::make_pair( m_flameGraph.rangeMin, m_flameGraph.rangeMax );
+    auto& cache = m_flameGraph.cache;
+    auto cit = std::find_if( cache.begin(), cache.end(), [&range] ( const auto& v ) { return v.first == range; } );
+    if( cit == cache.end() )
+    {
+        if( m_flameGraph.running && m_flameGraph.pendingRange != range && !( fullRange && m_flameGraph.pendingFull ) ) m_flameGraph.Abort();
+        if( m_flameGraph.ready.load( std::memory_order_acquire ) )
+        {
+            m_flameGraph.task.Wait();
+            m_flameGraph.running = false;
+            if( m_flameGraph.pendingFull )
+            {
+                // Only the latest full range data is kept, so that it doesn't push out limited ranges.
+                const auto prev = std::make_pair( int64_t( 0 ), m_flameGraph.fullRangeEnd );
+                auto pit = std::find_if( cache.begin(), cache.end(), [&prev] ( const auto& v ) { return v.first == prev; } );
+                if( pit != cache.end() ) cache.erase( pit );
+                m_flameGraph.fullRangeEnd = m_flameGraph.pendingRange.second;
+                m_flameGraph.fullRangeTime = s_time;
+            }
+            cache.emplace( cache.begin(), m_flameGraph.pendingRange, std::move( m_flameGraph.pending ) );
+            if( cache.size() > m_flameGraph.CacheSize ) cache.pop_back();
+            m_flameGraph.pending.clear();
+            m_flameGraph.ready.store( false, std::memory_order_relaxed );
+            cit = std::find_if( cache.begin(), cache.end(), [&range] ( const auto& v ) { return v.first == range; } );
+        }
+    }
+    if( cit == cache.end() )
+    {
+        // Previous full range data is shown until the update is ready. Updates
+        // are calculated at most once per FullRangeInterval seconds.
+        if( fullRange && m_flameGraph.fullRangeEnd >= 0 )
+        {
+            const auto prev = std::make_pair( int64_t( 0 ), m_flameGraph.fullRangeEnd );
+            cit = std::find_if( cache.begin(), cache.end(), [&prev] ( const auto& v ) { return v.first == prev; } );
+        }
+        if( !m_flameGraph.running && ( cit == cache.end() || s_time - m_flameGraph.fullRangeTime >= m_flameGraph.FullRangeInterval ) )
+        {
+            {
+                std::shared_lock<std::shared_mutex> lock( m_worker.GetDataLock() );
+                m_flameGraph.progressTotal = m_worker.GetThreadData().size();
+            }
+            m_flameGraph.progress.store( 0, std::memory_order_relaxed );
+            m_flameGraph.pendingRange = range;
+            m_flameGraph.pendingFull = fullRange;
+            m_flameGraph.running = true;
+            m_flameGraph.task.Run( [this, range] { CalcFlameGraph( range.first, range.second ); } );
+        }
+        if( cit == cache.end() )
+        {
+            ImGui::TextWrapped( "Please wait, computing data..." );
+            DrawWaitingDots( s_time );
+            TextFocused( "Processed threads:", RealToString( m_flameGraph.progress.load( std::memory_order_relaxed ) ) );
+            ImGui::SameLine();
+            TextFocused( "/", RealToString( m_flameGraph.progressTotal ) );
+            ImGui::End();
+            return;
+        }
+    }
+    if( cit != cache.begin() )
+    {
+        std::rotate( cache.begin(), cit, cit+1 );
+        cit = cache.begin();
+    }
+
+    if( ImGui::Button( ICON_FA_REDO_ALT " Recalculate" ) )
+    {
+        cache.erase( cit );
+        ImGui::End();
+        return;
+    }
+    ImGui::SameLine();
+    if( ButtonDisablable( ICON_FA_HOME " Reset focus", m_flameGraph.focus.empty() ) )
+    {
+        m_flameGraph.focus.clear();
+    }
+    ImGui::SameLine();
+    ImGui::Spacing();
+    ImGui::SameLine();
+
+    const auto& data = cit->second;
+    const FlameGraphItem* root = nullptr;
+    auto level = &data;
+    for( size_t i=0; i<m_flameGraph.focus.size(); i++ )
+    {
+        const auto srcloc = m_flameGraph.focus[i];
+        auto it = std::find_if( level->begin(), level->end(), [srcloc] ( const auto& v ) { return v.srcloc == srcloc; } );
+        if( it == level->end() )
+        {
+            m_flameGraph.focus.resize( i );
+            break;
+        }
+        root = &*it;
+        level = &root->children;
+    }
+
+    int64_t total = 0;
+    if( root )
+    {
+        total = root->time;
+        TextFocused( "Focus:", m_worker.GetZoneName( m_worker.GetSourceLocation( root->srcloc ) ) );
+    }
+    else
+    {
+        for( auto& v : data ) total += v.time;
+        TextFocused( "Total zone time:", TimeToString( total ) );
+    }
+    ImGui::SameLine();
+    DrawHelpMarker( "Zones from all threads are merged by call path. Zone times are clipped to the selected time range. Click on an item to focus on it, right click to go back one level." );
+    ImGui::Separator();
+
+    if( total == 0 )
+    {
+        ImGui::TextUnformatted( "No zones in selected time range." );
+        ImGui::End();
+        return;
+    }
+
+    ImGui::BeginChild( "##flameGraph" );
+    const auto wpos = ImGui::GetCursorScreenPos();
+    const auto w = ImGui::GetWindowContentRegionWidth();
+    const auto pxns = w / double( total );
+    int depth = 0;
+    auto path = m_flameGraph.focus;
+    if( root )
+    {
+        path.pop_back();
+        depth = DrawFlameGraphItem( *root, wpos, 0, pxns, 0, path );
+    }
+    else
+    {
+        double x = 0;
+        for( auto& v : data )
+        {
+            const auto d = DrawFlameGraphItem( v, wpos, x, pxns, 0, path );
+            if( d > depth ) depth = d;
+            x += v.time * pxns;
+        }
+    }
+    ImGui::Dummy( ImVec2( w, depth * ( ImGui::GetFontSize() + 1 ) ) );
+    if( !m_flameGraph.focus.empty() && ImGui::IsWindowHovered() && ImGui::IsMouseClicked( 1 ) )
+    {
+        m_flameGraph.focus.pop_back();
+    }
+    ImGui::EndChild();
+    ImGui::End();
+}
+
+int View::DrawFlameGraphItem( const FlameGraphItem& item, const ImVec2& wpos, double x, double pxns, int depth, std::vector<int16_t>& path )
+{
+    const auto zsz = item.time * pxns;
+    if( zsz < 1 ) return depth;
+
+    const auto ty = ImGui::GetFontSize();
+    const auto offset = ( ty + 1 ) * depth;
+    auto draw = ImGui::GetWindowDrawList();
+    const auto& srcloc = m_worker.GetSourceLocation( item.srcloc );
+    const auto color = GetSrcLocColor( srcloc, depth );
+    const char* zoneName = m_worker.GetZoneName( srcloc );
+
+    draw->AddRectFilled( wpos + ImVec2( x, offset ), wpos + ImVec2( x + zsz, offset + ty ), color );
+    draw->AddRect( wpos + ImVec2( x, offset ), wpos + ImVec2( x + zsz, offset + ty ), DarkenColor( color ) );
+
+    auto tsz = ImGui::CalcTextSize( zoneName );
+    if( tsz.x > zsz )
+    {
+        zoneName = ShortenNamespace( zoneName );
+        tsz = ImGui::CalcTextSize( zoneName );
+    }
+    if( tsz.x < zsz )
+    {
+        DrawTextContrast( draw, wpos + ImVec2( x + ( zsz - tsz.x ) / 2, offset ), 0xFFFFFFFF, zoneName );
+    }
+    else
+    {
+        ImGui::PushClipRect( wpos + ImVec2( x, offset ), wpos + ImVec2( x + zsz, offset + ty ), true );
+        DrawTextContrast( draw, wpos + ImVec2( x, offset ), 0xFFFFFFFF, zoneName );
+        ImGui::PopClipRect();
+    }
+
+    path.push_back( item.srcloc );
+    if( ImGui::IsWindowHovered() && ImGui::IsMouseHoveringRect( wpos + ImVec2( x, offset ), wpos + ImVec2( x + zsz, offset + ty ) ) )
+    {
+        ImGui::BeginTooltip();
+        ImGui::TextUnformatted( m_worker.GetZoneName( srcloc ) );
+        ImGui::TextDisabled( "%s:%i", m_worker.GetString( srcloc.file ), srcloc.line );
+        ImGui::Separator();
+        TextFocused( "Execution time:", TimeToString( item.time ) );
+        ImGui::SameLine();
+        ImGui::TextDisabled( "(%.2f%% of total)", item.time * pxns / ImGui::GetWindowContentRegionWidth() * 100 );
+        TextFocused( "Zone count:", RealToString( item.count ) );
+        int64_t childTime = 0;
+        for( auto& v : item.children ) childTime += v.time;
+        TextFocused( "Self time:", TimeToString( item.time - childTime ) );
+        ImGui::EndTooltip();
+
+        m_zoneSrcLocHighlight = item.srcloc;
+        if( ImGui::IsMouseClicked( 0 ) ) m_flameGraph.focus = path;
+    }
+
+    int maxdepth = depth + 1;
+    for( auto& v : item.children )
+    {
+        const auto d = DrawFlameGraphItem( v, wpos, x, pxns, depth + 1, path );
+        if( d > maxdepth ) maxdepth = d;
+        x += v.time * pxns;
+    }
+    path.pop_back();
+    return maxdepth;
+}
+
+void View::CalcFlameGraph( int64_t rangeMin, int64_t rangeMax )
+{
+    auto& data = m_flameGraph.pending;
+    const auto threadNum = m_flameGraph.progressTotal;
+    for( uint32_t i=0; i<threadNum; i++ )
+    {
+        if( m_flameGraph.abort.load( std::memory_order_relaxed ) ) return;
+        {
+            std::shared_lock<std::shared_mutex> lock( m_worker.GetDataLock() );
+            BuildFlameGraph( data, m_worker.GetThreadData()[i]->timeline, rangeMin, rangeMax );
+        }
+        m_flameGraph.progress.fetch_add( 1, std::memory_order_relaxed );
+    }
+    if( m_flameGraph.abort.load( std::memory_order_relaxed ) ) return;
+    SortFlameGraph( data );
+    m_flameGraph.ready.store( true, std::memory_order_release );
+}
+
+void View::BuildFlameGraph( std::vector<FlameGraphItem>& data, const Vector<short_ptr<ZoneEvent>>& zones, int64_t rangeMin, int64_t rangeMax )
+{
+    if( zones.is_magic() )
+    {
+        BuildFlameGraphImpl<VectorAdapterDirect<ZoneEvent>>( data, *(Vector<ZoneEvent>*)( &zones ), rangeMin, rangeMax );
+    }
+    else
+    {
+        BuildFlameGraphImpl<VectorAdapterPointer<ZoneEvent>>( data, zones, rangeMin, rangeMax );
+    }
+}
+
+template<typename Adapter, typename V>
+void View::BuildFlameGraphImpl( std::vector<FlameGraphItem>& data, const V& zones, int64_t rangeMin, int64_t rangeMax )
+{
+    // cast to uint64_t, so that unended zones (end = -1) are still included
+    auto it = std::lower_bound( zones.begin(), zones.end(), rangeMin, [] ( const auto& l, const auto& r ) { Adapter a; return (uint64_t)a(l).End() < (uint64_t)r; } );
+    if( it == zones.end() ) return;
+    const auto zitend = std::lower_bound( it, zones.end(), rangeMax, [] ( const auto& l, const auto& r ) { Adapter a; return a(l).Start() < r; } );
+
+    Adapter a;
+    while( it < zitend )
+    {
+        if( m_flameGraph.abort.load( std::memory_order_relaxed ) ) return;
+        auto& ev = a(*it);
+        const auto start = std::max( ev.Start(), rangeMin );
+        const auto end = std::min( m_worker.GetZoneEnd( ev ), rangeMax );
+        if( end >= start )
+        {
+            const auto srcloc = ev.SrcLoc();
+            auto dit = std::find_if( data.begin(), data.end(), [srcloc] ( const auto& v ) { return v.srcloc == srcloc; } );
+            if( dit == data.end() )
+            {
+                data.emplace_back( FlameGraphItem { srcloc, 0, 0, {} } );
+                dit = data.end() - 1;
+            }
+            dit->time += end - start;
+            dit->count++;
+            if( ev.HasChildren() ) BuildFlameGraph( dit->children, m_worker.GetZoneChildren( ev.Child() ), rangeMin, rangeMax );
+        }
+        ++it;
+    }
+}
+
+void View::SortFlameGraph( std::vector<FlameGraphItem>& data )
+{
+    pdqsort_branchless( data.begin(), data.end(), [] ( const auto& lhs, const auto& rhs ) { return lhs.time > rhs.time; } );
+    for( auto& v : data ) SortFlameGraph( v.children );
+}
 #endif
 
 void View::SmallCallstackButton( const char* name, uint32_t callstack, int& idx, bool tooltip )
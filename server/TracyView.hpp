@@ -14,6 +14,8 @@
 #include "TracyDecayValue.hpp"
 #include "TracyImGui.hpp"
 #include "TracyShortPtr.hpp"
+#include "TracyStringSearch.hpp"
+#include "TracyTaskDispatch.hpp"
 #include "TracyTexture.hpp"
 #include "TracyUserData.hpp"
 #include "TracyVector.hpp"
@@ -108,6 +110,14 @@ private:
 
     enum { InvalidId = 0xFFFFFFFF };
 
+    struct FlameGraphItem
+    {
+        int16_t srcloc;
+        int64_t time;
+        uint64_t count;
+        std::vector<FlameGraphItem> children;
+    };
+
     struct PathData
     {
         uint32_t cnt;
@@ -129,6 +139,7 @@ private:
     void DrawZones();
     void DrawContextSwitches( const ContextSwitch* ctx, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int endOffset );
     void DrawSamples( const Vector<SampleData>& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset );
+    int DrawZoneAggregates( const Vector<ZoneAggregateTrack>& tracks, bool hover, double pxns, const ImVec2& wpos, int offset, float yMin, float yMax );
 #ifndef TRACY_NO_STATISTICS
     int DispatchGhostLevel( const Vector<GhostZone>& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, float yMin, float yMax, uint64_t tid );
     int DrawGhostLevel( const Vector<GhostZone>& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, float yMin, float yMax, uint64_t tid );
@@ -136,9 +147,9 @@ private:
 #endif
     int DispatchZoneLevel( const Vector<short_ptr<ZoneEvent>>& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, float yMin, float yMax, uint64_t tid );
     template<typename Adapter, typename V>
-    int DrawZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, float yMin, float yMax, uint64_t tid );
+    int DrawZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, float yMin, float yMax, uint64_t tid, const ZoneColumns* cols );
     template<typename Adapter, typename V>
-    int SkipZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, float yMin, float yMax, uint64_t tid );
+    int SkipZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, float yMin, float yMax, uint64_t tid, const ZoneColumns* cols );
     int DispatchGpuZoneLevel( const Vector<short_ptr<GpuEvent>>& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, uint64_t thread, float yMin, float yMax, int64_t begin, int drift );
     template<typename Adapter, typename V>
     int DrawGpuZoneLevel( const V& vec, bool hover, double pxns, int64_t nspx, const ImVec2& wpos, int offset, int depth, uint64_t thread, float yMin, float yMax, int64_t begin, int drift );
@@ -152,11 +163,15 @@ private:
     int DrawCpuData( int offset, double pxns, const ImVec2& wpos, bool hover, float yMin, float yMax );
     void DrawOptions();
     void DrawMessages();
+    void UpdateMessageList();
     void DrawFindZone();
     void DrawStatistics();
+    void DrawZoneThrottlePopup( int16_t srcloc );
+    void ZoneAggregateTooltip( int16_t srcloc );
     void DrawMemory();
     void DrawAllocList();
     void DrawCompare();
+    void DrawCompareDiff();
     void DrawCallstackWindow();
     void DrawMemoryAllocWindow();
     void DrawInfo();
@@ -168,6 +183,8 @@ private:
     void DrawSelectedAnnotation();
     void DrawAnnotationList();
     void DrawSampleParents();
+    void DrawFlameGraph();
+    int DrawFlameGraphItem( const FlameGraphItem& item, const ImVec2& wpos, double x, double pxns, int depth, std::vector<int16_t>& path );
 
     void ListMemData( std::vector<const MemEvent*>& vec, std::function<void(const MemEvent*)> DrawAddress, const char* id = nullptr, int64_t startTime = -1 );
 
@@ -231,8 +248,16 @@ private:
 #ifndef TRACY_NO_STATISTICS
     void FindZones();
     void FindZonesCompare();
+    void CalcCompareDiff();
+    bool ExportCompareDiff( const char* fn );
 #endif
 
+    void CalcFlameGraph( int64_t rangeMin, int64_t rangeMax );
+    void BuildFlameGraph( std::vector<FlameGraphItem>& data, const Vector<short_ptr<ZoneEvent>>& zones, int64_t rangeMin, int64_t rangeMax );
+    template<typename Adapter, typename V>
+    void BuildFlameGraphImpl( std::vector<FlameGraphItem>& data, const V& zones, int64_t rangeMin, int64_t rangeMax );
+    static void SortFlameGraph( std::vector<FlameGraphItem>& data );
+
     std::vector<MemoryPage> GetMemoryPages() const;
     const char* GetPlotName( const PlotData* plot ) const;
 
@@ -323,9 +348,12 @@ private:
     int m_frameHover = -1;
     bool m_messagesScrollBottom;
     ImGuiTextFilter m_messageFilter;
+    StringFilter m_messageSearch;
+    Vector<uint32_t> m_msgList;
+    size_t m_msgListProcessed = 0;
+    const MessageData* m_msgListLast = nullptr;
     bool m_showMessageImages = false;
     ImGuiTextFilter m_statisticsFilter;
-    int m_visibleMessages = 0;
     bool m_disconnectIssued = false;
     DecayValue<uint64_t> m_drawThreadMigrations = 0;
     DecayValue<uint64_t> m_drawThreadHighlight = 0;
@@ -364,6 +392,8 @@ private:
     bool m_statSampleTime = true;
     int m_statMode = 0;
     int m_statSampleLocation = 2;
+    int m_zoneThrottleMode = 0;
+    int m_zoneThrottleValue = 10;
     bool m_statHideUnknown = true;
     bool m_showAllSymbols = false;
     int m_showCallstackFrameAddress = 0;
@@ -415,7 +445,7 @@ private:
     };
 
     std::atomic<SaveThreadState> m_saveThreadState { SaveThreadState::Inert };
-    std::thread m_saveThread;
+    TaskGroup m_saveTask;
     std::atomic<size_t> m_srcFileBytes { 0 };
     std::atomic<size_t> m_dstFileBytes { 0 };
 
@@ -561,6 +591,17 @@ private:
         double v1;
     };
 
+    struct CompDiff
+    {
+        const char* name;
+        int16_t srcloc[2];
+        size_t count[2];
+        double mean[2];
+        int64_t median[2];
+        int64_t p99[2];
+        double pValue;
+    };
+
     struct {
         bool show = false;
         bool ignoreCase = false;
@@ -585,6 +626,23 @@ private:
         int64_t total[2];
         int minBinVal = 1;
         int compareMode = 0;
+        TaskGroup diffTask;
+        bool diffRunning = false;
+        std::atomic<bool> diffReady { false };
+        std::atomic<bool> diffAbort { false };
+        std::vector<CompDiff> diff;
+        int diffSort = 0;
+
+        void AbortDiff()
+        {
+            diffAbort.store( true, std::memory_order_relaxed );
+            diffTask.Cancel();
+            diffTask.Wait();
+            diffRunning = false;
+            diffAbort.store( false, std::memory_order_relaxed );
+            diffReady.store( false, std::memory_order_relaxed );
+            diff.clear();
+        }
 
         void ResetSelection()
         {
@@ -609,6 +667,40 @@ private:
         }
     } m_compare;
 
+    struct {
+        enum { CacheSize = 8 };
+        enum { FullRangeInterval = 2 };     // seconds between updates of a growing full range
+
+        bool show = false;
+        bool limitRange = false;
+        int64_t rangeMin = 0;
+        int64_t rangeMax = 0;
+        TaskGroup task;
+        bool running = false;
+        std::atomic<bool> ready { false };
+        std::atomic<bool> abort { false };
+        std::atomic<uint32_t> progress { 0 };
+        uint32_t progressTotal = 0;
+        std::pair<int64_t, int64_t> pendingRange;
+        bool pendingFull = false;
+        int64_t fullRangeEnd = -1;
+        double fullRangeTime = 0;
+        std::vector<FlameGraphItem> pending;
+        std::vector<std::pair<std::pair<int64_t, int64_t>, std::vector<FlameGraphItem>>> cache;
+        std::vector<int16_t> focus;
+
+        void Abort()
+        {
+            abort.store( true, std::memory_order_relaxed );
+            task.Cancel();
+            task.Wait();
+            running = false;
+            abort.store( false, std::memory_order_relaxed );
+            ready.store( false, std::memory_order_relaxed );
+            pending.clear();
+        }
+    } m_flameGraph;
+
     struct {
         bool show = false;
         char pattern[1024] = {};
@@ -10,6 +10,7 @@
 
 #include <cctype>
 #include <chrono>
+#include <math.h>
 #include <string.h>
 #include <inttypes.h>
 
@@ -19,6 +20,7 @@
 #include "../common/TracySystem.hpp"
 #include "TracyFileRead.hpp"
 #include "TracyFileWrite.hpp"
+#include "TracyPackedCpuData.hpp"
 #include "TracySort.hpp"
 #include "TracyTaskDispatch.hpp"
 #include "TracyVersion.hpp"
@@ -229,7 +231,7 @@ static tracy_force_inline void UpdateLockRange( LockMap& lockmap, const LockEven
 
 LoadProgress Worker::s_loadProgress;
 
-Worker::Worker( const char* addr, int port )
+Worker::Worker( const char* addr, int port, int recvFrames )
     : m_addr( addr )
     , m_port( port )
     , m_hasData( false )
@@ -254,6 +256,10 @@ Worker::Worker( const char* addr, int port )
 
     memset( m_gpuCtxMap, 0, sizeof( m_gpuCtxMap ) );
 
+    m_recvFrames = std::max( recvFrames, 1 );
+    m_recvBuffer = new char[size_t( m_recvFrames ) * LZ4Size];
+    m_recvSize.resize( m_recvFrames );
+
 #ifndef TRACY_NO_STATISTICS
     m_data.sourceLocationZonesReady = true;
     m_data.callstackSamplesReady = true;
@@ -263,6 +269,7 @@ Worker::Worker( const char* addr, int port )
 
     m_thread = std::thread( [this] { SetThreadName( "Tracy Worker" ); Exec(); } );
     m_threadNet = std::thread( [this] { SetThreadName( "Tracy Network" ); Network(); } );
+    m_threadDecompress = std::thread( [this] { SetThreadName( "Tracy Decompress" ); Decompress(); } );
 }
 
 Worker::Worker( const std::string& program, const std::vector<ImportEventTimeline>& timeline, const std::vector<ImportEventMessages>& messages )
@@ -389,7 +396,7 @@ Worker::Worker( const std::string& program, const std::vector<ImportEventTimelin
     m_data.framesBase->frames.push_back( FrameEvent{ 0, -1, -1 } );
 }
 
-Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
+Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks, const LoadFilter& filter )
     : m_hasData( true )
     , m_stream( nullptr )
     , m_buffer( nullptr )
@@ -421,6 +428,7 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
         throw LegacyVersion( FileVersion( 0, 2, 0 ) );
     }
     m_traceVersion = fileVer;
+    const bool filterActive = filter.IsActive() && fileVer >= FileVersion( 0, 6, 12 );
 
     if( fileVer == FileVersion( 0, 5, 0 ) )
     {
@@ -460,6 +468,10 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
     {
         f.Read( m_data.cpuArch );
     }
+    if( fileVer >= FileVersion( 0, 6, 14 ) )
+    {
+        f.Read( m_data.memory.sampleInterval );
+    }
 
     uint64_t sz;
     {
@@ -588,18 +600,36 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
     unordered_flat_map<uint64_t, const char*> pointerMap;
 
     f.Read( sz );
-    m_data.stringMap.reserve( sz );
-    m_data.stringData.reserve_exact( sz, m_slab );
-    for( uint64_t i=0; i<sz; i++ )
+    m_data.stringData.ReserveExact( sz, m_slab );
+    if( fileVer >= FileVersion( 0, 6, 18 ) )
+    {
+        const char* prev = nullptr;
+        for( uint64_t i=0; i<sz; i++ )
+        {
+            uint64_t ptr;
+            uint32_t shared, ssz;
+            f.Read3( ptr, shared, ssz );
+            auto dst = m_slab.Alloc<char>( shared+ssz+1 );
+            if( shared != 0 ) memcpy( dst, prev, shared );
+            f.Read( dst+shared, ssz );
+            dst[shared+ssz] = '\0';
+            m_data.stringData.Set( i, dst );
+            pointerMap.emplace( ptr, dst );
+            prev = dst;
+        }
+    }
+    else
     {
-        uint64_t ptr, ssz;
-        f.Read2( ptr, ssz );
-        auto dst = m_slab.Alloc<char>( ssz+1 );
-        f.Read( dst, ssz );
-        dst[ssz] = '\0';
-        m_data.stringMap.emplace( charutil::StringKey { dst, ssz }, i );
-        m_data.stringData[i] = ( dst );
-        pointerMap.emplace( ptr, dst );
+        for( uint64_t i=0; i<sz; i++ )
+        {
+            uint64_t ptr, ssz;
+            f.Read2( ptr, ssz );
+            auto dst = m_slab.Alloc<char>( ssz+1 );
+            f.Read( dst, ssz );
+            dst[ssz] = '\0';
+            m_data.stringData.Set( i, dst );
+            pointerMap.emplace( ptr, dst );
+        }
     }
 
     f.Read( sz );
@@ -674,9 +704,67 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
         m_data.sourceLocationPayload[i] = srcloc;
         m_data.sourceLocationPayloadMap.emplace( srcloc, int16_t( i ) );
     }
+    const auto slp = sz;
+
+    if( fileVer >= FileVersion( 0, 6, 15 ) )
+    {
+        // Throttling counts cannot be attributed to a subset of the trace.
+        f.Read( sz );
+        for( uint64_t i=0; i<sz; i++ )
+        {
+            int16_t id;
+            uint64_t cnt;
+            f.Read2( id, cnt );
+            if( !filterActive ) m_data.zonesDropped.emplace( id, cnt );
+        }
+    }
+
+    if( fileVer >= FileVersion( 0, 6, 17 ) )
+    {
+        f.Read( sz );
+        for( uint64_t i=0; i<sz; i++ )
+        {
+            DataLossRange v;
+            f.Read6( v.start, v.end, v.callstacks, v.zones, v.other, v.level );
+            if( filterActive && ( v.start > filter.timeMax || ( v.end >= 0 && v.end < filter.timeMin ) ) ) continue;
+            m_data.dataLoss.push_back( v );
+        }
+    }
+
+    unordered_flat_set<uint64_t> threadFilter;
+    unordered_flat_set<int16_t> zoneFilter;
+    if( filterActive )
+    {
+        for( auto& v : filter.threads ) threadFilter.emplace( v );
+        if( !filter.zones.empty() )
+        {
+            auto MatchZone = [this, &filter, &zoneFilter] ( const SourceLocation& srcloc, int16_t id ) {
+                const auto name = GetZoneName( srcloc );
+                for( auto& v : filter.zones )
+                {
+                    if( v == name )
+                    {
+                        zoneFilter.emplace( id );
+                        break;
+                    }
+                }
+            };
+            for( uint64_t i=1; i<sle; i++ )
+            {
+                auto it = m_data.sourceLocation.find( m_data.sourceLocationExpand[i] );
+                if( it != m_data.sourceLocation.end() ) MatchZone( it->second, int16_t( i ) );
+            }
+            for( uint64_t i=0; i<slp; i++ )
+            {
+                MatchZone( *m_data.sourceLocationPayload[i], -int16_t( i + 1 ) );
+            }
+            // Nothing matches, but an empty set would mean "no zone filter".
+            if( zoneFilter.empty() ) zoneFilter.emplace( std::numeric_limits<int16_t>::min() );
+        }
+    }
 
 #ifndef TRACY_NO_STATISTICS
-    m_data.sourceLocationZones.reserve( sle + sz );
+    m_data.sourceLocationZones.reserve( sle + slp );
 
     f.Read( sz );
     if( fileVer >= FileVersion( 0, 5, 2 ) )
@@ -688,7 +776,7 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
             f.Read2( id, cnt );
             auto status = m_data.sourceLocationZones.emplace( id, SourceLocationZones() );
             assert( status.second );
-            status.first->second.zones.reserve( cnt );
+            if( !filterActive ) status.first->second.zones.reserve( cnt );
         }
     }
     else
@@ -778,6 +866,14 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
                 lockmap.threadList.emplace_back( t );
             }
             f.Read( tsz );
+            if( filterActive )
+            {
+                ReadLockTimelineFiltered( f, lockmap, tsz, filter );
+                if( lockmap.timeline.empty() ) continue;
+                UpdateLockCount( lockmap, 0 );
+                m_data.lockMap.emplace( id, lockmapPtr );
+                continue;
+            }
             lockmap.timeline.reserve_exact( tsz, m_slab );
             auto ptr = lockmap.timeline.data();
             if( fileVer >= FileVersion( 0, 5, 2 ) )
@@ -889,8 +985,31 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
     s_loadProgress.subTotal.store( 0, std::memory_order_relaxed );
     s_loadProgress.progress.store( LoadProgress::Messages, std::memory_order_relaxed );
     unordered_flat_map<uint64_t, MessageData*> msgMap;
+    std::vector<std::pair<uint64_t, MessageData*>> msgFiltered;
     f.Read( sz );
-    if( eventMask & EventType::Messages )
+    if( ( eventMask & EventType::Messages ) && filterActive )
+    {
+        int64_t refTime = 0;
+        for( uint64_t i=0; i<sz; i++ )
+        {
+            uint64_t ptr;
+            f.Read( ptr );
+            const auto time = ReadTimeOffset( f, refTime );
+            if( time >= filter.timeMin && time <= filter.timeMax )
+            {
+                auto msgdata = m_slab.Alloc<MessageData>();
+                msgdata->time = time;
+                f.Read3( msgdata->ref, msgdata->color, msgdata->callstack );
+                msgFiltered.emplace_back( ptr, msgdata );
+                msgMap.emplace( ptr, msgdata );
+            }
+            else
+            {
+                f.Skip( sizeof( MessageData::ref ) + sizeof( MessageData::color ) + sizeof( MessageData::callstack ) );
+            }
+        }
+    }
+    else if( eventMask & EventType::Messages )
     {
         m_data.messages.reserve_exact( sz, m_slab );
         if( fileVer >= FileVersion( 0, 5, 12 ) )
@@ -974,14 +1093,46 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
     }
     int32_t childIdx = 0;
     f.Read( sz );
-    m_data.threads.reserve_exact( sz, m_slab );
+    std::vector<ThreadData*> threadsFiltered;
+    if( !filterActive ) m_data.threads.reserve_exact( sz, m_slab );
     for( uint64_t i=0; i<sz; i++ )
     {
+        uint64_t tid, tcnt;
+        f.Read2( tid, tcnt );
+        if( !threadFilter.empty() && threadFilter.find( tid ) == threadFilter.end() )
+        {
+            uint32_t tsz;
+            f.Read( tsz );
+            if( tsz != 0 ) SkipTimeline( f, tsz );
+            uint64_t msz;
+            f.Read( msz );
+            for( uint64_t j=0; j<msz; j++ )
+            {
+                uint64_t ptr;
+                f.Read( ptr );
+                msgMap.erase( ptr );
+            }
+            uint64_t ssz;
+            f.Read( ssz );
+            f.Skip( ssz * ( 8 + 3 ) );
+            if( fileVer >= FileVersion( 0, 6, 16 ) )
+            {
+                uint64_t asz;
+                f.Read( asz );
+                for( uint64_t j=0; j<asz; j++ )
+                {
+                    int16_t srcloc;
+                    uint64_t dsz;
+                    f.Read2( srcloc, dsz );
+                    f.Skip( dsz * sizeof( ZoneAggregate ) );
+                }
+            }
+            continue;
+        }
+
         auto td = m_slab.AllocInit<ThreadData>();
-        uint64_t tid;
-        f.Read2( tid, td->count );
         td->id = tid;
-        m_data.zonesCnt += td->count;
+        td->count = tcnt;
         if( fileVer < FileVersion( 0, 6, 3 ) )
         {
             uint64_t tsz;
@@ -998,12 +1149,45 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
             f.Read( tsz );
             if( tsz != 0 )
             {
-                ReadTimeline( f, td->timeline, tsz, 0, childIdx );
+                if( filterActive )
+                {
+                    td->count -= ReadTimelineFiltered( f, td->timeline, tsz, childIdx, filter, zoneFilter );
+                }
+                else if( fileVer >= FileVersion( 0, 6, 12 ) )
+                {
+                    ReadTimeline( f, td->timeline, tsz, 0, childIdx );
+                }
+                else
+                {
+                    ReadTimelinePre0612( f, td->timeline, tsz, 0, childIdx );
+                }
             }
         }
+        m_data.zonesCnt += td->count;
         uint64_t msz;
         f.Read( msz );
-        if( eventMask & EventType::Messages )
+        if( ( eventMask & EventType::Messages ) && filterActive )
+        {
+            const auto ctid = CompressThread( tid );
+            std::vector<MessageData*> msgs;
+            for( uint64_t j=0; j<msz; j++ )
+            {
+                uint64_t ptr;
+                f.Read( ptr );
+                auto it = msgMap.find( ptr );
+                if( it != msgMap.end() )
+                {
+                    it->second->thread = ctid;
+                    msgs.emplace_back( it->second );
+                }
+            }
+            if( !msgs.empty() )
+            {
+                td->messages.reserve_exact( msgs.size(), m_slab );
+                for( size_t j=0; j<msgs.size(); j++ ) td->messages[j] = msgs[j];
+            }
+        }
+        else if( eventMask & EventType::Messages )
         {
             const auto ctid = CompressThread( tid );
             td->messages.reserve_exact( msz, m_slab );
@@ -1026,7 +1210,32 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
             f.Read( ssz );
             if( ssz != 0 )
             {
-                if( eventMask & EventType::Samples )
+                if( ( eventMask & EventType::Samples ) && filterActive )
+                {
+                    std::vector<SampleData> samples;
+                    int64_t refTime = 0;
+                    for( uint64_t j=0; j<ssz; j++ )
+                    {
+                        const auto time = ReadTimeOffset( f, refTime );
+                        if( time >= filter.timeMin && time <= filter.timeMax )
+                        {
+                            auto& sd = samples.emplace_back();
+                            sd.time.SetVal( time );
+                            f.Read( &sd.callstack, sizeof( sd.callstack ) );
+                        }
+                        else
+                        {
+                            f.Skip( sizeof( SampleData::callstack ) );
+                        }
+                    }
+                    if( !samples.empty() )
+                    {
+                        m_data.samplesCnt += samples.size();
+                        td->samples.reserve_exact( samples.size(), m_slab );
+                        memcpy( td->samples.data(), samples.data(), samples.size() * sizeof( SampleData ) );
+                    }
+                }
+                else if( eventMask & EventType::Samples )
                 {
                     m_data.samplesCnt += ssz;
                     int64_t refTime = 0;
@@ -1045,9 +1254,71 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
                 }
             }
         }
-        m_data.threads[i] = td;
+        if( fileVer >= FileVersion( 0, 6, 16 ) )
+        {
+            uint64_t asz;
+            f.Read( asz );
+            for( uint64_t j=0; j<asz; j++ )
+            {
+                int16_t srcloc;
+                uint64_t dsz;
+                f.Read2( srcloc, dsz );
+                if( !zoneFilter.empty() && zoneFilter.find( srcloc ) == zoneFilter.end() )
+                {
+                    f.Skip( dsz * sizeof( ZoneAggregate ) );
+                    continue;
+                }
+                std::vector<ZoneAggregate> data;
+                data.reserve( dsz );
+                for( uint64_t k=0; k<dsz; k++ )
+                {
+                    ZoneAggregate agg;
+                    f.Read( &agg, sizeof( agg ) );
+                    // Summaries crossing the time range limits can't be split.
+                    if( agg.start < filter.timeMin || agg.end > filter.timeMax ) continue;
+                    data.emplace_back( agg );
+                    AddZoneAggregateStats( srcloc, agg );
+                }
+                if( data.empty() ) continue;
+                auto& track = td->zoneAggregates.push_next();
+                track.srcloc = srcloc;
+                track.data.reserve_exact( data.size(), m_slab );
+                memcpy( track.data.data(), data.data(), data.size() * sizeof( ZoneAggregate ) );
+            }
+        }
+        if( filterActive )
+        {
+            threadsFiltered.emplace_back( td );
+        }
+        else
+        {
+            m_data.threads[i] = td;
+        }
         m_threadMap.emplace( tid, td );
     }
+    if( filterActive )
+    {
+        if( !threadsFiltered.empty() )
+        {
+            m_data.threads.reserve_exact( threadsFiltered.size(), m_slab );
+            memcpy( m_data.threads.data(), threadsFiltered.data(), threadsFiltered.size() * sizeof( ThreadData* ) );
+        }
+        if( eventMask & EventType::Messages )
+        {
+            // Messages of threads which were filtered out are no longer in the map.
+            size_t msz = 0;
+            for( auto& v : msgFiltered ) if( msgMap.find( v.first ) != msgMap.end() ) msz++;
+            if( msz != 0 )
+            {
+                m_data.messages.reserve_exact( msz, m_slab );
+                size_t idx = 0;
+                for( auto& v : msgFiltered )
+                {
+                    if( msgMap.find( v.first ) != msgMap.end() ) m_data.messages[idx++] = v.second;
+                }
+            }
+        }
+    }
 
     s_loadProgress.progress.store( LoadProgress::GpuZones, std::memory_order_relaxed );
     f.Read( sz );
@@ -1151,6 +1422,33 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
             }
             uint64_t psz;
             f.Read4( pd->name, pd->min, pd->max, psz );
+            if( filterActive )
+            {
+                std::vector<PlotItem> data;
+                double min = std::numeric_limits<double>::max();
+                double max = std::numeric_limits<double>::lowest();
+                int64_t refTime = 0;
+                for( uint64_t j=0; j<psz; j++ )
+                {
+                    int64_t t;
+                    double val;
+                    f.Read2( t, val );
+                    refTime += t;
+                    if( refTime < filter.timeMin || refTime > filter.timeMax ) continue;
+                    auto& item = data.emplace_back();
+                    item.time = refTime;
+                    item.val = val;
+                    if( min > val ) min = val;
+                    if( max < val ) max = val;
+                }
+                if( data.empty() ) continue;
+                pd->min = min;
+                pd->max = max;
+                pd->data.reserve_exact( data.size(), m_slab );
+                memcpy( pd->data.data(), data.data(), data.size() * sizeof( PlotItem ) );
+                m_data.plots.Data().push_back_no_space_check( pd );
+                continue;
+            }
             pd->data.reserve_exact( psz, m_slab );
             if( fileVer >= FileVersion( 0, 5, 2 ) )
             {
@@ -1200,7 +1498,58 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
     s_loadProgress.subTotal.store( 0, std::memory_order_relaxed );
     s_loadProgress.progress.store( LoadProgress::Memory, std::memory_order_relaxed );
     f.Read( sz );
-    if( eventMask & EventType::Memory )
+    if( ( eventMask & EventType::Memory ) && filterActive )
+    {
+        uint64_t activeSz, freesSz;
+        f.Read2( activeSz, freesSz );
+        s_loadProgress.subTotal.store( sz, std::memory_order_relaxed );
+        // Allocations are kept if their lifetime overlaps the time range.
+        std::vector<MemEvent> data;
+        std::vector<uint32_t> frees;
+        auto& active = m_data.memory.active;
+        int64_t refTime = 0;
+        for( uint64_t i=0; i<sz; i++ )
+        {
+            s_loadProgress.subProgress.store( i, std::memory_order_relaxed );
+            uint64_t ptr, size;
+            Int24 csAlloc, csFree;
+            int64_t timeAlloc, timeFree;
+            uint16_t threadAlloc, threadFree;
+            f.Read8( ptr, size, csAlloc, csFree, timeAlloc, timeFree, threadAlloc, threadFree );
+            refTime += timeAlloc;
+            if( refTime > filter.timeMax || ( timeFree >= 0 && timeFree + refTime < filter.timeMin ) ) continue;
+            const auto idx = uint32_t( data.size() );
+            auto& mem = data.emplace_back();
+            mem.SetPtr( ptr );
+            mem.SetSize( size );
+            mem.SetCsAlloc( csAlloc.Val() );
+            mem.csFree = csFree;
+            mem.SetTimeThreadAlloc( refTime, threadAlloc );
+            if( timeFree >= 0 )
+            {
+                mem.SetTimeThreadFree( timeFree + refTime, threadFree );
+                frees.emplace_back( idx );
+            }
+            else
+            {
+                mem.SetTimeThreadFree( timeFree, threadFree );
+                active.emplace( ptr, idx );
+            }
+        }
+        if( !data.empty() )
+        {
+            m_data.memory.data.reserve_exact( data.size(), m_slab );
+            memcpy( m_data.memory.data.data(), data.data(), data.size() * sizeof( MemEvent ) );
+            reconstructMemAllocPlot = true;
+        }
+        if( !frees.empty() )
+        {
+            m_data.memory.frees.reserve_exact( frees.size(), m_slab );
+            memcpy( m_data.memory.frees.data(), frees.data(), frees.size() * sizeof( uint32_t ) );
+        }
+        f.Read3( m_data.memory.high, m_data.memory.low, m_data.memory.usage );
+    }
+    else if( eventMask & EventType::Memory )
     {
         m_data.memory.data.reserve_exact( sz, m_slab );
         uint64_t activeSz, freesSz;
@@ -1481,8 +1830,8 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
 
             // Leave one thread for file reader, second thread for dispatch (this thread)
             // Minimum 2 threads to have at least two buffers (one in use, second one filling up)
-            const auto jobs = std::max<int>( std::thread::hardware_concurrency() - 2, 2 );
-            auto td = std::make_unique<TaskDispatch>( jobs );
+            const auto jobs = std::max<int>( int( TaskDispatch::Get().NumWorkers() ) - 2, 2 );
+            TaskGroup group;
             auto data = std::make_unique<JobData[]>( jobs );
 
             for( uint64_t i=0; i<sz; i++ )
@@ -1511,7 +1860,7 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
                         }
                     }
                     if( idx >= 0 ) break;
-                    YieldThread();
+                    if( !group.RunPending() ) YieldThread();
                 }
 
                 if( data[idx].bufsz < sz )
@@ -1524,7 +1873,7 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
                 data[idx].fi = fi;
 
                 data[idx].state.store( JobData::InProgress, std::memory_order_release );
-                td->Queue( [this, &data, idx, fi, fileVer] {
+                group.Run( [this, &data, idx, fi, fileVer] {
                     if( fileVer <= FileVersion( 0, 6, 9 ) ) m_texcomp.Rdo( data[idx].buf, fi->w * fi->h / 16 );
                     fi->csz = m_texcomp.Pack( data[idx].ctx, data[idx].outbuf, data[idx].outsz, data[idx].buf, fi->w * fi->h / 2 );
                     data[idx].state.store( JobData::DataReady, std::memory_order_release );
@@ -1532,8 +1881,7 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
 
                 m_data.frameImage[i] = fi;
             }
-            td->Sync();
-            td.reset();
+            group.Wait();
             for( int i=0; i<jobs; i++ )
             {
                 if( data[i].state.load( std::memory_order_acquire ) == JobData::DataReady )
@@ -1588,6 +1936,42 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
                 s_loadProgress.subProgress.store( i, std::memory_order_relaxed );
                 uint64_t thread, csz;
                 f.Read2( thread, csz );
+                if( !threadFilter.empty() && threadFilter.find( thread ) == threadFilter.end() )
+                {
+                    f.Skip( csz * ( sizeof( int64_t ) * 3 + sizeof( int8_t ) * 3 ) );
+                    continue;
+                }
+                if( filterActive )
+                {
+                    std::vector<ContextSwitchData> cs;
+                    int64_t runningTime = 0;
+                    int64_t refTime = 0;
+                    for( uint64_t j=0; j<csz; j++ )
+                    {
+                        int64_t deltaWakeup, deltaStart, diff;
+                        uint8_t cpu;
+                        int8_t reason, state;
+                        f.Read6( deltaWakeup, deltaStart, diff, cpu, reason, state );
+                        refTime += deltaWakeup;
+                        const auto wakeup = refTime;
+                        refTime += deltaStart;
+                        const auto start = refTime;
+                        refTime += diff;
+                        if( wakeup > filter.timeMax || ( refTime >= 0 && refTime < filter.timeMin ) ) continue;
+                        auto& item = cs.emplace_back();
+                        item.SetWakeup( wakeup );
+                        item.SetStartCpu( start, cpu );
+                        item.SetEndReasonState( refTime, reason, state );
+                        if( diff > 0 ) runningTime += diff;
+                    }
+                    if( cs.empty() ) continue;
+                    auto data = m_slab.AllocInit<ContextSwitch>();
+                    data->v.reserve_exact( cs.size(), m_slab );
+                    memcpy( data->v.data(), cs.data(), cs.size() * sizeof( ContextSwitchData ) );
+                    data->runningTime = runningTime;
+                    m_data.ctxSwitch.emplace( thread, data );
+                    continue;
+                }
                 auto data = m_slab.AllocInit<ContextSwitch>();
                 data->v.reserve_exact( csz, m_slab );
                 int64_t runningTime = 0;
@@ -1637,7 +2021,74 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
             {
                 int64_t refTime = 0;
                 f.Read( sz );
-                if( sz != 0 )
+                if( filterActive )
+                {
+                    std::vector<ContextSwitchCpu> data;
+                    for( uint64_t j=0; j<sz; j++ )
+                    {
+                        int64_t deltaStart, deltaEnd;
+                        uint16_t thread;
+                        f.Read3( deltaStart, deltaEnd, thread );
+                        refTime += deltaStart;
+                        const auto start = refTime;
+                        refTime += deltaEnd;
+                        if( start > filter.timeMax || ( refTime >= 0 && refTime < filter.timeMin ) ) continue;
+                        auto& item = data.emplace_back();
+                        item.SetStartThread( start, thread );
+                        item.SetEnd( refTime );
+                    }
+                    cnt += sz;
+                    s_loadProgress.subProgress.store( cnt, std::memory_order_relaxed );
+                    if( data.empty() ) continue;
+                    m_data.cpuDataCount = i+1;
+                    auto& cpu = m_data.cpuData[i];
+                    const auto dsz = data.size();
+                    if( dsz >= PackCpuDataMin )
+                    {
+                        cpu.packed.reserve_exact( ( dsz + PackedCpuChunkSize - 1 ) / PackedCpuChunkSize, m_slab );
+                        cpu.packedSize = dsz;
+                        size_t j = 0;
+                        for( auto& chunk : cpu.packed )
+                        {
+                            const auto csz = std::min<size_t>( dsz - j, PackedCpuChunkSize );
+                            PackCpuChunk( chunk, data.data() + j, csz, m_slab );
+                            j += csz;
+                        }
+                    }
+                    else
+                    {
+                        cpu.cs.reserve_exact( dsz, m_slab );
+                        memcpy( cpu.cs.data(), data.data(), dsz * sizeof( ContextSwitchCpu ) );
+                    }
+                }
+                else if( sz >= PackCpuDataMin )
+                {
+                    // Large context switch timelines are kept packed in memory.
+                    m_data.cpuDataCount = i+1;
+                    auto& cpu = m_data.cpuData[i];
+                    cpu.packed.reserve_exact( ( sz + PackedCpuChunkSize - 1 ) / PackedCpuChunkSize, m_slab );
+                    cpu.packedSize = sz;
+                    ContextSwitchCpu tmp[PackedCpuChunkSize];
+                    uint64_t j = 0;
+                    for( auto& chunk : cpu.packed )
+                    {
+                        const auto csz = std::min<uint64_t>( sz - j, PackedCpuChunkSize );
+                        for( uint64_t k=0; k<csz; k++ )
+                        {
+                            int64_t deltaStart, deltaEnd;
+                            uint16_t thread;
+                            f.Read3( deltaStart, deltaEnd, thread );
+                            refTime += deltaStart;
+                            tmp[k].SetStartThread( refTime, thread );
+                            refTime += deltaEnd;
+                            tmp[k].SetEnd( refTime );
+                        }
+                        PackCpuChunk( chunk, tmp, csz, m_slab );
+                        j += csz;
+                    }
+                    cnt += sz;
+                }
+                else if( sz != 0 )
                 {
                     m_data.cpuDataCount = i+1;
                     m_data.cpuData[i].cs.reserve_exact( sz, m_slab );
@@ -1830,6 +2281,117 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
         }
     }
 
+#ifndef TRACY_NO_STATISTICS
+    bool zoneStatsCached = false;
+    bool ctxUsageCached = false;
+    bool freesSorted = false;
+#endif
+    if( fileVer >= FileVersion( 0, 6, 13 ) )
+    {
+        uint8_t hasCache;
+        f.Read( hasCache );
+        if( hasCache )
+        {
+            f.Read( sz );
+#ifndef TRACY_NO_STATISTICS
+            // Zone references are only valid if all zones were loaded.
+            if( !filterActive )
+            {
+                const auto threadCnt = m_data.threads.size();
+                std::vector<uint16_t> threadMap;
+                threadMap.reserve( threadCnt );
+                for( auto& t : m_data.threads ) threadMap.emplace_back( m_data.localThreadCompress.DecompressMustRaw( t->id ) );
+
+                for( uint64_t i=0; i<sz; i++ )
+                {
+                    int16_t srcloc;
+                    uint64_t zsz;
+                    f.Read2( srcloc, zsz );
+                    auto& slz = m_data.sourceLocationZones[srcloc];
+                    f.Read7( slz.min, slz.max, slz.total, slz.sumSq, slz.selfMin, slz.selfMax, slz.selfTotal );
+                    assert( slz.zones.empty() );
+                    slz.zones.reserve_and_use( zsz );
+                    auto ptr = slz.zones.data();
+                    for( uint64_t j=0; j<zsz; j++ )
+                    {
+                        uint32_t vec, idx;
+                        uint16_t thread;
+                        f.Read3( vec, idx, thread );
+                        auto& zones = vec < threadCnt ? m_data.threads[vec]->timeline : m_data.zoneChildren[vec - threadCnt];
+                        assert( zones.is_magic() );
+                        ptr->SetZone( &(*(Vector<ZoneEvent>*)( &zones ))[idx] );
+                        ptr->SetThread( threadMap[thread] );
+                        ptr++;
+                    }
+                }
+                zoneStatsCached = true;
+                m_data.sourceLocationZonesReady = true;
+            }
+            else
+#endif
+            {
+                for( uint64_t i=0; i<sz; i++ )
+                {
+                    uint64_t zsz;
+                    f.Skip( sizeof( int16_t ) );
+                    f.Read( zsz );
+                    f.Skip( sizeof( int64_t ) * 6 + sizeof( double ) + zsz * ( sizeof( uint32_t ) * 2 + sizeof( uint16_t ) ) );
+                }
+            }
+
+            f.Read( sz );
+#ifndef TRACY_NO_STATISTICS
+            if( sz != 0 && ( eventMask & EventType::ContextSwitches ) && !filterActive )
+            {
+                m_data.ctxUsage.reserve_exact( sz, m_slab );
+                f.Read( m_data.ctxUsage.data(), sz * sizeof( ContextSwitchUsage ) );
+                m_data.ctxUsageReady = true;
+                ctxUsageCached = true;
+            }
+            else
+#endif
+            {
+                f.Skip( sz * sizeof( ContextSwitchUsage ) );
+            }
+
+            f.Read( sz );
+#ifndef TRACY_NO_STATISTICS
+            // A size mismatch means the cache doesn't match the memory events,
+            // in which case the order of frees is reconstructed.
+            if( ( eventMask & EventType::Memory ) && !filterActive && sz == m_data.memory.frees.size() )
+            {
+                auto& mem = m_data.memory;
+                f.Read( mem.frees.data(), sz * sizeof( uint32_t ) );
+                freesSorted = true;
+                const auto dsz = mem.data.size();
+                for( auto& v : mem.frees )
+                {
+                    if( v >= dsz || mem.data[v].TimeFree() < 0 )
+                    {
+                        freesSorted = false;
+                        break;
+                    }
+                }
+                if( !freesSorted )
+                {
+                    size_t fidx = 0;
+                    for( size_t i=0; i<dsz && fidx<sz; i++ )
+                    {
+                        if( mem.data[i].TimeFree() >= 0 ) mem.frees[fidx++] = uint32_t( i );
+                    }
+                }
+            }
+            else
+#endif
+            {
+                f.Skip( sz * sizeof( uint32_t ) );
+            }
+        }
+    }
+
+    for( auto& v : m_data.threads ) BuildZoneColumns( v->timeline );
+    for( auto& v : m_data.zoneChildren ) BuildZoneColumns( v );
+
     s_loadProgress.total.store( 0, std::memory_order_relaxed );
     m_loadTime = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::high_resolution_clock::now() - loadStart ).count();
 
@@ -1841,47 +2403,27 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
     {
         m_backgroundDone.store( false, std::memory_order_relaxed );
 #ifndef TRACY_NO_STATISTICS
-        m_threadBackground = std::thread( [this, reconstructMemAllocPlot, eventMask] {
-            std::vector<std::thread> jobs;
+        m_backgroundTasks.Run( [this, reconstructMemAllocPlot, eventMask, zoneStatsCached, ctxUsageCached, freesSorted] {
+            TaskGroup jobs;
 
-            if( !m_data.ctxSwitch.empty() )
+            if( !m_data.ctxSwitch.empty() && !ctxUsageCached )
             {
-                jobs.emplace_back( std::thread( [this] { ReconstructContextSwitchUsage(); } ) );
+                jobs.Run( [this] { ReconstructContextSwitchUsage(); } );
             }
 
             if( reconstructMemAllocPlot )
             {
-                jobs.emplace_back( std::thread( [this] { ReconstructMemAllocPlot(); } ) );
+                jobs.Run( [this, freesSorted] { ReconstructMemAllocPlot( freesSorted ); } );
             }
 
-            std::function<void(Vector<short_ptr<ZoneEvent>>&, uint16_t)> ProcessTimeline;
-            ProcessTimeline = [this, &ProcessTimeline] ( Vector<short_ptr<ZoneEvent>>& _vec, uint16_t thread )
+            if( !zoneStatsCached )
             {
-                if( m_shutdown.load( std::memory_order_relaxed ) ) return;
-                assert( _vec.is_magic() );
-                auto& vec = *(Vector<ZoneEvent>*)( &_vec );
-                for( auto& zone : vec )
-                {
-                    if( zone.IsEndValid() ) ReconstructZoneStatistics( zone, thread );
-                    if( zone.HasChildren() ) ProcessTimeline( GetZoneChildrenMutable( zone.Child() ), thread );
-                }
-            };
-
-            jobs.emplace_back( std::thread( [this, ProcessTimeline] {
-                for( auto& t : m_data.threads )
-                {
-                    if( m_shutdown.load( std::memory_order_relaxed ) ) return;
-                    if( !t->timeline.empty() )
-                    {
-                        // Don't touch thread compression cache in a thread.
-                        ProcessTimeline( t->timeline, m_data.localThreadCompress.DecompressMustRaw( t->id ) );
-                    }
-                }
-            } ) );
+                jobs.Run( [this] { ReconstructZoneStatistics(); } );
+            }
 
             if( eventMask & EventType::Samples )
             {
-                jobs.emplace_back( std::thread( [this] {
+                jobs.Run( [this] {
                     unordered_flat_map<uint32_t, uint32_t> counts;
                     uint32_t total = 0;
                     for( auto& t : m_data.threads ) total += t->samples.size();
@@ -1933,9 +2475,9 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
                     }
                     std::lock_guard<std::shared_mutex> lock( m_data.lock );
                     m_data.callstackSamplesReady = true;
-                } ) );
+                } );
 
-                jobs.emplace_back( std::thread( [this] {
+                jobs.Run( [this] {
                     uint32_t gcnt = 0;
                     for( auto& t : m_data.threads )
                     {
@@ -2033,21 +2575,12 @@ Worker::Worker( FileRead& f, EventType::Type eventMask, bool bgTasks )
                     std::lock_guard<std::shared_mutex> lock( m_data.lock );
                     m_data.ghostZonesReady = true;
                     m_data.ghostCnt = gcnt;
-                } ) );
+                } );
             }
 
-            for( auto& job : jobs ) job.join();
+            jobs.Wait();
+            if( m_shutdown.load( std::memory_order_relaxed ) ) return;
 
-            for( auto& v : m_data.sourceLocationZones )
-            {
-                if( m_shutdown.load( std::memory_order_relaxed ) ) return;
-                auto& zones = v.second.zones;
-#ifdef NO_PARALLEL_SORT
-                pdqsort_branchless( zones.begin(), zones.end(), []( const auto& lhs, const auto& rhs ) { return lhs.Zone()->Start() < rhs.Zone()->Start(); } );
-#else
-                std::sort( std::execution::par_unseq, zones.begin(), zones.end(), []( const auto& lhs, const auto& rhs ) { return lhs.Zone()->Start() < rhs.Zone()->Start(); } );
-#endif
-            }
             {
                 std::lock_guard<std::shared_mutex> lock( m_data.lock );
                 m_data.sourceLocationZonesReady = true;
@@ -2066,10 +2599,13 @@ Worker::~Worker()
     Shutdown();
 
     if( m_threadNet.joinable() ) m_threadNet.join();
+    if( m_threadDecompress.joinable() ) m_threadDecompress.join();
     if( m_thread.joinable() ) m_thread.join();
-    if( m_threadBackground.joinable() ) m_threadBackground.join();
+    m_backgroundTasks.Cancel();
+    m_backgroundTasks.Wait();
 
     delete[] m_buffer;
+    delete[] m_recvBuffer;
     LZ4_freeStreamDecode( (LZ4_streamDecode_t*)m_stream );
 
     delete[] m_frameImageBuffer;
@@ -2081,6 +2617,8 @@ Worker::~Worker()
         v->messages.~Vector();
         v->zoneIdStack.~Vector();
         v->samples.~Vector();
+        for( auto& t : v->zoneAggregates ) t.data.~Vector();
+        v->zoneAggregates.~Vector();
 #ifndef TRACY_NO_STATISTICS
         v->childTimeStack.~Vector();
         v->ghostZones.~Vector();
@@ -2177,7 +2715,7 @@ uint64_t Worker::GetContextSwitchPerCpuCount() const
     uint64_t cnt = 0;
     for( int i=0; i<m_data.cpuDataCount; i++ )
     {
-        cnt += m_data.cpuData[i].cs.size();
+        cnt += CpuDataReader( m_data.cpuData[i] ).size();
     }
     return cnt;
 }
@@ -2195,29 +2733,23 @@ void Worker::GetCpuUsageAtTime( int64_t time, int& own, int& other ) const
     if( time < 0 || time > m_data.lastTime ) return;
 
 #ifndef TRACY_NO_STATISTICS
-    // Remove this check when real-time ctxUsage contruction is implemented.
-    if( !m_data.ctxUsage.empty() )
-    {
-        auto it = std::upper_bound( m_data.ctxUsage.begin(), m_data.ctxUsage.end(), time, [] ( const auto& l, const auto& r ) { return l < r.Time(); } );
-        if( it == m_data.ctxUsage.begin() || it == m_data.ctxUsage.end() ) return;
-        --it;
-        own = it->Own();
-        other = it->Other();
-        return;
-    }
-#endif
-
+    auto it = std::upper_bound( m_data.ctxUsage.begin(), m_data.ctxUsage.end(), time, [] ( const auto& l, const auto& r ) { return l < r.Time(); } );
+    if( it == m_data.ctxUsage.begin() ) return;
+    --it;
+    own = it->Own();
+    other = it->Other();
+#else
     int cntOwn = 0;
     int cntOther = 0;
     for( int i=0; i<m_data.cpuDataCount; i++ )
     {
-        auto& cs = m_data.cpuData[i].cs;
+        CpuDataReader cs( m_data.cpuData[i] );
         if( !cs.empty() )
         {
-            auto it = std::lower_bound( cs.begin(), cs.end(), time, [] ( const auto& l, const auto& r ) { return (uint64_t)l.End() < (uint64_t)r; } );
-            if( it != cs.end() && it->IsEndValid() && it->Start() <= time  )
+            const auto idx = cs.LowerBoundEnd( 0, cs.size(), time );
+            if( idx != cs.size() && cs[idx].IsEndValid() && cs[idx].Start() <= time  )
             {
-                if( GetPidFromTid( DecompressThreadExternal( it->Thread() ) ) == m_pid )
+                if( GetPidFromTid( DecompressThreadExternal( cs[idx].Thread() ) ) == m_pid )
                 {
                     cntOwn++;
                 }
@@ -2230,6 +2762,7 @@ void Worker::GetCpuUsageAtTime( int64_t time, int& own, int& other ) const
     }
     own = cntOwn;
     other = cntOther;
+#endif
 }
 
 const ContextSwitch* const Worker::GetContextSwitchDataImpl( uint64_t thread )
@@ -2504,16 +3037,8 @@ int64_t Worker::GetZoneEnd( const GpuEvent& ev )
 uint32_t Worker::FindStringIdx( const char* str ) const
 {
     if( !str ) return 0;
-    charutil::StringKey key = { str, strlen( str ) };
-    auto sit = m_data.stringMap.find( key );
-    if( sit == m_data.stringMap.end() )
-    {
-        return 0;
-    }
-    else
-    {
-        return sit->second;
-    }
+    const auto idx = m_data.stringData.Find( str, strlen( str ) );
+    return idx < 0 ? 0 : uint32_t( idx );
 }
 
 const char* Worker::GetString( uint64_t ptr ) const
@@ -2632,6 +3157,14 @@ std::pair<const char*, const char*> Worker::GetExternalName( uint64_t id ) const
     }
 }
 
+const ZoneColumns* Worker::GetZoneColumns( const Vector<ZoneEvent>& vec ) const
+{
+    if( vec.size() < ZoneColumns::MinZones ) return nullptr;
+    auto it = m_data.zoneColumns.find( vec.data() );
+    if( it == m_data.zoneColumns.end() ) return nullptr;
+    return &it->second;
+}
+
 const char* Worker::GetZoneName( const SourceLocation& srcloc ) const
 {
     if( srcloc.name.active )
@@ -2703,53 +3236,93 @@ static bool strstr_nocase( const char* l, const char* r )
     return strstr( ll, rl ) != nullptr;
 }
 
-std::vector<int16_t> Worker::GetMatchingSourceLocation( const char* query, bool ignoreCase ) const
+std::vector<int16_t> Worker::GetMatchingSourceLocation( const char* query, bool ignoreCase )
 {
     std::vector<int16_t> match;
 
-    const auto sz = m_data.sourceLocationExpand.size();
-    for( size_t i=1; i<sz; i++ )
-    {
-        const auto it = m_data.sourceLocation.find( m_data.sourceLocationExpand[i] );
-        assert( it != m_data.sourceLocation.end() );
-        const auto& srcloc = it->second;
-        const auto str = GetString( srcloc.name.active ? srcloc.name : srcloc.function );
-        bool found = false;
+    auto check = [this, query, ignoreCase] ( int16_t srcloc ) {
+        const auto& sl = GetSourceLocation( srcloc );
+        const auto str = GetString( sl.name.active ? sl.name : sl.function );
         if( ignoreCase )
         {
-            found = strstr_nocase( str, query );
+            return strstr_nocase( str, query );
         }
         else
         {
-            found = strstr( str, query ) != nullptr;
+            return strstr( str, query ) != nullptr;
+        }
+    };
+
+    UpdateSourceLocationIndex();
+    const auto candidates = m_srclocIndex.Candidates( query );
+    if( candidates )
+    {
+        for( auto& v : *candidates )
+        {
+            if( check( v ) ) match.push_back( v );
         }
-        if( found )
+        for( auto& v : m_srclocIndexPending )
         {
-            match.push_back( (int16_t)i );
+            if( check( v ) ) match.push_back( v );
         }
+        // Same order as the full scan: static source locations first, then the allocated ones.
+        std::sort( match.begin(), match.end(), [] ( const auto& lhs, const auto& rhs ) { return ( lhs > 0 ) != ( rhs > 0 ) ? lhs > 0 : ( lhs > 0 ? lhs < rhs : lhs > rhs ); } );
     }
-
-    for( auto& srcloc : m_data.sourceLocationPayload )
+    else
     {
-        const auto str = GetString( srcloc->name.active ? srcloc->name : srcloc->function );
-        bool found = false;
-        if( ignoreCase )
+        const auto sz = m_data.sourceLocationExpand.size();
+        for( size_t i=1; i<sz; i++ )
         {
-            found = strstr_nocase( str, query );
+            if( check( int16_t( i ) ) ) match.push_back( int16_t( i ) );
         }
-        else
+        const auto psz = m_data.sourceLocationPayload.size();
+        for( size_t i=0; i<psz; i++ )
+        {
+            if( check( -int16_t( i + 1 ) ) ) match.push_back( -int16_t( i + 1 ) );
+        }
+    }
+
+    return match;
+}
+
+void Worker::UpdateSourceLocationIndex()
+{
+    // Names of source locations sent by the client may not be known yet. These
+    // are kept aside and indexed once they arrive.
+    auto index = [this] ( int16_t srcloc ) {
+        const auto& sl = GetSourceLocation( srcloc );
+        const auto str = GetString( sl.name.active ? sl.name : sl.function );
+        if( strcmp( str, "???" ) == 0 ) return false;
+        m_srclocIndex.Add( srcloc, str );
+        return true;
+    };
+
+    auto it = m_srclocIndexPending.begin();
+    while( it != m_srclocIndexPending.end() )
+    {
+        if( index( *it ) )
         {
-            found = strstr( str, query ) != nullptr;
+            it = m_srclocIndexPending.erase( it );
         }
-        if( found )
+        else
         {
-            auto it = m_data.sourceLocationPayloadMap.find( (const SourceLocation*)srcloc );
-            assert( it != m_data.sourceLocationPayloadMap.end() );
-            match.push_back( -int16_t( it->second + 1 ) );
+            ++it;
         }
     }
 
-    return match;
+    const auto sz = m_data.sourceLocationExpand.size();
+    for( size_t i=m_srclocIndexExpand; i<sz; i++ )
+    {
+        if( !index( int16_t( i ) ) ) m_srclocIndexPending.push_back( int16_t( i ) );
+    }
+    m_srclocIndexExpand = sz;
+
+    const auto psz = m_data.sourceLocationPayload.size();
+    for( size_t i=m_srclocIndexPayload; i<psz; i++ )
+    {
+        if( !index( -int16_t( i + 1 ) ) ) m_srclocIndexPending.push_back( -int16_t( i + 1 ) );
+    }
+    m_srclocIndexPayload = psz;
 }
 
 #ifndef TRACY_NO_STATISTICS
@@ -2790,32 +3363,84 @@ const unordered_flat_map<CallstackFrameId, uint32_t, Worker::CallstackFrameIdHas
 }
 #endif
 
+// Network data is handled in three stages, each running on its own thread.
+// Compressed frames are read from the socket into a ring of m_recvFrames
+// buffers, which allows the socket to be drained while processing lags
+// behind. Decompression must follow the client's ring buffer layout, so at
+// most two decompressed frames may wait for processing in Exec().
 void Worker::Network()
 {
     auto ShouldExit = [this] { return m_shutdown.load( std::memory_order_relaxed ); };
-    auto lz4buf = std::make_unique<char[]>( LZ4Size );
+    int idx = 0;
+
+    {
+        std::unique_lock<std::mutex> lock( m_recvLock );
+        m_recvCv.wait( lock, [this] { return m_recvStart || m_shutdown.load( std::memory_order_relaxed ); } );
+        if( m_shutdown.load( std::memory_order_relaxed ) ) goto close;
+    }
 
     for(;;)
     {
         {
-            std::unique_lock<std::mutex> lock( m_netWriteLock );
-            m_netWriteCv.wait( lock, [this] { return m_netWriteCnt > 0 || m_shutdown.load( std::memory_order_relaxed ); } );
+            std::unique_lock<std::mutex> lock( m_recvLock );
+            m_recvCv.wait( lock, [this] { return m_recvCnt < m_recvFrames || m_shutdown.load( std::memory_order_relaxed ); } );
             if( m_shutdown.load( std::memory_order_relaxed ) ) goto close;
-            m_netWriteCnt--;
         }
 
-        auto buf = m_buffer + m_bufferOffset;
         lz4sz_t lz4sz;
         if( !m_sock.Read( &lz4sz, sizeof( lz4sz ), 10, ShouldExit ) ) goto close;
-        if( !m_sock.Read( lz4buf.get(), lz4sz, 10, ShouldExit ) ) goto close;
+        if( lz4sz > LZ4Size ) goto close;
+        if( !m_sock.Read( m_recvBuffer + size_t( idx ) * LZ4Size, lz4sz, 10, ShouldExit ) ) goto close;
         auto bb = m_bytes.load( std::memory_order_relaxed );
         m_bytes.store( bb + sizeof( lz4sz ) + lz4sz, std::memory_order_relaxed );
+        m_recvSize[idx] = lz4sz;
+
+        {
+            std::lock_guard<std::mutex> lock( m_recvLock );
+            m_recvCnt++;
+            m_recvCv.notify_all();
+        }
+
+        idx = ( idx + 1 ) % m_recvFrames;
+    }
+
+close:
+    std::lock_guard<std::mutex> lock( m_recvLock );
+    m_recvEnd = true;
+    m_recvCv.notify_all();
+}
+
+void Worker::Decompress()
+{
+    int idx = 0;
 
-        auto sz = LZ4_decompress_safe_continue( (LZ4_streamDecode_t*)m_stream, lz4buf.get(), buf, lz4sz, TargetFrameSize );
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock( m_netWriteLock );
+            m_netWriteCv.wait( lock, [this] { return m_netWriteCnt > 0 || m_shutdown.load( std::memory_order_relaxed ); } );
+            if( m_shutdown.load( std::memory_order_relaxed ) ) goto close;
+            m_netWriteCnt--;
+        }
+        {
+            std::unique_lock<std::mutex> lock( m_recvLock );
+            m_recvCv.wait( lock, [this] { return m_recvCnt > 0 || m_recvEnd || m_shutdown.load( std::memory_order_relaxed ); } );
+            if( m_recvCnt == 0 || m_shutdown.load( std::memory_order_relaxed ) ) goto close;
+        }
+
+        auto buf = m_buffer + m_bufferOffset;
+        auto sz = LZ4_decompress_safe_continue( (LZ4_streamDecode_t*)m_stream, m_recvBuffer + size_t( idx ) * LZ4Size, buf, m_recvSize[idx], TargetFrameSize );
         assert( sz >= 0 );
-        bb = m_decBytes.load( std::memory_order_relaxed );
+        auto bb = m_decBytes.load( std::memory_order_relaxed );
         m_decBytes.store( bb + sz, std::memory_order_relaxed );
 
+        {
+            std::lock_guard<std::mutex> lock( m_recvLock );
+            m_recvCnt--;
+            m_recvCv.notify_all();
+        }
+        idx = ( idx + 1 ) % m_recvFrames;
+
         {
             std::lock_guard<std::mutex> lock( m_netReadLock );
             m_netRead.push_back( NetBuffer { m_bufferOffset, sz } );
@@ -2838,7 +3463,13 @@ void Worker::Exec()
 
     for(;;)
     {
-        if( m_shutdown.load( std::memory_order_relaxed ) ) { m_netWriteCv.notify_one(); return; };
+        if( m_shutdown.load( std::memory_order_relaxed ) )
+        {
+            m_netWriteCv.notify_one();
+            std::lock_guard<std::mutex> lock( m_recvLock );
+            m_recvCv.notify_all();
+            return;
+        }
         if( m_sock.Connect( m_addr.c_str(), m_port ) ) break;
     }
 
@@ -2883,20 +3514,23 @@ void Worker::Exec()
             goto close;
         }
         m_timerMul = welcome.timerMul;
+        InitTimerMapping();
         m_data.baseTime = welcome.initBegin;
         const auto initEnd = TscTime( welcome.initEnd - m_data.baseTime );
         m_data.framesBase->frames.push_back( FrameEvent{ 0, -1, -1 } );
         m_data.framesBase->frames.push_back( FrameEvent{ initEnd, -1, -1 } );
         m_data.lastTime = initEnd;
-        m_delay = TscTime( welcome.delay );
-        m_resolution = TscTime( welcome.resolution );
+        m_delay = TscPeriod( welcome.delay );
+        m_resolution = TscPeriod( welcome.resolution );
         m_pid = welcome.pid;
         m_samplingPeriod = welcome.samplingPeriod;
+        m_data.memory.sampleInterval = welcome.memSampleInterval;
         m_onDemand = welcome.onDemand;
         m_captureProgram = welcome.programName;
         m_captureTime = welcome.epoch;
         m_ignoreMemFreeFaults = welcome.onDemand || welcome.isApple;
         m_data.cpuArch = (CpuArchitecture)welcome.cpuArch;
+        m_queueBudget = welcome.queueBudget != 0;
 
         char dtmp[64];
         time_t date = welcome.epoch;
@@ -2917,6 +3551,10 @@ void Worker::Exec()
                 goto close;
             }
             m_data.frameOffset = onDemand.frames;
+            m_memNextOrder = onDemand.memOrder;
+            m_memJoinOrder = onDemand.memOrder;
+            m_lateJoin = onDemand.lateJoin != 0;
+            m_memJoinFilter = m_lateJoin;
             m_data.framesBase->frames.push_back( FrameEvent{ TscTime( onDemand.currentTime - m_data.baseTime ), -1, -1 } );
         }
     }
@@ -2931,6 +3569,11 @@ void Worker::Exec()
         m_netWriteCnt = 2;
         m_netWriteCv.notify_one();
     }
+    {
+        std::lock_guard<std::mutex> lock( m_recvLock );
+        m_recvStart = true;
+        m_recvCv.notify_all();
+    }
 
     t0 = std::chrono::high_resolution_clock::now();
 
@@ -2965,6 +3608,17 @@ void Worker::Exec()
                     QueryTerminate();
                     goto close;
                 }
+                m_drainItems++;
+            }
+            if( m_terminate )
+            {
+                FlushMemEvents();
+                if( m_failure != Failure::None )
+                {
+                    HandleFailure( ptr, end );
+                    QueryTerminate();
+                    goto close;
+                }
             }
 
             {
@@ -2973,6 +3627,7 @@ void Worker::Exec()
                 m_netWriteCv.notify_one();
             }
 
+            HandlePostponedLocks();
             HandlePostponedPlots();
 #ifndef TRACY_NO_STATISTICS
             HandlePostponedSamples();
@@ -3052,8 +3707,18 @@ void Worker::Exec()
     }
 
 close:
+    if( m_failure == Failure::None )
+    {
+        std::lock_guard<std::shared_mutex> lock( m_data.lock );
+        FlushMemEvents();
+        HandlePostponedLocks();
+    }
     Shutdown();
     m_netWriteCv.notify_one();
+    {
+        std::lock_guard<std::mutex> lock( m_recvLock );
+        m_recvCv.notify_all();
+    }
     m_sock.Close();
     m_connected.store( false, std::memory_order_relaxed );
 }
@@ -3062,6 +3727,21 @@ void Worker::UpdateMbps( int64_t td )
 {
     const auto bytes = m_bytes.exchange( 0, std::memory_order_relaxed );
     const auto decBytes = m_decBytes.exchange( 0, std::memory_order_relaxed );
+
+    // The client uses the rate at which queue items are consumed to decide
+    // when it may stop dropping data.
+    m_drainTime += td;
+    if( td != 0 && m_drainTime >= 1000 )
+    {
+        if( m_queueBudget )
+        {
+            std::lock_guard<std::shared_mutex> lock( m_data.lock );
+            Query( ServerQueryDrainRate, m_drainItems * 1000 / m_drainTime );
+        }
+        m_drainItems = 0;
+        m_drainTime = 0;
+    }
+
     std::lock_guard<std::shared_mutex> lock( m_mbpsData.lock );
     if( td != 0 )
     {
@@ -3282,6 +3962,9 @@ bool Worker::DispatchProcess( const QueueItem& ev, const char*& ptr )
             case QueueType::CallstackAllocPayload:
                 AddCallstackAllocPayload( ev.stringTransfer.ptr, ptr, sz );
                 break;
+            case QueueType::ZoneAggregatePayload:
+                AddZoneAggregatePayload( ev.stringTransfer.ptr, ptr, sz );
+                break;
             case QueueType::ExternalName:
                 AddExternalName( ev.stringTransfer.ptr, ptr, sz );
                 m_serverQuerySpaceLeft++;
@@ -3537,11 +4220,18 @@ void Worker::InsertLockEvent( LockMap& lockmap, LockEvent* lev, uint64_t thread,
         timeline.push_back( { lev } );
         UpdateLockCount( lockmap, timeline.size() - 1 );
     }
-    else
+    else if( timeline.back().ptr->Time() <= time )
     {
-        assert( timeline.back().ptr->Time() <= time );
         timeline.push_back_non_empty( { lev } );
-        UpdateLockCount( lockmap, timeline.size() - 1 );
+        // State of postponed events is calculated when they are merged.
+        if( lockmap.postpone.empty() ) UpdateLockCount( lockmap, timeline.size() - 1 );
+    }
+    else
+    {
+        // Lock events are sent through per-thread queues, so events from
+        // different threads may arrive out of order. These are merged into
+        // the timeline once per batch of received data.
+        lockmap.postpone.push_back( { lev } );
     }
 
     auto& range = lockmap.range[it->second];
@@ -3772,6 +4462,26 @@ uint64_t Worker::GetCanonicalPointer( const CallstackFrameId& id ) const
     return ( id.idx & 0x3FFFFFFFFFFFFFFF ) | ( ( id.idx & 0x3000000000000000 ) << 2 );
 }
 
+void Worker::AddZoneAggregatePayload( uint64_t ptr, const char* data, size_t sz )
+{
+    assert( m_pendingZoneAggregatePtr == 0 );
+    assert( sz % sizeof( QueueZoneAggregateEntry ) == 0 );
+    const auto cnt = sz / sizeof( QueueZoneAggregateEntry );
+    m_pendingZoneAggregate.resize( cnt );
+    memcpy( m_pendingZoneAggregate.data(), data, sz );
+    m_pendingZoneAggregatePtr = ptr;
+}
+
+void Worker::AddZoneAggregateStats( int16_t srcloc, const ZoneAggregate& agg )
+{
+    auto& stats = m_data.zoneAggregateStats[srcloc];
+    stats.count += agg.count;
+    stats.total += agg.total;
+    if( agg.min < stats.min ) stats.min = agg.min;
+    if( agg.max > stats.max ) stats.max = agg.max;
+    for( int i=0; i<ZoneAggregateBuckets; i++ ) stats.hist[i] += agg.hist[i];
+}
+
 void Worker::AddCallstackPayload( uint64_t ptr, const char* _data, size_t _sz )
 {
     assert( m_pendingCallstackPtr == 0 );
@@ -3986,6 +4696,25 @@ void Worker::HandlePostponedPlots()
     }
 }
 
+void Worker::HandlePostponedLocks()
+{
+    for( auto& v : m_data.lockMap )
+    {
+        auto& lockmap = *v.second;
+        auto& src = lockmap.postpone;
+        if( src.empty() ) continue;
+        auto& dst = lockmap.timeline;
+        std::stable_sort( src.begin(), src.end(), [] ( const auto& l, const auto& r ) { return l.ptr->Time() < r.ptr->Time(); } );
+        const auto ds = std::upper_bound( dst.begin(), dst.end(), src.front().ptr->Time(), [] ( const auto& l, const auto& r ) { return l < r.ptr->Time(); } );
+        const auto dsd = std::distance( dst.begin(), ds );
+        const auto ded = dst.size();
+        dst.insert( dst.end(), src.begin(), src.end() );
+        std::inplace_merge( dst.begin() + dsd, dst.begin() + ded, dst.end(), [] ( const auto& l, const auto& r ) { return l.ptr->Time() < r.ptr->Time(); } );
+        src.clear();
+        UpdateLockCount( lockmap, dsd );
+    }
+}
+
 #ifndef TRACY_NO_STATISTICS
 void Worker::HandlePostponedSamples()
 {
@@ -4003,22 +4732,19 @@ void Worker::HandlePostponedSamples()
 StringLocation Worker::StoreString( const char* str, size_t sz )
 {
     StringLocation ret;
-    charutil::StringKey key = { str, sz };
-    auto sit = m_data.stringMap.find( key );
-    if( sit == m_data.stringMap.end() )
+    const auto idx = m_data.stringData.Find( str, sz );
+    if( idx < 0 )
     {
         auto ptr = m_slab.Alloc<char>( sz+1 );
         memcpy( ptr, str, sz );
         ptr[sz] = '\0';
         ret.ptr = ptr;
-        ret.idx = m_data.stringData.size();
-        m_data.stringMap.emplace( charutil::StringKey { ptr, sz }, m_data.stringData.size() );
-        m_data.stringData.push_back( ptr );
+        ret.idx = m_data.stringData.Add( ptr );
     }
     else
     {
-        ret.ptr = sit->first.ptr;
-        ret.idx = sit->second;
+        ret.ptr = m_data.stringData[idx];
+        ret.idx = uint32_t( idx );
     }
     return ret;
 }
@@ -4210,6 +4936,24 @@ bool Worker::Process( const QueueItem& ev )
     case QueueType::SysTimeReport:
         ProcessSysTime( ev.sysTime );
         break;
+    case QueueType::TimerCalibration:
+        ProcessTimerCalibration( ev.timerCalibration );
+        break;
+    case QueueType::ZoneThrottleReport:
+        ProcessZoneThrottleReport( ev.zoneThrottleReport );
+        break;
+    case QueueType::DataLoss:
+        ProcessDataLoss( ev.dataLoss );
+        break;
+    case QueueType::TimeReferenceReset:
+        m_refTimeThread = 0;
+        m_refTimeSerial = 0;
+        m_refTimeCtx = 0;
+        m_refTimeGpu = 0;
+        break;
+    case QueueType::ZoneAggregate:
+        ProcessZoneAggregate( ev.zoneAggregate );
+        break;
     case QueueType::ContextSwitch:
         ProcessContextSwitch( ev.contextSwitch );
         break;
@@ -4335,6 +5079,13 @@ void Worker::ProcessZoneBeginAllocSrcLocCallstack( const QueueZoneBegin& ev )
 void Worker::ProcessZoneEnd( const QueueZoneEnd& ev )
 {
     auto td = m_threadCtxData;
+    if( m_lateJoin && ( !td || td->stack.empty() ) )
+    {
+        // Zone was started before this server has attached to the client.
+        m_refTimeThread += ev.time;
+        if( td ) td->nextZoneId = 0;
+        return;
+    }
     assert( td );
 
     auto zoneId = td->zoneIdStack.back_and_pop();
@@ -4482,6 +5233,13 @@ void Worker::ProcessFrameMark( const QueueFrameMark& ev )
         Query( ServerQueryFrameName, name );
     } );
 
+    assert( fd->continuous == 1 );
+    const auto time = TscTime( ev.time - m_data.baseTime );
+    // Frames marked before this server has attached to the client are
+    // already accounted for in the frame offset.
+    if( m_lateJoin && !fd->frames.empty() && fd->frames.back().start > time ) return;
+    assert( fd->frames.empty() || fd->frames.back().start <= time );
+
     int32_t frameImage = -1;
     auto fis = m_frameImageStaging.find( fd->frames.size() );
     if( fis != m_frameImageStaging.end() )
@@ -4490,9 +5248,6 @@ void Worker::ProcessFrameMark( const QueueFrameMark& ev )
         m_frameImageStaging.erase( fis );
     }
 
-    assert( fd->continuous == 1 );
-    const auto time = TscTime( ev.time - m_data.baseTime );
-    assert( fd->frames.empty() || fd->frames.back().start <= time );
     fd->frames.push_back( FrameEvent{ time, -1, frameImage } );
     if( m_data.lastTime < time ) m_data.lastTime = time;
 
@@ -4541,7 +5296,7 @@ void Worker::ProcessFrameMarkEnd( const QueueFrameMark& ev )
     const auto time = TscTime( ev.time - m_data.baseTime );
     if( fd->frames.empty() )
     {
-        FrameEndFailure();
+        if( !m_lateJoin ) FrameEndFailure();
         return;
     }
     assert( fd->frames.back().end == -1 );
@@ -4612,6 +5367,12 @@ void Worker::ProcessFrameImage( const QueueFrameImage& ev )
 void Worker::ProcessZoneText( const QueueZoneText& ev )
 {
     auto td = RetrieveThread( m_threadCtx );
+    if( m_lateJoin && ( !td || td->stack.empty() ) )
+    {
+        m_pendingCustomStrings.erase( ev.text );
+        if( td ) td->nextZoneId = 0;
+        return;
+    }
     if( !td || td->stack.empty() || td->nextZoneId != td->zoneIdStack.back() )
     {
         ZoneTextFailure( m_threadCtx );
@@ -4646,6 +5407,12 @@ void Worker::ProcessZoneText( const QueueZoneText& ev )
 void Worker::ProcessZoneName( const QueueZoneText& ev )
 {
     auto td = RetrieveThread( m_threadCtx );
+    if( m_lateJoin && ( !td || td->stack.empty() ) )
+    {
+        m_pendingCustomStrings.erase( ev.text );
+        if( td ) td->nextZoneId = 0;
+        return;
+    }
     if( !td || td->stack.empty() || td->nextZoneId != td->zoneIdStack.back() )
     {
         ZoneNameFailure( m_threadCtx );
@@ -4662,206 +5429,224 @@ void Worker::ProcessZoneName( const QueueZoneText& ev )
     m_pendingCustomStrings.erase( it );
 }
 
-void Worker::ProcessLockAnnounce( const QueueLockAnnounce& ev )
+LockMap& Worker::GetOrCreateLockMap( uint32_t id, LockType type, bool typeKnown )
 {
-    auto it = m_data.lockMap.find( ev.id );
+    auto it = m_data.lockMap.find( id );
     if( it == m_data.lockMap.end() )
     {
         auto lm = m_slab.AllocInit<LockMap>();
-        lm->srcloc = ShrinkSourceLocation( ev.lckloc );
-        lm->type = ev.type;
-        lm->timeAnnounce = TscTime( ev.time - m_data.baseTime );
+        lm->timeAnnounce = 0;
         lm->timeTerminate = 0;
-        lm->valid = true;
+        lm->valid = false;
+        lm->type = type;
         lm->isContended = false;
-        m_data.lockMap.emplace( ev.id, lm );
+        it = m_data.lockMap.emplace( id, lm ).first;
     }
-    else
+    else if( typeKnown && it->second->type != type )
     {
-        it->second->srcloc = ShrinkSourceLocation( ev.lckloc );
-        assert( it->second->type == ev.type );
-        it->second->timeAnnounce = TscTime( ev.time - m_data.baseTime );
-        it->second->valid = true;
+        // The type was guessed from an exclusive lock event. Events of locks
+        // which are not announced yet use the shared layout, so the lock
+        // state can be recalculated.
+        auto& lockmap = *it->second;
+        assert( !lockmap.valid );
+        lockmap.type = type;
+        if( !lockmap.timeline.empty() ) UpdateLockCount( lockmap, 0 );
     }
+    return *it->second;
+}
+
+LockEvent* Worker::AllocLockEvent( const LockMap& lockmap )
+{
+    if( lockmap.valid && lockmap.type == LockType::Lockable ) return m_slab.Alloc<LockEvent>();
+    return m_slab.Alloc<LockEventShared>();
+}
+
+void Worker::ProcessLockAnnounce( const QueueLockAnnounce& ev )
+{
+    auto& lockmap = GetOrCreateLockMap( ev.id, ev.type, true );
+    lockmap.srcloc = ShrinkSourceLocation( ev.lckloc );
+    lockmap.timeAnnounce = TscTime( ev.time - m_data.baseTime );
+    lockmap.valid = true;
     CheckSourceLocation( ev.lckloc );
 }
 
 void Worker::ProcessLockTerminate( const QueueLockTerminate& ev )
 {
-    auto it = m_data.lockMap.find( ev.id );
-    if( it == m_data.lockMap.end() )
-    {
-        auto lm = m_slab.AllocInit<LockMap>();
-        lm->type = ev.type;
-        lm->timeAnnounce = 0;
-        lm->timeTerminate = TscTime( ev.time - m_data.baseTime );
-        lm->valid = false;
-        lm->isContended = false;
-        m_data.lockMap.emplace( ev.id, lm );
-    }
-    else
-    {
-        assert( it->second->type == ev.type );
-        it->second->timeTerminate = TscTime( ev.time - m_data.baseTime );
-    }
+    auto& lockmap = GetOrCreateLockMap( ev.id, ev.type, true );
+    lockmap.timeTerminate = TscTime( ev.time - m_data.baseTime );
 }
 
 void Worker::ProcessLockWait( const QueueLockWait& ev )
 {
-    auto it = m_data.lockMap.find( ev.id );
-    if( it == m_data.lockMap.end() )
-    {
-        auto lm = m_slab.AllocInit<LockMap>();
-        lm->timeAnnounce = 0;
-        lm->timeTerminate = 0;
-        lm->valid = false;
-        lm->type = ev.type;
-        lm->isContended = false;
-        it = m_data.lockMap.emplace( ev.id, lm ).first;
-    }
+    auto& lockmap = GetOrCreateLockMap( ev.id, ev.type, true );
 
-    auto lev = ev.type == LockType::Lockable ? m_slab.Alloc<LockEvent>() : m_slab.Alloc<LockEventShared>();
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
+    auto lev = AllocLockEvent( lockmap );
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
     const auto time = TscTime( refTime - m_data.baseTime );
     lev->SetTime( time );
     lev->SetSrcLoc( 0 );
     lev->type = LockEvent::Type::Wait;
 
-    InsertLockEvent( *it->second, lev, ev.thread, time );
+    InsertLockEvent( lockmap, lev, m_threadCtx, time );
 }
 
 void Worker::ProcessLockObtain( const QueueLockObtain& ev )
 {
-    auto it = m_data.lockMap.find( ev.id );
-    assert( it != m_data.lockMap.end() );
-    auto& lock = *it->second;
+    // A try lock obtains without waiting, so this may be the first event of
+    // a lock announced on another thread.
+    auto& lock = GetOrCreateLockMap( ev.id, LockType::Lockable, false );
 
-    auto lev = lock.type == LockType::Lockable ? m_slab.Alloc<LockEvent>() : m_slab.Alloc<LockEventShared>();
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
+    auto lev = AllocLockEvent( lock );
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
     const auto time = TscTime( refTime - m_data.baseTime );
     lev->SetTime( time );
     lev->SetSrcLoc( 0 );
     lev->type = LockEvent::Type::Obtain;
 
-    InsertLockEvent( lock, lev, ev.thread, time );
+    if( m_lateJoin && lock.threadMap.find( m_threadCtx ) == lock.threadMap.end() )
+    {
+        // Lock wait was started before this server has attached to the client.
+        auto wait = AllocLockEvent( lock );
+        wait->SetTime( time );
+        wait->SetSrcLoc( 0 );
+        wait->type = LockEvent::Type::Wait;
+        InsertLockEvent( lock, wait, m_threadCtx, time );
+    }
+    InsertLockEvent( lock, lev, m_threadCtx, time );
 }
 
 void Worker::ProcessLockRelease( const QueueLockRelease& ev )
 {
-    auto it = m_data.lockMap.find( ev.id );
-    assert( it != m_data.lockMap.end() );
-    auto& lock = *it->second;
+    auto& lock = GetOrCreateLockMap( ev.id, LockType::Lockable, false );
+    if( m_lateJoin && lock.threadMap.find( m_threadCtx ) == lock.threadMap.end() )
+    {
+        // Lock was obtained before this server has attached to the client.
+        m_refTimeThread += ev.time;
+        return;
+    }
 
-    auto lev = lock.type == LockType::Lockable ? m_slab.Alloc<LockEvent>() : m_slab.Alloc<LockEventShared>();
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
+    auto lev = AllocLockEvent( lock );
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
     const auto time = TscTime( refTime - m_data.baseTime );
     lev->SetTime( time );
     lev->SetSrcLoc( 0 );
     lev->type = LockEvent::Type::Release;
 
-    InsertLockEvent( lock, lev, ev.thread, time );
+    InsertLockEvent( lock, lev, m_threadCtx, time );
 }
 
 void Worker::ProcessLockSharedWait( const QueueLockWait& ev )
 {
-    auto it = m_data.lockMap.find( ev.id );
-    if( it == m_data.lockMap.end() )
-    {
-        auto lm = m_slab.AllocInit<LockMap>();
-        lm->valid = false;
-        lm->type = ev.type;
-        lm->isContended = false;
-        it = m_data.lockMap.emplace( ev.id, lm ).first;
-    }
-
     assert( ev.type == LockType::SharedLockable );
+    auto& lockmap = GetOrCreateLockMap( ev.id, ev.type, true );
+
     auto lev = m_slab.Alloc<LockEventShared>();
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
     const auto time = TscTime( refTime - m_data.baseTime );
     lev->SetTime( time );
     lev->SetSrcLoc( 0 );
     lev->type = LockEvent::Type::WaitShared;
 
-    InsertLockEvent( *it->second, lev, ev.thread, time );
+    InsertLockEvent( lockmap, lev, m_threadCtx, time );
 }
 
 void Worker::ProcessLockSharedObtain( const QueueLockObtain& ev )
 {
-    auto it = m_data.lockMap.find( ev.id );
-    assert( it != m_data.lockMap.end() );
-    auto& lock = *it->second;
+    auto& lock = GetOrCreateLockMap( ev.id, LockType::SharedLockable, true );
 
-    assert( lock.type == LockType::SharedLockable );
     auto lev = m_slab.Alloc<LockEventShared>();
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
     const auto time = TscTime( refTime - m_data.baseTime );
     lev->SetTime( time );
     lev->SetSrcLoc( 0 );
     lev->type = LockEvent::Type::ObtainShared;
 
-    InsertLockEvent( lock, lev, ev.thread, time );
+    if( m_lateJoin && lock.threadMap.find( m_threadCtx ) == lock.threadMap.end() )
+    {
+        // Lock wait was started before this server has attached to the client.
+        auto wait = m_slab.Alloc<LockEventShared>();
+        wait->SetTime( time );
+        wait->SetSrcLoc( 0 );
+        wait->type = LockEvent::Type::WaitShared;
+        InsertLockEvent( lock, wait, m_threadCtx, time );
+    }
+    InsertLockEvent( lock, lev, m_threadCtx, time );
 }
 
 void Worker::ProcessLockSharedRelease( const QueueLockRelease& ev )
 {
-    auto it = m_data.lockMap.find( ev.id );
-    assert( it != m_data.lockMap.end() );
-    auto& lock = *it->second;
+    auto& lock = GetOrCreateLockMap( ev.id, LockType::SharedLockable, true );
+    if( m_lateJoin && lock.threadMap.find( m_threadCtx ) == lock.threadMap.end() )
+    {
+        // Lock was obtained before this server has attached to the client.
+        m_refTimeThread += ev.time;
+        return;
+    }
 
-    assert( lock.type == LockType::SharedLockable );
     auto lev = m_slab.Alloc<LockEventShared>();
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
     const auto time = TscTime( refTime - m_data.baseTime );
     lev->SetTime( time );
     lev->SetSrcLoc( 0 );
     lev->type = LockEvent::Type::ReleaseShared;
 
-    InsertLockEvent( lock, lev, ev.thread, time );
+    InsertLockEvent( lock, lev, m_threadCtx, time );
 }
 
 void Worker::ProcessLockMark( const QueueLockMark& ev )
 {
     CheckSourceLocation( ev.srcloc );
     auto lit = m_data.lockMap.find( ev.id );
+    // The marked event is sent before the mark from the same thread, so it
+    // is missing only if it was sent before this server has attached.
+    if( m_lateJoin && lit == m_data.lockMap.end() ) return;
     assert( lit != m_data.lockMap.end() );
     auto& lockmap = *lit->second;
-    auto tid = lockmap.threadMap.find( ev.thread );
+    auto tid = lockmap.threadMap.find( m_threadCtx );
+    if( m_lateJoin && tid == lockmap.threadMap.end() ) return;
     assert( tid != lockmap.threadMap.end() );
     const auto thread = tid->second;
-    auto it = lockmap.timeline.end();
-    for(;;)
-    {
-        --it;
-        if( it->ptr->thread == thread )
+
+    // The marked event may still wait in the postponed events.
+    auto find = [thread] ( Vector<LockEventPtr>& vec ) -> LockEvent* {
+        auto it = vec.end();
+        while( it != vec.begin() )
         {
-            switch( it->ptr->type )
+            --it;
+            if( it->ptr->thread == thread )
             {
-            case LockEvent::Type::Obtain:
-            case LockEvent::Type::ObtainShared:
-            case LockEvent::Type::Wait:
-            case LockEvent::Type::WaitShared:
-                it->ptr->SetSrcLoc( ShrinkSourceLocation( ev.srcloc ) );
-                return;
-            default:
-                break;
+                switch( it->ptr->type )
+                {
+                case LockEvent::Type::Obtain:
+                case LockEvent::Type::ObtainShared:
+                case LockEvent::Type::Wait:
+                case LockEvent::Type::WaitShared:
+                    return it->ptr;
+                default:
+                    break;
+                }
             }
         }
-    }
+        return nullptr;
+    };
+    auto lev = find( lockmap.timeline );
+    auto pev = find( lockmap.postpone );
+    if( pev && ( !lev || pev->Time() >= lev->Time() ) ) lev = pev;
+    if( lev ) lev->SetSrcLoc( ShrinkSourceLocation( ev.srcloc ) );
 }
 
 void Worker::ProcessLockName( const QueueLockName& ev )
 {
-    auto lit = m_data.lockMap.find( ev.id );
-    assert( lit != m_data.lockMap.end() );
+    auto& lockmap = GetOrCreateLockMap( ev.id, LockType::Lockable, false );
     auto it = m_pendingCustomStrings.find( ev.name );
     assert( it != m_pendingCustomStrings.end() );
-    lit->second->customName = StringIdx( it->second.idx );
+    lockmap.customName = StringIdx( it->second.idx );
     m_pendingCustomStrings.erase( it );
 }
 
@@ -5132,6 +5917,12 @@ void Worker::ProcessGpuZoneEnd( const QueueGpuZoneEnd& ev, bool serial )
     assert( ctx );
 
     auto td = ctx->threadData.find( ev.thread );
+    if( m_lateJoin && ( td == ctx->threadData.end() || td->second.stack.empty() ) )
+    {
+        // Zone was started before this server has attached to the client.
+        if( serial ) m_refTimeSerial += ev.cpuTime; else m_refTimeThread += ev.cpuTime;
+        return;
+    }
     assert( td != ctx->threadData.end() );
 
     assert( !td->second.stack.empty() );
@@ -5176,6 +5967,7 @@ void Worker::ProcessGpuTime( const QueueGpuTime& ev )
     }
 
     auto zone = ctx->query[ev.queryId];
+    if( m_lateJoin && !zone ) return;
     assert( zone );
     ctx->query[ev.queryId] = nullptr;
 
@@ -5202,49 +5994,163 @@ void Worker::ProcessGpuTime( const QueueGpuTime& ev )
 
 void Worker::ProcessMemAlloc( const QueueMemAlloc& ev )
 {
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
-    const auto time = TscTime( refTime - m_data.baseTime );
-    if( m_data.lastTime < time ) m_data.lastTime = time;
-    NoticeThread( ev.thread );
-
-    assert( m_data.memory.active.find( ev.ptr ) == m_data.memory.active.end() );
-    assert( m_data.memory.data.empty() || m_data.memory.data.back().TimeAlloc() <= time );
-
-    m_data.memory.active.emplace( ev.ptr, m_data.memory.data.size() );
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
 
-    const auto ptr = ev.ptr;
     uint32_t lo;
     uint16_t hi;
     memcpy( &lo, ev.size, 4 );
     memcpy( &hi, ev.size+4, 2 );
-    const uint64_t size = lo | ( uint64_t( hi ) << 32 );
 
-    auto& mem = m_data.memory.data.push_next();
-    mem.SetPtr( ptr );
-    mem.SetSize( size );
-    mem.SetTimeThreadAlloc( time, CompressThread( ev.thread ) );
-    mem.SetTimeThreadFree( -1, 0 );
-    mem.SetCsAlloc( 0 );
-    mem.csFree.SetVal( 0 );
+    QueueMemEvent( MemEventPending { ev.order, true, m_threadCtx, TscTime( refTime - m_data.baseTime ), ev.ptr, lo | ( uint64_t( hi ) << 32 ), 0 } );
+}
 
-    const auto low = m_data.memory.low;
+void Worker::ProcessMemFree( const QueueMemFree& ev )
+{
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
+
+    QueueMemEvent( MemEventPending { ev.order, false, m_threadCtx, TscTime( refTime - m_data.baseTime ), ev.ptr, 0, 0 } );
+}
+
+void Worker::ProcessMemAllocCallstack( const QueueMemAlloc& ev )
+{
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
+
+    uint32_t lo;
+    uint16_t hi;
+    memcpy( &lo, ev.size, 4 );
+    memcpy( &hi, ev.size+4, 2 );
+
+    assert( m_memEventCallstack.find( m_threadCtx ) == m_memEventCallstack.end() );
+    m_memEventCallstack.emplace( m_threadCtx, MemEventPending { ev.order, true, m_threadCtx, TscTime( refTime - m_data.baseTime ), ev.ptr, lo | ( uint64_t( hi ) << 32 ), 0 } );
+}
+
+void Worker::ProcessMemFreeCallstack( const QueueMemFree& ev )
+{
+    const auto refTime = m_refTimeThread + ev.time;
+    m_refTimeThread = refTime;
+
+    assert( m_memEventCallstack.find( m_threadCtx ) == m_memEventCallstack.end() );
+    m_memEventCallstack.emplace( m_threadCtx, MemEventPending { ev.order, false, m_threadCtx, TscTime( refTime - m_data.baseTime ), ev.ptr, 0, 0 } );
+}
+
+void Worker::ProcessCallstackMemory( const QueueCallstackMemory& ev )
+{
+    assert( m_pendingCallstackPtr == ev.ptr );
+    m_pendingCallstackPtr = 0;
+
+    auto it = m_memEventCallstack.find( m_threadCtx );
+    assert( it != m_memEventCallstack.end() );
+    auto mev = it->second;
+    m_memEventCallstack.erase( it );
+    mev.callstack = m_pendingCallstackId;
+    QueueMemEvent( mev );
+}
+
+// Memory events are retrieved from per-thread queues on the client, so they
+// arrive out of order. Each event carries an order stamp taken from a global
+// counter, which is used to restore the original order. Events are processed
+// as soon as all events with earlier stamps were seen. The merge window is
+// bounded, as stamps may be missing when the client runs in on-demand mode.
+void Worker::QueueMemEvent( const MemEventPending& ev )
+{
+    enum { MemEventWindowSize = 1024*1024 };
+
+    if( m_memJoinFilter )
+    {
+        // Events stamped before a late join are still queued on the client and
+        // may arrive after events stamped later. An allocation processed after
+        // its free would stay active forever, so these events are dropped.
+        const auto dist = int32_t( ev.order - m_memJoinOrder );
+        if( dist < 0 ) return;
+        // Stop before the stamps wrap around.
+        if( dist > ( 1 << 30 ) ) m_memJoinFilter = false;
+    }
+
+    if( int32_t( ev.order - m_memNextOrder ) < 0 )
+    {
+        // Late event, already skipped over.
+        if( ev.alloc ) HandleMemAlloc( ev ); else HandleMemFree( ev );
+        return;
+    }
+
+    auto& window = m_memEventWindow;
+    const auto cmp = [] ( const auto& lhs, const auto& rhs ) { return int32_t( lhs.order - rhs.order ) > 0; };
+    if( ev.order == m_memNextOrder && window.empty() )
+    {
+        m_memNextOrder++;
+        if( ev.alloc ) HandleMemAlloc( ev ); else HandleMemFree( ev );
+        return;
+    }
+
+    window.emplace_back( ev );
+    std::push_heap( window.begin(), window.end(), cmp );
+    while( !window.empty() && ( window.front().order == m_memNextOrder || window.size() > MemEventWindowSize ) && m_failure == Failure::None )
+    {
+        std::pop_heap( window.begin(), window.end(), cmp );
+        const auto next = window.back();
+        window.pop_back();
+        m_memNextOrder = next.order + 1;
+        if( next.alloc ) HandleMemAlloc( next ); else HandleMemFree( next );
+    }
+}
+
+void Worker::FlushMemEvents()
+{
+    for( auto& v : m_memEventCallstack ) m_memEventWindow.emplace_back( v.second );
+    m_memEventCallstack.clear();
+
+    auto& window = m_memEventWindow;
+    pdqsort_branchless( window.begin(), window.end(), [] ( const auto& lhs, const auto& rhs ) { return int32_t( lhs.order - rhs.order ) < 0; } );
+    for( auto& v : window )
+    {
+        if( m_failure != Failure::None ) break;
+        if( v.alloc ) HandleMemAlloc( v ); else HandleMemFree( v );
+    }
+    if( !window.empty() ) m_memNextOrder = window.back().order + 1;
+    window.clear();
+}
+
+void Worker::HandleMemAlloc( const MemEventPending& ev )
+{
+    // Order stamp and time are not retrieved atomically on the client.
+    const auto time = std::max( ev.time, m_memLastTime );
+    m_memLastTime = time;
+    if( m_data.lastTime < time ) m_data.lastTime = time;
+    NoticeThread( ev.thread );
+
+    assert( m_data.memory.active.find( ev.ptr ) == m_data.memory.active.end() );
+    assert( m_data.memory.data.empty() || m_data.memory.data.back().TimeAlloc() <= time );
+
+    m_data.memory.active.emplace( ev.ptr, m_data.memory.data.size() );
+
+    const auto ptr = ev.ptr;
+    const auto size = ev.size;
+
+    auto& mem = m_data.memory.data.push_next();
+    mem.SetPtr( ptr );
+    mem.SetSize( size );
+    mem.SetTimeThreadAlloc( time, CompressThread( ev.thread ) );
+    mem.SetTimeThreadFree( -1, 0 );
+    mem.SetCsAlloc( ev.callstack );
+    mem.csFree.SetVal( 0 );
+
+    const auto low = m_data.memory.low;
     const auto high = m_data.memory.high;
     const auto ptrend = ptr + size;
 
     m_data.memory.low = std::min( low, ptr );
     m_data.memory.high = std::max( high, ptrend );
-    m_data.memory.usage += size;
+    m_data.memory.usage += EstimateMemSize( size );
 
     MemAllocChanged( time );
 }
 
-bool Worker::ProcessMemFree( const QueueMemFree& ev )
+void Worker::HandleMemFree( const MemEventPending& ev )
 {
-    const auto refTime = m_refTimeSerial + ev.time;
-    m_refTimeSerial = refTime;
-
-    if( ev.ptr == 0 ) return false;
+    if( ev.ptr == 0 ) return;
 
     auto it = m_data.memory.active.find( ev.ptr );
     if( it == m_data.memory.active.end() )
@@ -5254,60 +6160,22 @@ bool Worker::ProcessMemFree( const QueueMemFree& ev )
             CheckThreadString( ev.thread );
             MemFreeFailure( ev.thread );
         }
-        return false;
+        return;
     }
 
-    const auto time = TscTime( refTime - m_data.baseTime );
+    const auto time = std::max( ev.time, m_memLastTime );
+    m_memLastTime = time;
     if( m_data.lastTime < time ) m_data.lastTime = time;
     NoticeThread( ev.thread );
 
     m_data.memory.frees.push_back( it->second );
     auto& mem = m_data.memory.data[it->second];
     mem.SetTimeThreadFree( time, CompressThread( ev.thread ) );
-    m_data.memory.usage -= mem.Size();
+    mem.csFree.SetVal( ev.callstack );
+    m_data.memory.usage -= EstimateMemSize( mem.Size() );
     m_data.memory.active.erase( it );
 
     MemAllocChanged( time );
-    return true;
-}
-
-void Worker::ProcessMemAllocCallstack( const QueueMemAlloc& ev )
-{
-    m_lastMemActionCallstack = m_data.memory.data.size();
-    ProcessMemAlloc( ev );
-    m_lastMemActionWasAlloc = true;
-}
-
-void Worker::ProcessMemFreeCallstack( const QueueMemFree& ev )
-{
-    if( ProcessMemFree( ev ) )
-    {
-        m_lastMemActionCallstack = m_data.memory.frees.back();
-        m_lastMemActionWasAlloc = false;
-    }
-    else
-    {
-        m_lastMemActionCallstack = std::numeric_limits<uint64_t>::max();
-    }
-}
-
-void Worker::ProcessCallstackMemory( const QueueCallstackMemory& ev )
-{
-    assert( m_pendingCallstackPtr == ev.ptr );
-    m_pendingCallstackPtr = 0;
-
-    if( m_lastMemActionCallstack != std::numeric_limits<uint64_t>::max() )
-    {
-        auto& mem = m_data.memory.data[m_lastMemActionCallstack];
-        if( m_lastMemActionWasAlloc )
-        {
-            mem.SetCsAlloc( m_pendingCallstackId );
-        }
-        else
-        {
-            mem.csFree.SetVal( m_pendingCallstackId );
-        }
-    }
 }
 
 void Worker::ProcessCallstack( const QueueCallstack& ev )
@@ -5316,6 +6184,7 @@ void Worker::ProcessCallstack( const QueueCallstack& ev )
     m_pendingCallstackPtr = 0;
 
     auto nit = m_nextCallstack.find( m_threadCtx );
+    if( m_lateJoin && nit == m_nextCallstack.end() ) return;
     assert( nit != m_nextCallstack.end() );
     auto& next = nit->second;
 
@@ -5353,6 +6222,7 @@ void Worker::ProcessCallstackAlloc( const QueueCallstackAlloc& ev )
     m_pendingCallstackPtr = 0;
 
     auto nit = m_nextCallstack.find( m_threadCtx );
+    if( m_lateJoin && nit == m_nextCallstack.end() ) return;
     assert( nit != m_nextCallstack.end() );
     auto& next = nit->second;
 
@@ -5719,6 +6589,142 @@ void Worker::ProcessCrashReport( const QueueCrashReport& ev )
     m_data.crashEvent.callstack = 0;
 }
 
+void Worker::InitTimerMapping()
+{
+    m_timerLast = TimerSegment { 0, 0, m_timerMul };
+    m_timerMaxTsc = 0;
+    m_timerSegments.clear();
+    m_timerSegments.push_back( m_timerLast );
+    m_timerCalibrated = false;
+}
+
+int64_t Worker::TscTimeSegment( int64_t tsc ) const
+{
+    assert( !m_timerSegments.empty() );
+    auto it = std::upper_bound( m_timerSegments.begin(), m_timerSegments.end(), tsc, [] ( const auto& l, const auto& r ) { return l < r.tsc; } );
+    if( it != m_timerSegments.begin() ) --it;
+    return it->time + int64_t( ( tsc - it->tsc ) * it->mul );
+}
+
+// Each calibration record starts a new segment of the timer mapping. The
+// mapping stays continuous and monotonic. Its slope follows the timer frequency
+// measured since the previous record, adjusted to make up for the difference
+// between the mapped time and the clock over the next interval. Events of other
+// threads with later timer values may have been mapped before the record is
+// processed, so the new segment starts after the largest timer value mapped so
+// far. Mapping of timer values which were already converted is never changed.
+void Worker::ProcessTimerCalibration( const QueueTimerCalibration& ev )
+{
+    const auto tsc = ev.time - m_data.baseTime;
+    if( tsc <= m_timerLast.tsc ) return;
+    const auto time = TscTime( tsc );
+
+    if( !m_timerCalibrated )
+    {
+        m_timerCalibrated = true;
+        m_timerCalibTsc = tsc;
+        m_timerCalibNs = ev.ns;
+        m_timerCalibOffset = time - ev.ns;
+        return;
+    }
+
+    const auto dtsc = tsc - m_timerCalibTsc;
+    const auto dns = ev.ns - m_timerCalibNs;
+    if( dns <= 0 ) return;
+    m_timerCalibTsc = tsc;
+    m_timerCalibNs = ev.ns;
+
+    const auto freq = double( dns ) / dtsc;
+    const auto err = double( time - ( ev.ns + m_timerCalibOffset ) );
+    const auto mul = std::min( std::max( freq - err / dtsc, freq * 0.5 ), freq * 2 );
+
+    const auto start = std::max( tsc, m_timerMaxTsc );
+    const auto startTime = m_timerLast.time + int64_t( ( start - m_timerLast.tsc ) * m_timerLast.mul );
+    assert( startTime >= m_timerLast.time && mul > 0 );
+    m_timerLast = TimerSegment { start, startTime, mul };
+    m_timerSegments.push_back( m_timerLast );
+}
+
+void Worker::ProcessZoneThrottleReport( const QueueZoneThrottleReport& ev )
+{
+    if( ev.dropped == 0 ) return;
+    m_data.zonesDropped[ShrinkSourceLocation( ev.srcloc )] += ev.dropped;
+}
+
+// Each level change closes the current range, and the counts of the dropped
+// events refer to it.
+void Worker::ProcessDataLoss( const QueueDataLoss& ev )
+{
+    const auto time = TscTime( ev.time - m_data.baseTime );
+    if( !m_data.dataLoss.empty() && m_data.dataLoss.back().end < 0 )
+    {
+        auto& range = m_data.dataLoss.back();
+        range.end = time;
+        range.callstacks += ev.callstacks;
+        range.zones += ev.zones;
+        range.other += ev.other;
+    }
+    if( ev.level != DataLossNone )
+    {
+        m_data.dataLoss.push_back( DataLossRange { time, -1, 0, 0, 0, ev.level } );
+    }
+    if( m_data.lastTime < time ) m_data.lastTime = time;
+}
+
+void Worker::ProcessZoneAggregate( const QueueZoneAggregate& ev )
+{
+    assert( m_pendingZoneAggregatePtr == ev.ptr );
+    m_pendingZoneAggregatePtr = 0;
+
+    auto td = m_threadCtxData;
+    if( !td ) td = m_threadCtxData = NoticeThread( m_threadCtx );
+
+    for( auto& v : m_pendingZoneAggregate )
+    {
+        CheckSourceLocation( v.srcloc );
+        const auto srcloc = ShrinkSourceLocation( v.srcloc );
+
+        ZoneAggregate agg;
+        agg.start = TscTime( v.start - m_data.baseTime );
+        agg.end = TscTime( v.end - m_data.baseTime );
+        agg.total = TscPeriod( v.total );
+        agg.min = TscPeriod( v.min );
+        agg.max = TscPeriod( v.max );
+        agg.count = v.count;
+        memcpy( agg.hist, v.hist, sizeof( agg.hist ) );
+
+        ZoneAggregateTrack* track = nullptr;
+        for( auto& t : td->zoneAggregates )
+        {
+            if( t.srcloc == srcloc )
+            {
+                track = &t;
+                break;
+            }
+        }
+        if( !track )
+        {
+            track = &td->zoneAggregates.push_next();
+            track->srcloc = srcloc;
+        }
+        // Idle intervals are sent by the profiler thread, which may overtake
+        // intervals still waiting in the client queue.
+        if( track->data.empty() || track->data.back().start <= agg.start )
+        {
+            track->data.push_back( agg );
+        }
+        else
+        {
+            auto it = std::upper_bound( track->data.begin(), track->data.end(), agg.start, [] ( const auto& l, const auto& r ) { return l < r.start; } );
+            track->data.insert( it, agg );
+        }
+
+        AddZoneAggregateStats( srcloc, agg );
+        if( m_data.lastTime < agg.end ) m_data.lastTime = agg.end;
+    }
+    m_pendingZoneAggregate.clear();
+}
+
 void Worker::ProcessSysTime( const QueueSysTime& ev )
 {
     const auto time = TscTime( ev.time - m_data.baseTime );
@@ -5784,6 +6790,9 @@ void Worker::ProcessContextSwitch( const QueueContextSwitch& ev )
             auto& cx = cs.back();
             assert( m_data.externalThreadCompress.DecompressThread( cx.Thread() ) == ev.oldThread );
             cx.SetEnd( time );
+#ifndef TRACY_NO_STATISTICS
+            if( GetPidFromTid( DecompressThreadExternal( cx.Thread() ) ) == m_pid ) UpdateCpuUsage( time, -1, -1, 0 ); else UpdateCpuUsage( time, -1, 0, -1 );
+#endif
         }
     }
     if( ev.newThread != 0 )
@@ -5825,6 +6834,9 @@ void Worker::ProcessContextSwitch( const QueueContextSwitch& ev )
         cx.SetStart( time );
         cx.SetEnd( -1 );
         cx.SetThread( m_data.externalThreadCompress.CompressThread( ev.newThread ) );
+#ifndef TRACY_NO_STATISTICS
+        if( GetPidFromTid( ev.newThread ) == m_pid ) UpdateCpuUsage( time, -1, 1, 0 ); else UpdateCpuUsage( time, -1, 0, 1 );
+#endif
 
         CheckExternalName( ev.newThread );
 
@@ -5866,7 +6878,26 @@ void Worker::ProcessThreadWakeup( const QueueThreadWakeup& ev )
 
 void Worker::ProcessTidToPid( const QueueTidToPid& ev )
 {
-    if( m_data.tidToPid.find( ev.tid ) == m_data.tidToPid.end() ) m_data.tidToPid.emplace( ev.tid, ev.pid );
+    if( m_data.tidToPid.find( ev.tid ) != m_data.tidToPid.end() ) return;
+    m_data.tidToPid.emplace( ev.tid, ev.pid );
+
+#ifndef TRACY_NO_STATISTICS
+    // The process of a thread is reported after its first context switches,
+    // which were counted as other process usage until now.
+    if( ev.pid != m_pid ) return;
+    auto it = m_data.ctxSwitch.find( ev.tid );
+    if( it == m_data.ctxSwitch.end() ) return;
+    for( auto& v : it->second->v )
+    {
+        if( v.Reason() == ContextSwitchData::Wakeup ) continue;
+        // Only regions present in the CPU data were counted.
+        auto& cs = m_data.cpuData[v.Cpu()].cs;
+        auto cit = std::lower_bound( cs.begin(), cs.end(), v.Start(), [] ( const auto& l, const auto& r ) { return l.Start() < r; } );
+        while( cit != cs.end() && cit->Start() == v.Start() && DecompressThreadExternal( cit->Thread() ) != ev.tid ) ++cit;
+        if( cit == cs.end() || cit->Start() != v.Start() ) continue;
+        UpdateCpuUsage( cit->Start(), cit->End(), 1, -1 );
+    }
+#endif
 }
 
 void Worker::ProcessParamSetup( const QueueParamSetup& ev )
@@ -5887,6 +6918,16 @@ void Worker::ProcessCpuTopology( const QueueCpuTopology& ev )
     m_data.cpuTopologyMap.emplace( ev.thread, CpuThreadTopology { ev.package, ev.core } );
 }
 
+// An allocation of size s is sampled with probability 1 - exp( -s / T ), where T
+// is the mean sampling interval. Weighting each sample by the inverse of this
+// probability gives an unbiased estimate of the allocated bytes.
+uint64_t Worker::EstimateMemSize( uint64_t size ) const
+{
+    const auto interval = m_data.memory.sampleInterval;
+    if( interval == 0 || size == 0 ) return size;
+    return uint64_t( double( size ) / ( 1.0 - exp( -double( size ) / interval ) ) );
+}
+
 void Worker::MemAllocChanged( int64_t time )
 {
     const auto val = (double)m_data.memory.usage;
@@ -5918,14 +6959,17 @@ void Worker::CreateMemAllocPlot()
     m_data.plots.Data().push_back( m_data.memory.plot );
 }
 
-void Worker::ReconstructMemAllocPlot()
+void Worker::ReconstructMemAllocPlot( bool freesSorted )
 {
     auto& mem = m_data.memory;
+    if( !freesSorted )
+    {
 #ifdef NO_PARALLEL_SORT
-    pdqsort_branchless( mem.frees.begin(), mem.frees.end(), [&mem] ( const auto& lhs, const auto& rhs ) { return mem.data[lhs].TimeFree() < mem.data[rhs].TimeFree(); } );
+        pdqsort_branchless( mem.frees.begin(), mem.frees.end(), [&mem] ( const auto& lhs, const auto& rhs ) { return mem.data[lhs].TimeFree() < mem.data[rhs].TimeFree(); } );
 #else
-    std::sort( std::execution::par_unseq, mem.frees.begin(), mem.frees.end(), [&mem] ( const auto& lhs, const auto& rhs ) { return mem.data[lhs].TimeFree() < mem.data[rhs].TimeFree(); } );
+        std::sort( std::execution::par_unseq, mem.frees.begin(), mem.frees.end(), [&mem] ( const auto& lhs, const auto& rhs ) { return mem.data[lhs].TimeFree() < mem.data[rhs].TimeFree(); } );
 #endif
+    }
 
     const auto psz = mem.data.size() + mem.frees.size() + 1;
 
@@ -5962,7 +7006,7 @@ void Worker::ReconstructMemAllocPlot()
         {
             if( atime < ftime )
             {
-                usage += int64_t( aptr->Size() );
+                usage += int64_t( EstimateMemSize( aptr->Size() ) );
                 assert( usage >= 0 );
                 if( max < usage ) max = usage;
                 ptr->time = atime;
@@ -5974,7 +7018,7 @@ void Worker::ReconstructMemAllocPlot()
             }
             else
             {
-                usage -= int64_t( mem.data[*fptr].Size() );
+                usage -= int64_t( EstimateMemSize( mem.data[*fptr].Size() ) );
                 assert( usage >= 0 );
                 if( max < usage ) max = usage;
                 ptr->time = ftime;
@@ -5991,7 +7035,7 @@ void Worker::ReconstructMemAllocPlot()
     {
         assert( aptr->TimeFree() < 0 );
         int64_t time = aptr->TimeAlloc();
-        usage += int64_t( aptr->Size() );
+        usage += int64_t( EstimateMemSize( aptr->Size() ) );
         assert( usage >= 0 );
         if( max < usage ) max = usage;
         ptr->time = time;
@@ -6003,7 +7047,7 @@ void Worker::ReconstructMemAllocPlot()
     {
         const auto& memData = mem.data[*fptr];
         int64_t time = memData.TimeFree();
-        usage -= int64_t( memData.Size() );
+        usage -= int64_t( EstimateMemSize( memData.Size() ) );
         assert( usage >= 0 );
         assert( max >= usage );
         ptr->time = time;
@@ -6020,26 +7064,27 @@ void Worker::ReconstructMemAllocPlot()
     m_data.memory.plot = plot;
 }
 
-#ifndef TRACY_NO_STATISTICS
-void Worker::ReconstructContextSwitchUsage()
+void Worker::CalcContextSwitchUsage( Vector<ContextSwitchUsage>& vec )
 {
     assert( m_data.cpuDataCount != 0 );
     const auto cpucnt = m_data.cpuDataCount;
 
-    auto& vec = m_data.ctxUsage;
     vec.push_back( ContextSwitchUsage( 0, 0, 0 ) );
 
     struct Cpu
     {
         bool startDone;
-        Vector<ContextSwitchCpu>::iterator it;
-        Vector<ContextSwitchCpu>::iterator end;
+        size_t it;
+        size_t end;
+        CpuDataReader data;
     };
     std::vector<Cpu> cpus;
     cpus.reserve( cpucnt );
     for( int i=0; i<cpucnt; i++ )
     {
-        cpus.emplace_back( Cpu { false, m_data.cpuData[i].cs.begin(), m_data.cpuData[i].cs.end() } );
+        CpuDataReader data( m_data.cpuData[i] );
+        const auto sz = data.size();
+        cpus.emplace_back( Cpu { false, 0, sz, std::move( data ) } );
     }
 
     uint8_t other = 0;
@@ -6053,7 +7098,7 @@ void Worker::ReconstructContextSwitchUsage()
             if( cpus[i].it != cpus[i].end )
             {
                 atEnd = false;
-                const auto ct = !cpus[i].startDone ? cpus[i].it->Start() : cpus[i].it->End();
+                const auto ct = !cpus[i].startDone ? cpus[i].data[cpus[i].it].Start() : cpus[i].data[cpus[i].it].End();
                 if( ct < nextTime ) nextTime = ct;
             }
         }
@@ -6062,9 +7107,9 @@ void Worker::ReconstructContextSwitchUsage()
         {
             while( cpus[i].it != cpus[i].end )
             {
-                const auto ct = !cpus[i].startDone ? cpus[i].it->Start() : cpus[i].it->End();
+                const auto ct = !cpus[i].startDone ? cpus[i].data[cpus[i].it].Start() : cpus[i].data[cpus[i].it].End();
                 if( nextTime != ct ) break;
-                const auto isOwn = GetPidFromTid( DecompressThreadExternal( cpus[i].it->Thread() ) ) == m_pid;
+                const auto isOwn = GetPidFromTid( DecompressThreadExternal( cpus[i].data[cpus[i].it].Thread() ) ) == m_pid;
                 if( !cpus[i].startDone )
                 {
                     if( isOwn )
@@ -6077,10 +7122,10 @@ void Worker::ReconstructContextSwitchUsage()
                         other++;
                         assert( other <= cpucnt );
                     }
-                    if( !cpus[i].it->IsEndValid() )
+                    if( !cpus[i].data[cpus[i].it].IsEndValid() )
                     {
                         cpus[i].it++;
-                        assert( cpus[i].it = cpus[i].end );
+                        assert( cpus[i].it == cpus[i].end );
                     }
                     else
                     {
@@ -6110,6 +7155,51 @@ void Worker::ReconstructContextSwitchUsage()
             vec.push_back( ContextSwitchUsage( nextTime, other, own ) );
         }
     }
+}
+
+#ifndef TRACY_NO_STATISTICS
+// Applies a change of CPU usage to the [start, end) time range. Negative end
+// extends the change to all later times. Context switches arrive mostly in
+// time order, so usually only the last usage entries are modified.
+void Worker::UpdateCpuUsage( int64_t start, int64_t end, int own, int other )
+{
+    auto& vec = m_data.ctxUsage;
+    if( vec.empty() ) vec.push_back( ContextSwitchUsage( 0, 0, 0 ) );
+    if( start < 0 ) start = 0;
+    if( end >= 0 && end <= start ) return;
+
+    // Returns index of the entry starting at the given time, creating it if needed.
+    auto split = [&vec] ( int64_t time ) -> size_t {
+        auto it = vec.end();
+        if( vec.back().Time() > time )
+        {
+            it = std::upper_bound( vec.begin(), vec.end(), time, [] ( const auto& l, const auto& r ) { return l < r.Time(); } );
+        }
+        auto prev = it - 1;
+        if( prev->Time() == time ) return size_t( prev - vec.begin() );
+        const auto idx = size_t( it - vec.begin() );
+        vec.insert( it, ContextSwitchUsage( time, prev->Other(), prev->Own() ) );
+        return idx;
+    };
+
+    const auto first = split( start );
+    const auto last = end < 0 ? vec.size() : split( end );
+    for( size_t i=first; i<last; i++ )
+    {
+        auto& v = vec[i];
+        assert( int( v.Own() ) + own >= 0 && int( v.Other() ) + other >= 0 );
+        v.SetOwn( v.Own() + own );
+        v.SetOther( v.Other() + other );
+    }
+
+    // Entries are only stored where the usage changes.
+    if( last != vec.size() && vec[last].Own() == vec[last-1].Own() && vec[last].Other() == vec[last-1].Other() ) vec.erase( vec.begin() + last );
+    if( first != 0 && vec[first].Own() == vec[first-1].Own() && vec[first].Other() == vec[first-1].Other() ) vec.erase( vec.begin() + first );
+}
+
+void Worker::ReconstructContextSwitchUsage()
+{
+    CalcContextSwitchUsage( m_data.ctxUsage );
 
     std::lock_guard<std::shared_mutex> lock( m_data.lock );
     m_data.ctxUsageReady = true;
@@ -6294,14 +7384,23 @@ void Worker::UpdateSampleStatisticsImpl( const CallstackFrameData** frames, uint
 }
 #endif
 
-int64_t Worker::ReadTimeline( FileRead& f, ZoneEvent* zone, int64_t refTime, int32_t& childIdx )
+int64_t Worker::ReadTimelineHaveSize( FileRead& f, ZoneEvent* zone, int64_t refTime, int32_t& childIdx, uint32_t sz )
 {
-    uint32_t sz;
-    f.Read( sz );
-    return ReadTimelineHaveSize( f, zone, refTime, childIdx, sz );
+    if( sz == 0 )
+    {
+        zone->SetChild( -1 );
+        return refTime;
+    }
+    else
+    {
+        const auto idx = childIdx;
+        childIdx++;
+        zone->SetChild( idx );
+        return ReadTimeline( f, m_data.zoneChildren[idx], sz, refTime, childIdx );
+    }
 }
 
-int64_t Worker::ReadTimelineHaveSize( FileRead& f, ZoneEvent* zone, int64_t refTime, int32_t& childIdx, uint32_t sz )
+int64_t Worker::ReadTimelineHaveSizePre0612( FileRead& f, ZoneEvent* zone, int64_t refTime, int32_t& childIdx, uint32_t sz )
 {
     if( sz == 0 )
     {
@@ -6313,7 +7412,7 @@ int64_t Worker::ReadTimelineHaveSize( FileRead& f, ZoneEvent* zone, int64_t refT
         const auto idx = childIdx;
         childIdx++;
         zone->SetChild( idx );
-        return ReadTimeline( f, m_data.zoneChildren[idx], sz, refTime, childIdx );
+        return ReadTimelinePre0612( f, m_data.zoneChildren[idx], sz, refTime, childIdx );
     }
 }
 
@@ -6388,15 +7487,123 @@ void Worker::ReadTimelinePre0510( FileRead& f, GpuEvent* zone, int64_t& refTime,
 }
 
 #ifndef TRACY_NO_STATISTICS
-void Worker::ReconstructZoneStatistics( ZoneEvent& zone, uint16_t thread )
+void Worker::ReconstructZoneStatistics()
+{
+    struct PartialData
+    {
+        std::mutex lock;
+        unordered_flat_map<int16_t, SourceLocationZones> slz;
+    };
+
+    // Wait() runs jobs also on the calling thread.
+    const auto jobs = TaskDispatch::Get().NumWorkers();
+    TaskGroup group;
+
+    // Each running job accumulates into a free partial data set, so that there are
+    // never more sets than jobs which can be executed in parallel.
+    std::vector<PartialData> partial( jobs + 1 );
+    auto ProcessChunk = [this, &partial] ( ZoneEvent* begin, ZoneEvent* end, uint16_t thread ) {
+        for(;;)
+        {
+            for( auto& p : partial )
+            {
+                if( p.lock.try_lock() )
+                {
+                    ReconstructZoneStatistics( p.slz, begin, end, thread );
+                    p.lock.unlock();
+                    return;
+                }
+            }
+        }
+    };
+
+    // Big threads are split into chunks of top-level zones, so that the work is
+    // distributed even if a single thread dominates the trace.
+    size_t total = 0;
+    for( auto& t : m_data.threads ) total += t->timeline.size();
+    const auto chunkSize = std::max<size_t>( total / ( jobs * 8 ), 1 );
+    for( auto& t : m_data.threads )
+    {
+        if( t->timeline.empty() ) continue;
+        assert( t->timeline.is_magic() );
+        auto& vec = *(Vector<ZoneEvent>*)( &t->timeline );
+        // Don't touch thread compression cache in a thread.
+        const auto thread = m_data.localThreadCompress.DecompressMustRaw( t->id );
+        auto ptr = vec.begin();
+        const auto end = vec.end();
+        while( ptr != end )
+        {
+            const auto next = std::min<size_t>( end - ptr, chunkSize ) + ptr;
+            group.Run( [ProcessChunk, ptr, next, thread] { ProcessChunk( ptr, next, thread ); } );
+            ptr = next;
+        }
+    }
+    group.Wait();
+    if( m_shutdown.load( std::memory_order_relaxed ) ) return;
+
+    for( auto& v : m_data.sourceLocationZones )
+    {
+        const auto srcloc = v.first;
+        auto slz = &v.second;
+        group.Run( [srcloc, slz, &partial] {
+            size_t sz = 0;
+            for( auto& p : partial )
+            {
+                auto it = p.slz.find( srcloc );
+                if( it == p.slz.end() ) continue;
+                auto& src = it->second;
+                sz += src.zones.size();
+                if( slz->min > src.min ) slz->min = src.min;
+                if( slz->max < src.max ) slz->max = src.max;
+                slz->total += src.total;
+                slz->sumSq += src.sumSq;
+                if( slz->selfMin > src.selfMin ) slz->selfMin = src.selfMin;
+                if( slz->selfMax < src.selfMax ) slz->selfMax = src.selfMax;
+                slz->selfTotal += src.selfTotal;
+            }
+            if( sz == 0 ) return;
+            auto& zones = slz->zones;
+            assert( zones.empty() );
+            zones.reserve_and_use( sz );
+            auto dst = zones.data();
+            for( auto& p : partial )
+            {
+                auto it = p.slz.find( srcloc );
+                if( it == p.slz.end() ) continue;
+                auto& src = it->second.zones;
+                memcpy( dst, src.data(), src.size() * sizeof( ZoneThreadData ) );
+                dst += src.size();
+            }
+            pdqsort_branchless( zones.begin(), zones.end(), []( const auto& lhs, const auto& rhs ) { return lhs.Zone()->Start() < rhs.Zone()->Start(); } );
+        } );
+    }
+    group.Wait();
+}
+
+void Worker::ReconstructZoneStatistics( unordered_flat_map<int16_t, SourceLocationZones>& slzMap, ZoneEvent* zone, ZoneEvent* end, uint16_t thread )
+{
+    if( m_shutdown.load( std::memory_order_relaxed ) ) return;
+    while( zone != end )
+    {
+        if( zone->IsEndValid() ) ReconstructZoneStatistics( slzMap, *zone, thread );
+        if( zone->HasChildren() )
+        {
+            auto& children = GetZoneChildrenMutable( zone->Child() );
+            assert( children.is_magic() );
+            auto& vec = *(Vector<ZoneEvent>*)( &children );
+            ReconstructZoneStatistics( slzMap, vec.begin(), vec.end(), thread );
+        }
+        zone++;
+    }
+}
+
+void Worker::ReconstructZoneStatistics( unordered_flat_map<int16_t, SourceLocationZones>& slzMap, ZoneEvent& zone, uint16_t thread )
 {
     assert( zone.IsEndValid() );
     auto timeSpan = zone.End() - zone.Start();
     if( timeSpan > 0 )
     {
-        auto it = m_data.sourceLocationZones.find( zone.SrcLoc() );
-        assert( it != m_data.sourceLocationZones.end() );
-        auto& slz = it->second;
+        auto& slz = slzMap[zone.SrcLoc()];
         auto& ztd = slz.zones.push_next();
         ztd.SetZone( &zone );
         ztd.SetThread( thread );
@@ -6429,6 +7636,203 @@ void Worker::CountZoneStatistics( ZoneEvent* zone )
 #endif
 
 int64_t Worker::ReadTimeline( FileRead& f, Vector<short_ptr<ZoneEvent>>& _vec, uint32_t size, int64_t refTime, int32_t& childIdx )
+{
+    assert( size != 0 );
+    const auto lp = s_loadProgress.subProgress.load( std::memory_order_relaxed );
+    s_loadProgress.subProgress.store( lp + size, std::memory_order_relaxed );
+    auto& vec = *(Vector<ZoneEvent>*)( &_vec );
+    vec.set_magic();
+    vec.reserve_exact( size, m_slab );
+    auto zone = vec.begin();
+    auto end = vec.end();
+    do
+    {
+        int16_t srcloc;
+        int64_t tstart, tlen;
+        uint32_t childSz, extra;
+        f.Read5( srcloc, tstart, extra, tlen, childSz );
+        refTime += tstart;
+        zone->SetStartSrcLoc( refTime, srcloc );
+        zone->extra = extra;
+        ReadTimelineHaveSize( f, zone, refTime, childIdx, childSz );
+        refTime += tlen;
+        zone->SetEnd( refTime );
+#ifdef TRACY_NO_STATISTICS
+        CountZoneStatistics( zone );
+#endif
+    }
+    while( ++zone != end );
+
+    return refTime;
+}
+
+uint64_t Worker::ReadTimelineFiltered( FileRead& f, Vector<short_ptr<ZoneEvent>>& _vec, uint32_t size, int32_t& childIdx, const LoadFilter& filter, const unordered_flat_set<int16_t>& zoneFilter )
+{
+    assert( size != 0 );
+    const auto lp = s_loadProgress.subProgress.load( std::memory_order_relaxed );
+    s_loadProgress.subProgress.store( lp + size, std::memory_order_relaxed );
+
+    // Top-level zone count is not known before the whole timeline is read.
+    std::vector<ZoneEvent> tmp;
+    uint64_t skipped = 0;
+    int64_t refTime = 0;
+    for( uint32_t i=0; i<size; i++ )
+    {
+        int16_t srcloc;
+        int64_t tstart, tlen;
+        uint32_t childSz, extra;
+        f.Read5( srcloc, tstart, extra, tlen, childSz );
+        refTime += tstart;
+        const auto start = refTime;
+        refTime += tlen;
+        const auto end = refTime >= 0 ? refTime : std::numeric_limits<int64_t>::max();
+
+        if( end >= filter.timeMin && start <= filter.timeMax && ( zoneFilter.empty() || zoneFilter.find( srcloc ) != zoneFilter.end() ) )
+        {
+            auto& zone = tmp.emplace_back();
+            zone.SetStartSrcLoc( start, srcloc );
+            zone.extra = extra;
+            ReadTimelineHaveSize( f, &zone, start, childIdx, childSz );
+            zone.SetEnd( refTime );
+#ifdef TRACY_NO_STATISTICS
+            CountZoneStatistics( &zone );
+#endif
+        }
+        else
+        {
+            skipped++;
+            if( childSz != 0 ) skipped += SkipTimeline( f, childSz );
+        }
+    }
+
+    if( !tmp.empty() )
+    {
+        auto& vec = *(Vector<ZoneEvent>*)( &_vec );
+        vec.set_magic();
+        vec.reserve_exact( tmp.size(), m_slab );
+        memcpy( vec.data(), tmp.data(), tmp.size() * sizeof( ZoneEvent ) );
+    }
+    return skipped;
+}
+
+void Worker::BuildZoneColumns( const Vector<short_ptr<ZoneEvent>>& _vec )
+{
+    if( !_vec.is_magic() || _vec.size() < ZoneColumns::MinZones ) return;
+    auto& vec = *(const Vector<ZoneEvent>*)( &_vec );
+    const auto sz = vec.size();
+    const auto blocks = ( sz + ZoneColumns::BlockSize - 1 ) / ZoneColumns::BlockSize;
+
+    auto& cols = m_data.zoneColumns.emplace( vec.data(), ZoneColumns() ).first->second;
+    cols.start.reserve_exact( blocks, m_slab );
+    cols.end.reserve_exact( blocks, m_slab );
+    for( size_t i=0; i<blocks; i++ )
+    {
+        const auto& zone = vec[std::min<size_t>( ( i + 1 ) * ZoneColumns::BlockSize, sz ) - 1];
+        cols.start[i] = zone.Start();
+        cols.end[i] = zone.End();
+    }
+}
+
+uint64_t Worker::SkipTimeline( FileRead& f, uint32_t size )
+{
+    uint64_t cnt = size;
+    for( uint32_t i=0; i<size; i++ )
+    {
+        uint32_t childSz;
+        f.Skip( sizeof( int16_t ) + sizeof( int64_t ) + sizeof( uint32_t ) + sizeof( int64_t ) );
+        f.Read( childSz );
+        if( childSz != 0 ) cnt += SkipTimeline( f, childSz );
+    }
+    return cnt;
+}
+
+void Worker::ReadLockTimelineFiltered( FileRead& f, LockMap& lockmap, uint64_t size, const LoadFilter& filter )
+{
+    // Lock state is derived from the whole event history, so the timeline
+    // can only be cut at points where the lock is not held or waited for.
+    std::vector<LockEventShared> tmp;
+    tmp.reserve( size );
+    uint64_t first = 0;
+    uint64_t last = size;
+    uint8_t lockCount = 0;
+    uint64_t waitList = 0;
+    uint64_t waitShared = 0;
+    uint64_t sharedList = 0;
+    int64_t refTime = lockmap.timeAnnounce;
+    for( uint64_t i=0; i<size; i++ )
+    {
+        auto& ev = tmp.emplace_back();
+        const auto lt = ReadTimeOffset( f, refTime );
+        ev.SetTime( lt );
+        int16_t srcloc;
+        f.Read( srcloc );
+        ev.SetSrcLoc( srcloc );
+        f.Read( &ev.thread, sizeof( LockEvent::thread ) + sizeof( LockEvent::type ) );
+
+        const auto tbit = uint64_t( 1 ) << ev.thread;
+        switch( (LockEvent::Type)ev.type )
+        {
+        case LockEvent::Type::Wait:
+            waitList |= tbit;
+            break;
+        case LockEvent::Type::WaitShared:
+            waitShared |= tbit;
+            break;
+        case LockEvent::Type::Obtain:
+            waitList &= ~tbit;
+            lockCount++;
+            break;
+        case LockEvent::Type::Release:
+            if( lockCount > 0 ) lockCount--;
+            break;
+        case LockEvent::Type::ObtainShared:
+            waitShared &= ~tbit;
+            sharedList |= tbit;
+            break;
+        case LockEvent::Type::ReleaseShared:
+            sharedList &= ~tbit;
+            break;
+        default:
+            break;
+        }
+
+        if( lockCount == 0 && waitList == 0 && waitShared == 0 && sharedList == 0 )
+        {
+            if( lt < filter.timeMin )
+            {
+                first = i + 1;
+            }
+            else if( lt >= filter.timeMax && last == size )
+            {
+                last = i + 1;
+            }
+        }
+    }
+
+    if( first >= last ) return;
+    const auto sz = last - first;
+    lockmap.timeline.reserve_exact( sz, m_slab );
+    auto ptr = lockmap.timeline.data();
+    for( uint64_t i=first; i<last; i++ )
+    {
+        const auto& ev = tmp[i];
+        LockEvent* lev;
+        if( lockmap.type == LockType::Lockable )
+        {
+            lev = m_slab.Alloc<LockEvent>();
+            memcpy( lev, &ev, sizeof( LockEvent ) );
+        }
+        else
+        {
+            lev = m_slab.Alloc<LockEventShared>();
+            memcpy( lev, &ev, sizeof( LockEventShared ) );
+        }
+        *ptr++ = { lev };
+        UpdateLockRange( lockmap, *lev, lev->Time() );
+    }
+}
+
+int64_t Worker::ReadTimelinePre0612( FileRead& f, Vector<short_ptr<ZoneEvent>>& _vec, uint32_t size, int64_t refTime, int32_t& childIdx )
 {
     assert( size != 0 );
     const auto lp = s_loadProgress.subProgress.load( std::memory_order_relaxed );
@@ -6449,7 +7853,7 @@ int64_t Worker::ReadTimeline( FileRead& f, Vector<short_ptr<ZoneEvent>>& _vec, u
         refTime += tstart;
         zone->SetStartSrcLoc( refTime, srcloc );
         zone->extra = extra;
-        refTime = ReadTimelineHaveSize( f, zone, refTime, childIdx, childSz );
+        refTime = ReadTimelineHaveSizePre0612( f, zone, refTime, childIdx, childSz );
         f.Read5( tend, srcloc, tstart, extra, childSz );
         refTime += tend;
         zone->SetEnd( refTime );
@@ -6462,7 +7866,7 @@ int64_t Worker::ReadTimeline( FileRead& f, Vector<short_ptr<ZoneEvent>>& _vec, u
     refTime += tstart;
     zone->SetStartSrcLoc( refTime, srcloc );
     zone->extra = extra;
-    refTime = ReadTimelineHaveSize( f, zone, refTime, childIdx, childSz );
+    refTime = ReadTimelineHaveSizePre0612( f, zone, refTime, childIdx, childSz );
     f.Read( tend );
     refTime += tend;
     zone->SetEnd( refTime );
@@ -6666,7 +8070,7 @@ void Worker::Disconnect()
     m_disconnect = true;
 }
 
-void Worker::Write( FileWrite& f )
+void Worker::Write( FileWrite& f, bool statsCache )
 {
     f.Write( FileHeader, sizeof( FileHeader ) );
 
@@ -6678,6 +8082,7 @@ void Worker::Write( FileWrite& f )
     f.Write( &m_pid, sizeof( m_pid ) );
     f.Write( &m_samplingPeriod, sizeof( m_samplingPeriod ) );
     f.Write( &m_data.cpuArch, sizeof( m_data.cpuArch ) );
+    f.Write( &m_data.memory.sampleInterval, sizeof( m_data.memory.sampleInterval ) );
 
     uint64_t sz = m_captureName.size();
     f.Write( &sz, sizeof( sz ) );
@@ -6744,13 +8149,30 @@ void Worker::Write( FileWrite& f )
 
     sz = m_data.stringData.size();
     f.Write( &sz, sizeof( sz ) );
-    for( auto& v : m_data.stringData )
     {
-        uint64_t ptr = (uint64_t)v;
-        f.Write( &ptr, sizeof( ptr ) );
-        sz = strlen( v );
-        f.Write( &sz, sizeof( sz ) );
-        f.Write( v, sz );
+        // Each string only stores the part which differs from the previous one.
+        // Strings are kept in the order they were added. Sorting them gives
+        // longer shared prefixes, but each string then has to store its index,
+        // and the pointers are no longer ascending, which makes the compressed
+        // trace larger.
+        const char* prev = "";
+        uint32_t prevSz = 0;
+        for( size_t i=0; i<m_data.stringData.size(); i++ )
+        {
+            const auto v = m_data.stringData[i];
+            uint64_t ptr = (uint64_t)v;
+            f.Write( &ptr, sizeof( ptr ) );
+            const auto len = uint32_t( strlen( v ) );
+            const auto maxShared = std::min( len, prevSz );
+            uint32_t shared = 0;
+            while( shared < maxShared && v[shared] == prev[shared] ) shared++;
+            const uint32_t ssz = len - shared;
+            f.Write( &shared, sizeof( shared ) );
+            f.Write( &ssz, sizeof( ssz ) );
+            f.Write( v + shared, ssz );
+            prev = v;
+            prevSz = len;
+        }
     }
 
     sz = m_data.strings.size();
@@ -6807,6 +8229,26 @@ void Worker::Write( FileWrite& f )
         f.Write( v, sizeof( SourceLocationBase ) );
     }
 
+    sz = m_data.zonesDropped.size();
+    f.Write( &sz, sizeof( sz ) );
+    for( auto& v : m_data.zonesDropped )
+    {
+        f.Write( &v.first, sizeof( v.first ) );
+        f.Write( &v.second, sizeof( v.second ) );
+    }
+
+    sz = m_data.dataLoss.size();
+    f.Write( &sz, sizeof( sz ) );
+    for( auto& v : m_data.dataLoss )
+    {
+        f.Write( &v.start, sizeof( v.start ) );
+        f.Write( &v.end, sizeof( v.end ) );
+        f.Write( &v.callstacks, sizeof( v.callstacks ) );
+        f.Write( &v.zones, sizeof( v.zones ) );
+        f.Write( &v.other, sizeof( v.other ) );
+        f.Write( &v.level, sizeof( v.level ) );
+    }
+
 #ifndef TRACY_NO_STATISTICS
     sz = m_data.sourceLocationZones.size();
     f.Write( &sz, sizeof( sz ) );
@@ -6906,6 +8348,15 @@ void Worker::Write( FileWrite& f )
             WriteTimeOffset( f, refTime, v.time.Val() );
             f.Write( &v.callstack, sizeof( v.callstack ) );
         }
+        sz = thread->zoneAggregates.size();
+        f.Write( &sz, sizeof( sz ) );
+        for( auto& v : thread->zoneAggregates )
+        {
+            f.Write( &v.srcloc, sizeof( v.srcloc ) );
+            sz = v.data.size();
+            f.Write( &sz, sizeof( sz ) );
+            f.Write( v.data.data(), sz * sizeof( ZoneAggregate ) );
+        }
     }
 
     sz = 0;
@@ -7062,11 +8513,13 @@ void Worker::Write( FileWrite& f )
     f.Write( &sz, sizeof( sz ) );
     for( int i=0; i<256; i++ )
     {
-        sz = m_data.cpuData[i].cs.size();
+        CpuDataReader cs( m_data.cpuData[i] );
+        sz = cs.size();
         f.Write( &sz, sizeof( sz ) );
         int64_t refTime = 0;
-        for( auto& cx : m_data.cpuData[i].cs )
+        for( uint64_t j=0; j<sz; j++ )
         {
+            const auto cx = cs[j];
             WriteTimeOffset( f, refTime, cx.Start() );
             WriteTimeOffset( f, refTime, cx.End() );
             uint16_t thread = cx.Thread();
@@ -7127,6 +8580,126 @@ void Worker::Write( FileWrite& f )
             f.Write( &diff, sizeof( diff ) );
         }
     }
+
+    const uint8_t hasCache = statsCache ? 1 : 0;
+    f.Write( &hasCache, sizeof( hasCache ) );
+    if( statsCache ) WriteStatisticsCache( f );
+}
+
+void Worker::WriteStatisticsCache( FileWrite& f )
+{
+    unordered_flat_map<int16_t, SourceLocationZonesCache> cache;
+    uint32_t childIdx = 0;
+    for( size_t i=0; i<m_data.threads.size(); i++ )
+    {
+        CacheTimeline( cache, m_data.threads[i]->timeline, uint32_t( i ), uint16_t( i ), childIdx );
+    }
+
+    uint64_t sz = cache.size();
+    f.Write( &sz, sizeof( sz ) );
+    for( auto& v : cache )
+    {
+        auto& slz = v.second;
+        pdqsort_branchless( slz.zones.begin(), slz.zones.end(), []( const auto& lhs, const auto& rhs ) { return lhs.start < rhs.start; } );
+        f.Write( &v.first, sizeof( v.first ) );
+        sz = slz.zones.size();
+        f.Write( &sz, sizeof( sz ) );
+        f.Write( &slz.min, sizeof( slz.min ) );
+        f.Write( &slz.max, sizeof( slz.max ) );
+        f.Write( &slz.total, sizeof( slz.total ) );
+        f.Write( &slz.sumSq, sizeof( slz.sumSq ) );
+        f.Write( &slz.selfMin, sizeof( slz.selfMin ) );
+        f.Write( &slz.selfMax, sizeof( slz.selfMax ) );
+        f.Write( &slz.selfTotal, sizeof( slz.selfTotal ) );
+        for( auto& z : slz.zones )
+        {
+            f.Write( &z.vec, sizeof( z.vec ) );
+            f.Write( &z.idx, sizeof( z.idx ) );
+            f.Write( &z.thread, sizeof( z.thread ) );
+        }
+    }
+
+    if( m_data.cpuDataCount != 0 )
+    {
+        Vector<ContextSwitchUsage> ctxUsage;
+        CalcContextSwitchUsage( ctxUsage );
+        sz = ctxUsage.size();
+        f.Write( &sz, sizeof( sz ) );
+        f.Write( ctxUsage.data(), sz * sizeof( ContextSwitchUsage ) );
+    }
+    else
+    {
+        sz = 0;
+        f.Write( &sz, sizeof( sz ) );
+    }
+
+    // Frees are stored in order of memory events, but memory plot needs them sorted by time.
+    auto& mem = m_data.memory;
+    std::vector<uint32_t> frees( mem.frees.begin(), mem.frees.end() );
+    pdqsort_branchless( frees.begin(), frees.end(), [&mem] ( const auto& lhs, const auto& rhs ) { return mem.data[lhs].TimeFree() < mem.data[rhs].TimeFree(); } );
+    sz = frees.size();
+    f.Write( &sz, sizeof( sz ) );
+    f.Write( frees.data(), sz * sizeof( uint32_t ) );
+}
+
+void Worker::CacheTimeline( unordered_flat_map<int16_t, SourceLocationZonesCache>& cache, const Vector<short_ptr<ZoneEvent>>& vec, uint32_t vecIdx, uint16_t thread, uint32_t& childIdx )
+{
+    if( vec.is_magic() )
+    {
+        CacheTimelineImpl<VectorAdapterDirect<ZoneEvent>>( cache, *(Vector<ZoneEvent>*)( &vec ), vecIdx, thread, childIdx );
+    }
+    else
+    {
+        CacheTimelineImpl<VectorAdapterPointer<ZoneEvent>>( cache, vec, vecIdx, thread, childIdx );
+    }
+}
+
+template<typename Adapter, typename V>
+void Worker::CacheTimelineImpl( unordered_flat_map<int16_t, SourceLocationZonesCache>& cache, const V& vec, uint32_t vecIdx, uint16_t thread, uint32_t& childIdx )
+{
+    Adapter a;
+    uint32_t idx = 0;
+    for( auto& val : vec )
+    {
+        auto& v = a(val);
+        const Vector<short_ptr<ZoneEvent>>* children = nullptr;
+        if( v.HasChildren() )
+        {
+            children = &GetZoneChildren( v.Child() );
+            // Empty children vectors are not recreated by the loader.
+            if( children->empty() ) children = nullptr;
+        }
+        auto timeSpan = v.End() - v.Start();
+        if( v.IsEndValid() && timeSpan > 0 )
+        {
+            auto& slz = cache[v.SrcLoc()];
+            slz.zones.emplace_back( SourceLocationZonesCache::Zone { v.Start(), vecIdx, idx, thread } );
+            if( slz.min > timeSpan ) slz.min = timeSpan;
+            if( slz.max < timeSpan ) slz.max = timeSpan;
+            slz.total += timeSpan;
+            slz.sumSq += double( timeSpan ) * timeSpan;
+            if( children )
+            {
+                if( children->is_magic() )
+                {
+                    for( auto& c : *(const Vector<ZoneEvent>*)( children ) ) timeSpan -= std::max( int64_t( 0 ), c.End() - c.Start() );
+                }
+                else
+                {
+                    for( auto& c : *children ) timeSpan -= std::max( int64_t( 0 ), c->End() - c->Start() );
+                }
+            }
+            if( slz.selfMin > timeSpan ) slz.selfMin = timeSpan;
+            if( slz.selfMax < timeSpan ) slz.selfMax = timeSpan;
+            slz.selfTotal += timeSpan;
+        }
+        if( children )
+        {
+            const auto childVec = uint32_t( m_data.threads.size() ) + childIdx++;
+            CacheTimeline( cache, *children, childVec, thread, childIdx );
+        }
+        idx++;
+    }
 }
 
 void Worker::WriteTimeline( FileWrite& f, const Vector<short_ptr<ZoneEvent>>& vec, int64_t& refTime )
@@ -7155,6 +8728,8 @@ void Worker::WriteTimelineImpl( FileWrite& f, const V& vec, int64_t& refTime )
         int64_t start = v.Start();
         WriteTimeOffset( f, refTime, start );
         f.Write( &v.extra, sizeof( v.extra ) );
+        // Zone length precedes children, so that loader may skip whole subtrees.
+        WriteTimeOffset( f, refTime, v.End() );
         if( !v.HasChildren() )
         {
             const uint32_t sz = 0;
@@ -7162,9 +8737,9 @@ void Worker::WriteTimelineImpl( FileWrite& f, const V& vec, int64_t& refTime )
         }
         else
         {
-            WriteTimeline( f, GetZoneChildren( v.Child() ), refTime );
+            int64_t childRefTime = start;
+            WriteTimeline( f, GetZoneChildren( v.Child() ), childRefTime );
         }
-        WriteTimeOffset( f, refTime, v.End() );
     }
 }
 
@@ -7239,6 +8814,29 @@ void Worker::SetParameter( size_t paramIdx, int32_t val )
     Query( ServerQueryParameter, ( idx << 32 ) | v );
 }
 
+uint64_t Worker::GetZonesDropped( int16_t srcloc ) const
+{
+    auto it = m_data.zonesDropped.find( srcloc );
+    if( it == m_data.zonesDropped.end() ) return 0;
+    return it->second;
+}
+
+uint32_t Worker::GetZoneThrottle( int16_t srcloc ) const
+{
+    auto it = m_zoneThrottle.find( srcloc );
+    if( it == m_zoneThrottle.end() ) return 0;
+    return it->second;
+}
+
+void Worker::SetZoneThrottle( int16_t srcloc, ZoneThrottleMode mode, uint32_t value )
+{
+    assert( srcloc > 0 );
+    const auto setting = mode == ZoneThrottleNone ? 0 : ( uint32_t( mode ) << ZoneThrottleValueBits ) | std::min<uint32_t>( value, ZoneThrottleValueMask );
+    if( setting == 0 ) m_zoneThrottle.erase( srcloc );
+    else m_zoneThrottle[srcloc] = setting;
+    Query( ServerQueryZoneThrottle, m_data.sourceLocationExpand[srcloc], setting );
+}
+
 const Worker::CpuThreadTopology* Worker::GetThreadTopology( uint32_t cpuThread ) const
 {
     auto it = m_data.cpuTopologyMap.find( cpuThread );
@@ -21,8 +21,11 @@
 #include "TracyShortPtr.hpp"
 #include "TracySlab.hpp"
 #include "TracyStringDiscovery.hpp"
+#include "TracyStringTable.hpp"
+#include "TracyTaskDispatch.hpp"
 #include "TracyTextureCompression.hpp"
 #include "TracyThreadCompress.hpp"
+#include "TracyTrigramIndex.hpp"
 #include "TracyVarArray.hpp"
 
 
@@ -87,6 +90,27 @@ struct LoadProgress
     std::atomic<uint64_t> subProgress;
 };
 
+// Restricts which parts of a trace are loaded from file. Zone filtering is
+// done on the top-level zones of each thread timeline: a zone (together with
+// all of its children) is kept only if it overlaps the [timeMin, timeMax]
+// range and, if the zone name list is not empty, if its name is on the list.
+// Data of threads not present on the non-empty thread list is skipped.
+// Messages, samples, plot points, memory events and context switches are
+// kept if they fall within (or, for events with duration, overlap) the time
+// range. Lock timelines are cut at the last point before, and the first
+// point after the range at which the lock is free. Frames and GPU zones are
+// always kept in full. Filtering requires trace version 0.6.12 or newer, older traces are always
+// loaded in full.
+struct LoadFilter
+{
+    bool IsActive() const { return timeMin != std::numeric_limits<int64_t>::min() || timeMax != std::numeric_limits<int64_t>::max() || !threads.empty() || !zones.empty(); }
+
+    int64_t timeMin = std::numeric_limits<int64_t>::min();
+    int64_t timeMax = std::numeric_limits<int64_t>::max();
+    std::vector<uint64_t> threads;
+    std::vector<std::string> zones;
+};
+
 class Worker
 {
 public:
@@ -122,6 +146,15 @@ public:
         uint32_t core;
     };
 
+    struct ZoneAggregateStats
+    {
+        uint64_t count = 0;
+        int64_t total = 0;
+        int64_t min = std::numeric_limits<int64_t>::max();
+        int64_t max = 0;
+        uint64_t hist[ZoneAggregateBuckets] = {};
+    };
+
     struct SymbolCodeData
     {
         const char* data;
@@ -141,6 +174,28 @@ private:
         int64_t selfTotal = 0;
     };
 
+    // Zone references are stored as an index of the zone vector, in the order in which
+    // the vectors are created by the loader, and as an index of zone in the vector.
+    struct SourceLocationZonesCache
+    {
+        struct Zone
+        {
+            int64_t start;
+            uint32_t vec;
+            uint32_t idx;
+            uint16_t thread;
+        };
+
+        std::vector<Zone> zones;
+        int64_t min = std::numeric_limits<int64_t>::max();
+        int64_t max = std::numeric_limits<int64_t>::min();
+        int64_t total = 0;
+        double sumSq = 0;
+        int64_t selfMin = std::numeric_limits<int64_t>::max();
+        int64_t selfMax = std::numeric_limits<int64_t>::min();
+        int64_t selfTotal = 0;
+    };
+
     struct CallstackFrameIdHash
     {
         size_t operator()( const CallstackFrameId& id ) const { return id.data; }
@@ -211,8 +266,7 @@ private:
         CpuArchitecture cpuArch = CpuArchUnknown;
 
         unordered_flat_map<uint64_t, const char*> strings;
-        Vector<const char*> stringData;
-        unordered_flat_map<charutil::StringKey, uint32_t, charutil::StringKey::Hasher, charutil::StringKey::Comparator> stringMap;
+        StringTable stringData;
         unordered_flat_map<uint64_t, const char*> threadNames;
         unordered_flat_map<uint64_t, std::pair<const char*, const char*>> externalNames;
 
@@ -226,6 +280,9 @@ private:
 #else
         unordered_flat_map<int16_t, uint64_t> sourceLocationZonesCnt;
 #endif
+        unordered_flat_map<int16_t, uint64_t> zonesDropped;
+        unordered_flat_map<int16_t, ZoneAggregateStats> zoneAggregateStats;
+        Vector<DataLossRange> dataLoss;
 
         unordered_flat_map<VarArray<CallstackFrameId>*, uint32_t, VarArrayHasher<CallstackFrameId>, VarArrayComparator<CallstackFrameId>> callstackMap;
         Vector<short_ptr<VarArray<CallstackFrameId>>> callstackPayload;
@@ -258,6 +315,7 @@ private:
 
         Vector<Vector<short_ptr<ZoneEvent>>> zoneChildren;
         Vector<Vector<short_ptr<GpuEvent>>> gpuChildren;
+        unordered_flat_map<const ZoneEvent*, ZoneColumns> zoneColumns;
 #ifndef TRACY_NO_STATISTICS
         Vector<Vector<GhostZone>> ghostChildren;
         Vector<CallstackFrameId> ghostFrames;
@@ -344,6 +402,25 @@ private:
         uint32_t csz;
     };
 
+    struct MemEventPending
+    {
+        uint32_t order;
+        bool alloc;
+        uint64_t thread;
+        int64_t time;
+        uint64_t ptr;
+        uint64_t size;
+        uint32_t callstack;
+    };
+
+    // Linear timer to time mapping, valid from the given timer value onwards.
+    struct TimerSegment
+    {
+        int64_t tsc;
+        int64_t time;
+        double mul;
+    };
+
 public:
     enum class Failure
     {
@@ -359,9 +436,12 @@ public:
         NUM_FAILURES
     };
 
-    Worker( const char* addr, int port );
+    // Number of compressed frames which may be received ahead of decompression.
+    enum { DefaultRecvFrames = 16 };
+
+    Worker( const char* addr, int port, int recvFrames = DefaultRecvFrames );
     Worker( const std::string& program, const std::vector<ImportEventTimeline>& timeline, const std::vector<ImportEventMessages>& messages );
-    Worker( FileRead& f, EventType::Type eventMask = EventType::All, bool bgTasks = true );
+    Worker( FileRead& f, EventType::Type eventMask = EventType::All, bool bgTasks = true, const LoadFilter& filter = LoadFilter() );
     ~Worker();
 
     const std::string& GetAddr() const { return m_addr; }
@@ -430,6 +510,7 @@ public:
     const Vector<ThreadData*>& GetThreadData() const { return m_data.threads; }
     const ThreadData* GetThreadData( uint64_t tid ) const;
     const MemData& GetMemData() const { return m_data.memory; }
+    uint64_t EstimateMemSize( uint64_t size ) const;
     const Vector<short_ptr<FrameImage>>& GetFrameImages() const { return m_data.frameImage; }
     const Vector<StringRef>& GetAppInfo() const { return m_data.appInfo; }
 
@@ -477,6 +558,7 @@ public:
 
     tracy_force_inline const Vector<short_ptr<ZoneEvent>>& GetZoneChildren( int32_t idx ) const { return m_data.zoneChildren[idx]; }
     tracy_force_inline const Vector<short_ptr<GpuEvent>>& GetGpuChildren( int32_t idx ) const { return m_data.gpuChildren[idx]; }
+    const ZoneColumns* GetZoneColumns( const Vector<ZoneEvent>& vec ) const;
 #ifndef TRACY_NO_STATISTICS
     tracy_force_inline const Vector<GhostZone>& GetGhostChildren( int32_t idx ) const { return m_data.ghostChildren[idx]; }
     tracy_force_inline const CallstackFrameId& GetGhostFrame( const Int24& frame ) const { return m_data.ghostFrames[frame.Val()]; }
@@ -485,7 +567,7 @@ public:
     tracy_force_inline const bool HasZoneExtra( const ZoneEvent& ev ) const { return ev.extra != 0; }
     tracy_force_inline const ZoneExtra& GetZoneExtra( const ZoneEvent& ev ) const { return m_data.zoneExtra[ev.extra]; }
 
-    std::vector<int16_t> GetMatchingSourceLocation( const char* query, bool ignoreCase ) const;
+    std::vector<int16_t> GetMatchingSourceLocation( const char* query, bool ignoreCase );
 
 #ifndef TRACY_NO_STATISTICS
     const SourceLocationZones& GetZonesForSourceLocation( int16_t srcloc ) const;
@@ -519,7 +601,7 @@ public:
     void Shutdown() { m_shutdown.store( true, std::memory_order_relaxed ); }
     void Disconnect();
 
-    void Write( FileWrite& f );
+    void Write( FileWrite& f, bool statsCache = false );
     int GetTraceVersion() const { return m_traceVersion; }
     uint8_t GetHandshakeStatus() const { return m_handshake.load( std::memory_order_relaxed ); }
     int64_t GetSamplingPeriod() const { return m_samplingPeriod; }
@@ -537,13 +619,24 @@ public:
     const Vector<Parameter>& GetParameters() const { return m_params; }
     void SetParameter( size_t paramIdx, int32_t val );
 
+    uint64_t GetZonesDropped( int16_t srcloc ) const;
+    const unordered_flat_map<int16_t, ZoneAggregateStats>& GetZoneAggregateStats() const { return m_data.zoneAggregateStats; }
+    const Vector<DataLossRange>& GetDataLoss() const { return m_data.dataLoss; }
+    int64_t GetZoneAggregateBucketTime( int bucket ) const { return bucket == 0 ? 0 : TscPeriod( 1ull << bucket ); }
+    uint32_t GetZoneThrottle( int16_t srcloc ) const;
+    void SetZoneThrottle( int16_t srcloc, ZoneThrottleMode mode, uint32_t value );
+
     const decltype(DataBlock::cpuTopology)& GetCpuTopology() const { return m_data.cpuTopology; }
     const CpuThreadTopology* GetThreadTopology( uint32_t cpuThread ) const;
 
     std::pair<uint64_t, uint64_t> GetTextureCompressionBytes() const { return std::make_pair( m_texcomp.GetInputBytesCount(), m_texcomp.GetOutputBytesCount() ); }
 
 private:
+    // Loaded per CPU context switch timelines of at least this size are packed.
+    enum { PackCpuDataMin = 1024 * 1024 };
+
     void Network();
+    void Decompress();
     void Exec();
     void Query( ServerQuery type, uint64_t data, uint32_t extra = 0 );
     void QueryTerminate();
@@ -590,7 +683,7 @@ private:
     tracy_force_inline void ProcessGpuZoneEnd( const QueueGpuZoneEnd& ev, bool serial );
     tracy_force_inline void ProcessGpuTime( const QueueGpuTime& ev );
     tracy_force_inline void ProcessMemAlloc( const QueueMemAlloc& ev );
-    tracy_force_inline bool ProcessMemFree( const QueueMemFree& ev );
+    tracy_force_inline void ProcessMemFree( const QueueMemFree& ev );
     tracy_force_inline void ProcessMemAllocCallstack( const QueueMemAlloc& ev );
     tracy_force_inline void ProcessMemFreeCallstack( const QueueMemFree& ev );
     tracy_force_inline void ProcessCallstackMemory( const QueueCallstackMemory& ev );
@@ -603,6 +696,10 @@ private:
     tracy_force_inline void ProcessCodeInformation( const QueueCodeInformation& ev );
     tracy_force_inline void ProcessCrashReport( const QueueCrashReport& ev );
     tracy_force_inline void ProcessSysTime( const QueueSysTime& ev );
+    tracy_force_inline void ProcessTimerCalibration( const QueueTimerCalibration& ev );
+    tracy_force_inline void ProcessZoneThrottleReport( const QueueZoneThrottleReport& ev );
+    tracy_force_inline void ProcessDataLoss( const QueueDataLoss& ev );
+    tracy_force_inline void ProcessZoneAggregate( const QueueZoneAggregate& ev );
     tracy_force_inline void ProcessContextSwitch( const QueueContextSwitch& ev );
     tracy_force_inline void ProcessThreadWakeup( const QueueThreadWakeup& ev );
     tracy_force_inline void ProcessTidToPid( const QueueTidToPid& ev );
@@ -634,7 +731,11 @@ private:
 
     tracy_force_inline void MemAllocChanged( int64_t time );
     void CreateMemAllocPlot();
-    void ReconstructMemAllocPlot();
+    void QueueMemEvent( const MemEventPending& ev );
+    void FlushMemEvents();
+    void HandleMemAlloc( const MemEventPending& ev );
+    void HandleMemFree( const MemEventPending& ev );
+    void ReconstructMemAllocPlot( bool freesSorted );
 
     void InsertMessageData( MessageData* msg );
 
@@ -670,6 +771,8 @@ private:
 
     tracy_force_inline void NewZone( ZoneEvent* zone, uint64_t thread );
 
+    LockMap& GetOrCreateLockMap( uint32_t id, LockType type, bool typeKnown );
+    LockEvent* AllocLockEvent( const LockMap& lockmap );
     void InsertLockEvent( LockMap& lockmap, LockEvent* lev, uint64_t thread, int64_t time );
 
     void CheckString( uint64_t ptr );
@@ -688,6 +791,8 @@ private:
     void AddSymbolCode( uint64_t ptr, const char* data, size_t sz );
 
     tracy_force_inline void AddCallstackPayload( uint64_t ptr, const char* data, size_t sz );
+    tracy_force_inline void AddZoneAggregatePayload( uint64_t ptr, const char* data, size_t sz );
+    void AddZoneAggregateStats( int16_t srcloc, const ZoneAggregate& agg );
     tracy_force_inline void AddCallstackAllocPayload( uint64_t ptr, const char* data, size_t sz );
 
     void InsertPlot( PlotData* plot, int64_t time, double val );
@@ -695,6 +800,7 @@ private:
     void HandleFrameName( uint64_t name, const char* str, size_t sz );
 
     void HandlePostponedPlots();
+    void HandlePostponedLocks();
     void HandlePostponedSamples();
 
     bool IsThreadStringRetrieved( uint64_t id );
@@ -704,6 +810,7 @@ private:
     void DispatchFailure( const QueueItem& ev, const char*& ptr );
 
     StringLocation StoreString( const char* str, size_t sz );
+    void UpdateSourceLocationIndex();
     const ContextSwitch* const GetContextSwitchDataImpl( uint64_t thread );
 
     tracy_force_inline Vector<short_ptr<ZoneEvent>>& GetZoneChildrenMutable( int32_t idx ) { return m_data.zoneChildren[idx]; }
@@ -711,22 +818,26 @@ private:
     tracy_force_inline Vector<GhostZone>& GetGhostChildrenMutable( int32_t idx ) { return m_data.ghostChildren[idx]; }
 #endif
 
+    void CalcContextSwitchUsage( Vector<ContextSwitchUsage>& vec );
 #ifndef TRACY_NO_STATISTICS
     void ReconstructContextSwitchUsage();
+    void UpdateCpuUsage( int64_t start, int64_t end, int own, int other );
     void UpdateSampleStatistics( uint32_t callstack, uint32_t count, bool canPostpone );
     void UpdateSampleStatisticsPostponed( decltype(Worker::DataBlock::postponedSamples.begin())& it );
     void UpdateSampleStatisticsImpl( const CallstackFrameData** frames, uint16_t framesCount, uint32_t count, const VarArray<CallstackFrameId>& cs );
 #endif
 
-    tracy_force_inline int64_t ReadTimeline( FileRead& f, ZoneEvent* zone, int64_t refTime, int32_t& childIdx );
     tracy_force_inline int64_t ReadTimelineHaveSize( FileRead& f, ZoneEvent* zone, int64_t refTime, int32_t& childIdx, uint32_t sz );
+    tracy_force_inline int64_t ReadTimelineHaveSizePre0612( FileRead& f, ZoneEvent* zone, int64_t refTime, int32_t& childIdx, uint32_t sz );
     tracy_force_inline void ReadTimelinePre063( FileRead& f, ZoneEvent* zone, int64_t& refTime, int32_t& childIdx, int fileVer );
     tracy_force_inline void ReadTimeline( FileRead& f, GpuEvent* zone, int64_t& refTime, int64_t& refGpuTime, int32_t& childIdx );
     tracy_force_inline void ReadTimelineHaveSize( FileRead& f, GpuEvent* zone, int64_t& refTime, int64_t& refGpuTime, int32_t& childIdx, uint64_t sz );
     tracy_force_inline void ReadTimelinePre0510( FileRead& f, GpuEvent* zone, int64_t& refTime, int64_t& refGpuTime, int fileVer );
 
 #ifndef TRACY_NO_STATISTICS
-    tracy_force_inline void ReconstructZoneStatistics( ZoneEvent& zone, uint16_t thread );
+    void ReconstructZoneStatistics();
+    void ReconstructZoneStatistics( unordered_flat_map<int16_t, SourceLocationZones>& slzMap, ZoneEvent* zone, ZoneEvent* end, uint16_t thread );
+    tracy_force_inline void ReconstructZoneStatistics( unordered_flat_map<int16_t, SourceLocationZones>& slzMap, ZoneEvent& zone, uint16_t thread );
 #else
     tracy_force_inline void CountZoneStatistics( ZoneEvent* zone );
 #endif
@@ -738,9 +849,14 @@ private:
     void UpdateMbps( int64_t td );
 
     int64_t ReadTimeline( FileRead& f, Vector<short_ptr<ZoneEvent>>& vec, uint32_t size, int64_t refTime, int32_t& childIdx );
+    int64_t ReadTimelinePre0612( FileRead& f, Vector<short_ptr<ZoneEvent>>& vec, uint32_t size, int64_t refTime, int32_t& childIdx );
+    uint64_t ReadTimelineFiltered( FileRead& f, Vector<short_ptr<ZoneEvent>>& vec, uint32_t size, int32_t& childIdx, const LoadFilter& filter, const unordered_flat_set<int16_t>& zoneFilter );
+    uint64_t SkipTimeline( FileRead& f, uint32_t size );
+    void ReadLockTimelineFiltered( FileRead& f, LockMap& lockmap, uint64_t size, const LoadFilter& filter );
     void ReadTimelinePre063( FileRead& f, Vector<short_ptr<ZoneEvent>>& vec, uint64_t size, int64_t& refTime, int32_t& childIdx, int fileVer );
     void ReadTimeline( FileRead& f, Vector<short_ptr<GpuEvent>>& vec, uint64_t size, int64_t& refTime, int64_t& refGpuTime, int32_t& childIdx );
     void ReadTimelinePre0510( FileRead& f, Vector<short_ptr<GpuEvent>>& vec, uint64_t size, int64_t& refTime, int64_t& refGpuTime, int fileVer );
+    void BuildZoneColumns( const Vector<short_ptr<ZoneEvent>>& vec );
 
     tracy_force_inline void WriteTimeline( FileWrite& f, const Vector<short_ptr<ZoneEvent>>& vec, int64_t& refTime );
     tracy_force_inline void WriteTimeline( FileWrite& f, const Vector<short_ptr<GpuEvent>>& vec, int64_t& refTime, int64_t& refGpuTime );
@@ -749,8 +865,23 @@ private:
     template<typename Adapter, typename V>
     void WriteTimelineImpl( FileWrite& f, const V& vec, int64_t& refTime, int64_t& refGpuTime );
 
-    int64_t TscTime( int64_t tsc ) { return int64_t( tsc * m_timerMul ); }
-    int64_t TscTime( uint64_t tsc ) { return int64_t( tsc * m_timerMul ); }
+    void WriteStatisticsCache( FileWrite& f );
+    void CacheTimeline( unordered_flat_map<int16_t, SourceLocationZonesCache>& cache, const Vector<short_ptr<ZoneEvent>>& vec, uint32_t vecIdx, uint16_t thread, uint32_t& childIdx );
+    template<typename Adapter, typename V>
+    void CacheTimelineImpl( unordered_flat_map<int16_t, SourceLocationZonesCache>& cache, const V& vec, uint32_t vecIdx, uint16_t thread, uint32_t& childIdx );
+
+    tracy_force_inline int64_t TscTime( int64_t tsc )
+    {
+        if( tsc >= m_timerLast.tsc )
+        {
+            if( tsc > m_timerMaxTsc ) m_timerMaxTsc = tsc;
+            return m_timerLast.time + int64_t( ( tsc - m_timerLast.tsc ) * m_timerLast.mul );
+        }
+        return TscTimeSegment( tsc );
+    }
+    int64_t TscTimeSegment( int64_t tsc ) const;
+    int64_t TscPeriod( uint64_t tsc ) const { return int64_t( tsc * m_timerMul ); }
+    void InitTimerMapping();
 
     Socket m_sock;
     std::string m_addr;
@@ -758,12 +889,13 @@ private:
 
     std::thread m_thread;
     std::thread m_threadNet;
+    std::thread m_threadDecompress;
     std::atomic<bool> m_connected { false };
     std::atomic<bool> m_hasData;
     std::atomic<bool> m_shutdown { false };
 
     std::atomic<bool> m_backgroundDone { true };
-    std::thread m_threadBackground;
+    TaskGroup m_backgroundTasks;
 
     int64_t m_delay;
     int64_t m_resolution;
@@ -781,11 +913,14 @@ private:
     char* m_buffer;
     int m_bufferOffset;
     bool m_onDemand;
+    bool m_lateJoin = false;    // attached to an on-demand session which was already shared with another server
     bool m_ignoreMemFreeFaults;
 
     short_ptr<GpuCtxData> m_gpuCtxMap[256];
     unordered_flat_map<uint64_t, StringLocation> m_pendingCustomStrings;
     uint64_t m_pendingCallstackPtr = 0;
+    uint64_t m_pendingZoneAggregatePtr = 0;
+    std::vector<QueueZoneAggregateEntry> m_pendingZoneAggregate;
     uint32_t m_pendingCallstackId;
     unordered_flat_map<uint64_t, int16_t> m_pendingSourceLocationPayload;
     Vector<uint64_t> m_sourceLocationQueue;
@@ -809,14 +944,31 @@ private:
     uint64_t m_callstackAllocNextIdx = 0;
     uint64_t m_callstackParentNextIdx = 0;
 
-    uint64_t m_lastMemActionCallstack;
-    bool m_lastMemActionWasAlloc;
+    std::vector<MemEventPending> m_memEventWindow;
+    unordered_flat_map<uint64_t, MemEventPending> m_memEventCallstack;
+    uint32_t m_memNextOrder = 0;
+    uint32_t m_memJoinOrder = 0;
+    bool m_memJoinFilter = false;
+    int64_t m_memLastTime = 0;
+
+    std::vector<TimerSegment> m_timerSegments;
+    TimerSegment m_timerLast = {};
+    int64_t m_timerMaxTsc = 0;
+    bool m_timerCalibrated = false;
+    int64_t m_timerCalibTsc = 0;
+    int64_t m_timerCalibNs = 0;
+    int64_t m_timerCalibOffset = 0;
 
     Slab<64*1024*1024> m_slab;
 
     DataBlock m_data;
     MbpsBlock m_mbpsData;
 
+    TrigramIndex<int16_t> m_srclocIndex;
+    std::vector<int16_t> m_srclocIndexPending;
+    size_t m_srclocIndexExpand = 1;
+    size_t m_srclocIndexPayload = 0;
+
     int m_traceVersion;
     std::atomic<uint8_t> m_handshake { 0 };
 
@@ -845,6 +997,9 @@ private:
 
     std::atomic<uint64_t> m_bytes { 0 };
     std::atomic<uint64_t> m_decBytes { 0 };
+    uint64_t m_drainItems = 0;
+    bool m_queueBudget = false;
+    int64_t m_drainTime = 0;
 
     struct NetBuffer
     {
@@ -860,11 +1015,21 @@ private:
     std::mutex m_netWriteLock;
     std::condition_variable m_netWriteCv;
 
+    char* m_recvBuffer = nullptr;       // ring of m_recvFrames compressed frames
+    std::vector<lz4sz_t> m_recvSize;
+    int m_recvFrames = 0;
+    int m_recvCnt = 0;
+    bool m_recvStart = false;
+    bool m_recvEnd = false;
+    std::mutex m_recvLock;
+    std::condition_variable m_recvCv;
+
 #ifdef TRACY_NO_STATISTICS
     Vector<ZoneEvent*> m_zoneEventPool;
 #endif
 
     Vector<Parameter> m_params;
+    unordered_flat_map<int16_t, uint32_t> m_zoneThrottle;
 };
 
 }
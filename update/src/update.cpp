@@ -22,10 +22,15 @@
 
 void Usage()
 {
-    printf( "Usage: update [--hc|--extreme] input.tracy output.tracy\n\n" );
+    printf( "Usage: update [options] input.tracy output.tracy\n\n" );
     printf( "  --hc: enable LZ4HC compression\n" );
     printf( "  --extreme: enable extreme LZ4HC compression (very slow)\n" );
     printf( "  --zstd level: use Zstd compression with given compression level\n" );
+    printf( "  --cache: store derived statistics, to speed up trace loading\n" );
+    printf( "  --range start end: only keep data in given time range (in seconds)\n" );
+    printf( "  --thread id: only keep given thread (may be repeated)\n" );
+    printf( "  --zone name: only keep top-level zones with given name (may be repeated)\n\n" );
+    printf( "Filtering options require input trace version 0.6.12 or newer.\n" );
     exit( 1 );
 }
 
@@ -40,40 +45,69 @@ int main( int argc, char** argv )
 #endif
 
     tracy::FileWrite::Compression clev = tracy::FileWrite::Compression::Fast;
+    tracy::LoadFilter filter;
+    bool statsCache = false;
 
     int zstdLevel = 1;
-    if( argc != 3 && argc != 4 && argc != 5 ) Usage();
-    if( argc == 4 )
+    argv++;
+    argc--;
+    while( argc > 2 )
     {
-        if( strcmp( argv[1], "--hc" ) == 0 )
+        if( strcmp( argv[0], "--hc" ) == 0 )
         {
             clev = tracy::FileWrite::Compression::Slow;
         }
-        else if( strcmp( argv[1], "--extreme" ) == 0 )
+        else if( strcmp( argv[0], "--extreme" ) == 0 )
         {
             clev = tracy::FileWrite::Compression::Extreme;
         }
+        else if( strcmp( argv[0], "--cache" ) == 0 )
+        {
+            statsCache = true;
+        }
+        else if( strcmp( argv[0], "--zstd" ) == 0 && argc > 3 )
+        {
+            clev = tracy::FileWrite::Compression::Zstd;
+            zstdLevel = atoi( argv[1] );
+            if( zstdLevel > ZSTD_maxCLevel() || zstdLevel < ZSTD_minCLevel() )
+            {
+                printf( "Available Zstd compression levels range: %i - %i\n", ZSTD_minCLevel(), ZSTD_maxCLevel() );
+                exit( 1 );
+            }
+            argv++;
+            argc--;
+        }
+        else if( strcmp( argv[0], "--range" ) == 0 && argc > 4 )
+        {
+            filter.timeMin = int64_t( atof( argv[1] ) * 1000000000. );
+            filter.timeMax = int64_t( atof( argv[2] ) * 1000000000. );
+            if( filter.timeMin > filter.timeMax ) Usage();
+            argv += 2;
+            argc -= 2;
+        }
+        else if( strcmp( argv[0], "--thread" ) == 0 && argc > 3 )
+        {
+            filter.threads.emplace_back( strtoull( argv[1], nullptr, 10 ) );
+            argv++;
+            argc--;
+        }
+        else if( strcmp( argv[0], "--zone" ) == 0 && argc > 3 )
+        {
+            filter.zones.emplace_back( argv[1] );
+            argv++;
+            argc--;
+        }
         else
         {
             Usage();
         }
         argv++;
+        argc--;
     }
-    if( argc == 5 )
-    {
-        if( strcmp( argv[1], "--zstd" ) != 0 ) Usage();
-        clev = tracy::FileWrite::Compression::Zstd;
-        zstdLevel = atoi( argv[2] );
-        if( zstdLevel > ZSTD_maxCLevel() || zstdLevel < ZSTD_minCLevel() )
-        {
-            printf( "Available Zstd compression levels range: %i - %i\n", ZSTD_minCLevel(), ZSTD_maxCLevel() );
-            exit( 1 );
-        }
-        argv += 2;
-    }
+    if( argc != 2 ) Usage();
 
-    const char* input = argv[1];
-    const char* output = argv[2];
+    const char* input = argv[0];
+    const char* output = argv[1];
 
     printf( "Loading...\r" );
     fflush( stdout );
@@ -91,7 +125,7 @@ int main( int argc, char** argv )
         int inVer;
         {
             const auto t0 = std::chrono::high_resolution_clock::now();
-            tracy::Worker worker( *f, tracy::EventType::All, false );
+            tracy::Worker worker( *f, tracy::EventType::All, false, filter );
 
 #ifndef TRACY_NO_STATISTICS
             while( !worker.AreSourceLocationZonesReady() ) std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
@@ -105,7 +139,7 @@ int main( int argc, char** argv )
             }
             printf( "Saving... \r" );
             fflush( stdout );
-            worker.Write( *w );
+            worker.Write( *w, statsCache );
             w->Finish();
             const auto t1 = std::chrono::high_resolution_clock::now();
             const auto stats = w->GetCompressionStatistics();